@@ -0,0 +1,100 @@
+import argparse
+import csv
+import math
+
+# SAE J211 places the design frequency of a CFC filter at 2.0775*CFC
+CFC_DESIGN_RATIO = 2.0775
+
+
+def j211_coefficients(cfc, sample_rate):
+    # these equations come straight from SAE J211-1 appendix C
+    wd = 2 * math.pi * cfc * CFC_DESIGN_RATIO
+    half_angle = wd / (2 * sample_rate)
+    if cfc <= 0 or sample_rate <= 0 or half_angle >= math.pi / 2:
+        raise ValueError("CFC {} can not be realized at {}Hz".format(cfc, sample_rate))
+    wa = math.tan(half_angle)
+    denominator = 1 + math.sqrt(2) * wa + wa * wa
+    a0 = wa * wa / denominator
+    b1 = -2 * (wa * wa - 1) / denominator
+    b2 = (-1 + math.sqrt(2) * wa - wa * wa) / denominator
+    return a0, 2 * a0, a0, b1, b2
+
+
+def single_pass(data, coefficients):
+    a0, a1, a2, b1, b2 = coefficients
+    # start the filter settled on the first sample so offsets don't ring through the output
+    x1 = x2 = y1 = y2 = data[0]
+    out = []
+    for x in data:
+        y = a0 * x + a1 * x1 + a2 * x2 + b1 * y1 + b2 * y2
+        x2, x1 = x1, x
+        y2, y1 = y1, y
+        out.append(y)
+    return out
+
+
+def filtfilt(data, cfc, sample_rate):
+    """
+    Zero phase CFC filter as described in SAE J211. A 2-pole butterworth section is run forward and then
+    backward over the data which gives a 4-pole magnitude response with no phase lag.
+    """
+    if len(data) == 0:
+        return []
+    coefficients = j211_coefficients(cfc, sample_rate)
+    forward = single_pass(data, coefficients)
+    return single_pass(forward[::-1], coefficients)[::-1]
+
+
+def filter_columns(header, rows, cfc_for_column, sample_rate):
+    """
+    Filter every column that cfc_for_column returns a CFC for and recompute the magnitude columns
+    """
+    columns = list(zip(*rows)) if rows else [[] for _ in header]
+    columns = [[float(v) for v in column] for column in columns]
+    for i, name in enumerate(header):
+        cfc = cfc_for_column(name)
+        if cfc:
+            columns[i] = filtfilt(columns[i], cfc, sample_rate)
+
+    # the magnitude of a filtered vector is not the filtered magnitude, so rebuild it from the axes
+    for i, name in enumerate(header):
+        if name.endswith(":Magnitude") and i >= 3:
+            columns[i] = [math.sqrt(x * x + y * y + z * z) for x, y, z in zip(columns[i - 3], columns[i - 2], columns[i - 1])]
+    return [list(row) for row in zip(*columns)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Apply SAE J211 zero phase CFC filters to an exported impact CSV")
+    parser.add_argument("input", help="the csv file to filter")
+    parser.add_argument("output", help="where to write the filtered csv")
+    parser.add_argument("--rate", type=float, default=500, help="the rate the data was sampled at in Hz")
+    # the dummy can filter its streams as they are sampled and a CSV doesn't say which, so nothing is filtered by default
+    parser.add_argument("--accel-cfc", type=float, default=0, help="CFC for acceleration columns. Only for data the dummy didn't filter (0 to skip)")
+    parser.add_argument("--gyro-cfc", type=float, default=0, help="CFC for angular rate columns. Only for data the dummy didn't filter (0 to skip)")
+    args = parser.parse_args()
+    if not args.accel_cfc and not args.gyro_cfc:
+        parser.error("give --accel-cfc or --gyro-cfc. Binary logs can be filtered with log_to_csv.py --filter, which skips the streams the dummy filtered")
+
+    def cfc_for_column(name):
+        if name.endswith(":Magnitude"):
+            return 0
+        if "Accel" in name:
+            return args.accel_cfc
+        if "Gyro" in name:
+            return args.gyro_cfc
+        return 0
+
+    with open(args.input, 'r') as f:
+        data = [row for row in csv.reader(f) if row]
+    header, rows = data[0], data[1:]
+    rows = filter_columns(header, rows, cfc_for_column, args.rate)
+
+    with open(args.output, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(header)
+        for row in rows:
+            writer.writerow(["{:.6f}".format(v) for v in row])
+
+
+if __name__ == "__main__":
+    main()
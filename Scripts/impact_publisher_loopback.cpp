@@ -0,0 +1,269 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Runs ImpactPublisher against a loopback transport on a computer and decodes what it sends the same way the
+ * sideline tablet does, to check the batching, the queue while no client is connected and the frame layout.
+ * Build and run from the top of the repo:
+ * g++ -O2 -std=c++17 -Ilib/Telemetry -Ilib/Checksum Scripts/impact_publisher_loopback.cpp lib/Telemetry/ImpactPublisher.cpp lib/Telemetry/COBS.cpp lib/Checksum/CRC32.cpp -o impact_publisher_loopback
+ * ./impact_publisher_loopback
+*/
+
+#include "ImpactPublisher.h"
+#include "CRC32.h"
+#include "ByteOrder.h"
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition) do{ if(!(condition)){ printf("FAIL line %d: %s\n", __LINE__, #condition); failures++; } }while(0)
+
+/**
+ * @brief keeps every write in memory instead of sending it
+ */
+class LoopbackTransport : public ImpactTransport{
+    public:
+        bool isConnected() override{
+            return connected;
+        }
+
+        size_t send(const uint8_t* data, size_t length) override{
+            writes++;
+            // let part of a frame out to act like a link that gave up mid write
+            size_t taken = failNext ? length / 2 : length;
+            failNext = false;
+            bytes.insert(bytes.end(), data, data + taken);
+            return taken;
+        }
+
+        bool connected = false;
+        bool failNext = false;
+        int writes = 0;
+        std::vector<uint8_t> bytes;
+};
+
+struct DecodedSummary{
+    uint32_t sequence;
+    uint32_t time;
+    int64_t syncedTime;
+    uint16_t duration;
+    uint16_t peakLinear;
+    uint16_t peakRotational;
+    uint16_t risk;
+    int32_t peakLeftLoad;
+    int32_t peakRightLoad;
+    int8_t direction[3];
+};
+
+static bool cobsDecode(const std::vector<uint8_t>& in, std::vector<uint8_t>& out){
+    size_t index = 0;
+    while(index < in.size()){
+        uint8_t code = in[index];
+        if(code == 0 || index + code > in.size() + 1){
+            return false;
+        }
+        out.insert(out.end(), in.begin() + index + 1, in.begin() + index + code);
+        index += code;
+        if(code < 0xFF && index < in.size()){
+            out.push_back(0);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief split the bytes at the zeros and decode every impact frame. Frames that fail their CRC are counted
+ */
+static std::vector<std::vector<DecodedSummary>> decode(const std::vector<uint8_t>& bytes, int* badFrames){
+    std::vector<std::vector<DecodedSummary>> frames;
+    std::vector<uint8_t> chunk;
+    *badFrames = 0;
+    for(uint8_t byte : bytes){
+        if(byte != 0){
+            chunk.push_back(byte);
+            continue;
+        }
+        if(chunk.empty()){
+            continue;
+        }
+        std::vector<uint8_t> frame;
+        if(!cobsDecode(chunk, frame) || frame.size() < 6 ||
+            crc32(frame.data(), frame.size() - 4) != getUInt32(&frame[frame.size() - 4]) ||
+            frame[0] != TELEMETRY_FRAME_IMPACTS || frame.size() != (size_t)(2 + frame[1] * IMPACT_SUMMARY_BYTES + 4)){
+            (*badFrames)++;
+            chunk.clear();
+            continue;
+        }
+        std::vector<DecodedSummary> summaries;
+        const uint8_t* p = &frame[2];
+        for(uint8_t i = 0; i < frame[1]; i++){
+            DecodedSummary s;
+            s.sequence = getUInt32(p);
+            s.time = getUInt32(p + 4);
+            s.syncedTime = (int64_t)((uint64_t)getUInt32(p + 8) | ((uint64_t)getUInt32(p + 12) << 32));
+            s.duration = getUInt16(p + 16);
+            s.peakLinear = getUInt16(p + 18);
+            s.peakRotational = getUInt16(p + 20);
+            s.risk = getUInt16(p + 22);
+            s.peakLeftLoad = (int32_t)getUInt32(p + 24);
+            s.peakRightLoad = (int32_t)getUInt32(p + 28);
+            s.direction[0] = (int8_t)p[32];
+            s.direction[1] = (int8_t)p[33];
+            s.direction[2] = (int8_t)p[34];
+            summaries.push_back(s);
+            p += IMPACT_SUMMARY_BYTES;
+        }
+        frames.push_back(summaries);
+        chunk.clear();
+    }
+    return frames;
+}
+
+static ImpactSummary makeImpact(uint32_t time){
+    ImpactSummary impact;
+    impact.time = time;
+    // a time in 2023 on the host's clock, past what fits in 32 bits
+    impact.syncedTime = 1679836800000000LL + time;
+    impact.duration = 12;
+    impact.peakLinear = 87.46;
+    impact.peakRotational = 3210.4;
+    impact.risk = 0.4567;
+    impact.peakLeftLoad = -1500;
+    impact.peakRightLoad = 250000;
+    impact.direction[0] = 0;
+    impact.direction[1] = -30;
+    impact.direction[2] = 40;
+    return impact;
+}
+
+// impacts wait while nobody is connected and go out together once someone is
+static void testQueuedUntilConnected(){
+    LoopbackTransport link;
+    ImpactPublisher publisher(&link);
+    for(uint32_t i = 0; i < 3; i++){
+        publisher.publish(makeImpact(1000 + i), 1000 + i);
+    }
+    CHECK(publisher.update(5000) == 0);
+    CHECK(link.writes == 0 && publisher.getPending() == 3);
+
+    link.connected = true;
+    CHECK(publisher.update(5001) == 3);
+    CHECK(link.writes == 1);
+    int bad;
+    auto frames = decode(link.bytes, &bad);
+    CHECK(bad == 0 && frames.size() == 1 && frames[0].size() == 3);
+    for(uint32_t i = 0; i < 3 && frames.size() == 1 && frames[0].size() == 3; i++){
+        const DecodedSummary& s = frames[0][i];
+        CHECK(s.sequence == i && s.time == 1000 + i && s.syncedTime == 1679836800000000LL + 1000 + i);
+        CHECK(s.duration == 12 && s.peakLinear == 875 && s.peakRotational == 3210 && s.risk == 457);
+        CHECK(s.peakLeftLoad == -1500 && s.peakRightLoad == 250000);
+        // 0, -0.6, 0.8 as a unit vector
+        CHECK(s.direction[0] == 0 && s.direction[1] == -76 && s.direction[2] == 102);
+    }
+    CHECK(publisher.getSent() == 3 && publisher.getPending() == 0);
+}
+
+// a burst of impacts waits for the coalescing window and goes out in one write
+static void testBurstCoalesced(){
+    LoopbackTransport link;
+    link.connected = true;
+    ImpactPublisher publisher(&link);
+    publisher.publish(makeImpact(100), 100);
+    CHECK(publisher.update(100) == 0);
+    publisher.publish(makeImpact(120), 120);
+    publisher.publish(makeImpact(140), 140);
+    CHECK(publisher.update(100 + IMPACT_COALESCE_MS - 1) == 0);
+    CHECK(link.writes == 0);
+    CHECK(publisher.update(100 + IMPACT_COALESCE_MS) == 3);
+    CHECK(link.writes == 1 && publisher.getFramesSent() == 1);
+
+    // a full frame doesn't wait
+    for(uint32_t i = 0; i < IMPACT_FRAME_SUMMARIES; i++){
+        publisher.publish(makeImpact(1000), 1000);
+    }
+    CHECK(publisher.update(1000) == IMPACT_FRAME_SUMMARIES);
+    CHECK(link.writes == 2);
+}
+
+// the newest impacts are kept when the queue fills and the sequence numbers show what was dropped
+static void testOverflow(){
+    LoopbackTransport link;
+    ImpactPublisher publisher(&link);
+    const uint32_t total = IMPACT_QUEUE_LENGTH + 8;
+    for(uint32_t i = 0; i < total; i++){
+        publisher.publish(makeImpact(i), i);
+    }
+    CHECK(publisher.getDropped() == 8 && publisher.getPending() == IMPACT_QUEUE_LENGTH);
+
+    link.connected = true;
+    CHECK(publisher.update(total + IMPACT_COALESCE_MS) == IMPACT_QUEUE_LENGTH);
+    int bad;
+    auto frames = decode(link.bytes, &bad);
+    size_t expectedFrames = (IMPACT_QUEUE_LENGTH + IMPACT_FRAME_SUMMARIES - 1) / IMPACT_FRAME_SUMMARIES;
+    CHECK(bad == 0 && frames.size() == expectedFrames && link.writes == (int)expectedFrames);
+    uint32_t next = 8;
+    for(auto& frame : frames){
+        for(auto& s : frame){
+            CHECK(s.sequence == next && s.time == next);
+            next++;
+        }
+    }
+    CHECK(next == total);
+}
+
+// a write that doesn't take the whole frame is sent again, and the host skips the piece that got out
+static void testShortWrite(){
+    LoopbackTransport link;
+    link.connected = true;
+    link.failNext = true;
+    ImpactPublisher publisher(&link);
+    publisher.publish(makeImpact(7), 0);
+    CHECK(publisher.update(IMPACT_COALESCE_MS) == 0);
+    CHECK(publisher.getWriteFailures() == 1 && publisher.getPending() == 1);
+    CHECK(publisher.update(IMPACT_COALESCE_MS + 1) == 1);
+    int bad;
+    auto frames = decode(link.bytes, &bad);
+    CHECK(bad == 1 && frames.size() == 1 && frames[0].size() == 1 && frames[0][0].time == 7);
+}
+
+// values that don't fit are clamped instead of wrapping
+static void testClamping(){
+    LoopbackTransport link;
+    link.connected = true;
+    ImpactPublisher publisher(&link);
+    ImpactSummary impact;
+    impact.duration = 100000;
+    impact.peakLinear = 9000;
+    impact.peakRotational = -5;
+    impact.risk = NAN;
+    impact.peakLeftLoad = 1e12;
+    impact.peakRightLoad = -1e12;
+    publisher.publish(impact, 0);
+    publisher.update(IMPACT_COALESCE_MS);
+    int bad;
+    auto frames = decode(link.bytes, &bad);
+    CHECK(frames.size() == 1 && frames[0].size() == 1);
+    if(frames.size() == 1 && frames[0].size() == 1){
+        const DecodedSummary& s = frames[0][0];
+        CHECK(s.duration == UINT16_MAX && s.peakLinear == UINT16_MAX && s.peakRotational == 0 && s.risk == 0);
+        CHECK(s.peakLeftLoad == INT32_MAX && s.peakRightLoad == INT32_MIN);
+        // an impact from before the clock was synced
+        CHECK(s.syncedTime == 0);
+        CHECK(s.direction[0] == 0 && s.direction[1] == 0 && s.direction[2] == 0);
+    }
+}
+
+int main(){
+    testQueuedUntilConnected();
+    testBurstCoalesced();
+    testOverflow();
+    testShortWrite();
+    testClamping();
+    if(failures > 0){
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all impact publisher checks passed\n");
+    return 0;
+}
@@ -0,0 +1,221 @@
+import argparse
+import os
+import struct
+import sys
+import time
+import zlib
+
+from telemetry import cobs_decode
+
+TELEMETRY_FRAME_FILE_CHUNK = 0x03
+TELEMETRY_FRAME_FILE_END = 0x04
+
+
+class Link:
+    """
+    Sends commands to the dummy and splits what comes back into binary frames and lines of text.
+    Frames are COBS encoded between zero bytes with a CRC-32 at the end. See Telemetry.h for the layout
+    """
+
+    def __init__(self, port):
+        self.port = port
+        self.buffer = bytearray()
+        self.bad_frames = 0
+        # time.time_ns() when the last bytes arrived, for Scripts/time_sync.py
+        self.read_time = None
+
+    def send(self, *args):
+        self.port.write("!{};".format(",".join(str(a) for a in args)).encode("ascii"))
+        self.port.flush()
+
+    def read(self):
+        """
+        Yield ("frame", bytes) or ("text", line) for everything that arrives, and ("idle", None) after each read
+        so the caller can give up. Live telemetry frames keep arriving during a transfer, so the caller decides
+        what counts as progress
+        """
+        while True:
+            # take what has arrived without waiting for a full 4096 bytes, so a reply is seen as soon as it comes
+            data = self.port.read(max(1, min(4096, self.port.in_waiting)))
+            yield "idle", None
+            if not data:
+                continue
+            self.read_time = time.time_ns()
+            self.buffer += data
+            while True:
+                end = self.buffer.find(b"\x00")
+                if end < 0:
+                    break
+                chunk = bytes(self.buffer[:end])
+                del self.buffer[:end + 1]
+                if not chunk:
+                    continue
+                frame = cobs_decode(chunk)
+                if frame is not None and len(frame) >= 5 and zlib.crc32(frame[:-4]) == struct.unpack_from("<I", frame, len(frame) - 4)[0]:
+                    yield "frame", frame[:-4]
+                elif all(32 <= b < 127 or b in (9, 10, 13) for b in chunk):
+                    for line in chunk.decode("ascii").splitlines():
+                        if line.strip():
+                            yield "text", line.strip()
+                else:
+                    # a chunk that was damaged on the way. The gap in the offsets gets it sent again
+                    self.bad_frames += 1
+            # replies printed while no frames are being sent never get a zero after them, so take whole lines of text
+            # as soon as they arrive. A frame can't be mistaken for text since its type byte isn't printable
+            end = self.buffer.rfind(b"\n")
+            if end >= 0 and all(32 <= b < 127 or b in (9, 10, 13) for b in self.buffer[:end + 1]):
+                lines = bytes(self.buffer[:end + 1])
+                del self.buffer[:end + 1]
+                for line in lines.decode("ascii").splitlines():
+                    if line.strip():
+                        yield "text", line.strip()
+
+
+def list_files(link, timeout):
+    """
+    Ask for the file list. Returns a list of (index, name, size, crc)
+    """
+    link.send(23)
+    files = []
+    last_progress = time.time()
+    for kind, value in link.read():
+        if time.time() - last_progress > timeout:
+            break
+        if kind != "text":
+            continue
+        if value.startswith("!File,"):
+            last_progress = time.time()
+            index, name, size, crc = value[len("!File,"):].rstrip(";").split(",")
+            files.append((int(index), name, int(size), int(crc)))
+        elif value.startswith("!FileListEnd,"):
+            return files
+        elif value.startswith("!ERR,23"):
+            raise RuntimeError(value)
+    raise TimeoutError("no file list from the dummy")
+
+
+def download(link, index, name, size, crc, out_dir, timeout, retries):
+    """
+    Download one file. A partial download is kept as <name>.part and picked up from where it stopped,
+    even by a later run of this script
+    """
+    path = os.path.join(out_dir, name)
+    part_path = path + ".part"
+    if os.path.exists(path) and os.path.getsize(path) == size and file_crc(path) == crc:
+        print("{} already downloaded".format(name))
+        return True
+    mode = "r+b" if os.path.exists(part_path) else "w+b"
+    with open(part_path, mode) as part:
+        part.seek(0, os.SEEK_END)
+        offset = min(part.tell(), size)
+        part.truncate(offset)
+        # the device carries this on over the rest of the file instead of reading the start again
+        part_crc = file_crc(part_path) if offset > 0 else 0
+        attempts = 0
+        started = False
+        while attempts <= retries:
+            if started:
+                print("  resuming {} at {}".format(name, offset), file=sys.stderr)
+            # commands only carry signed 32 bit ints
+            link.send(24, index, offset, part_crc - (1 << 32) if part_crc >= (1 << 31) else part_crc)
+            started = True
+            attempts += 1
+            # chunks from the transfer this request replaced can still be on the way, so only take the one we asked for
+            restarting = True
+            last_progress = time.time()
+            for kind, value in link.read():
+                if time.time() - last_progress > timeout:
+                    break
+                if kind == "idle":
+                    continue
+                if kind == "text":
+                    if value.startswith("!ERR,24"):
+                        raise RuntimeError(value)
+                    continue
+                if value[0] == TELEMETRY_FRAME_FILE_CHUNK:
+                    file, sequence, chunk_offset, length = struct.unpack_from("<BIIB", value, 1)
+                    if file != index or chunk_offset < offset:
+                        continue
+                    if chunk_offset > offset:
+                        if restarting:
+                            continue
+                        # a chunk went missing. Ask again from the first byte we don't have
+                        break
+                    restarting = False
+                    last_progress = time.time()
+                    # only transfers that get nowhere count against the retries
+                    attempts = 0
+                    part.write(value[11:11 + length])
+                    part_crc = zlib.crc32(value[11:11 + length], part_crc)
+                    offset += length
+                    progress(name, offset, size)
+                elif value[0] == TELEMETRY_FRAME_FILE_END:
+                    file, sequence, end_size, end_crc = struct.unpack_from("<BIII", value, 1)
+                    if file != index or end_size != offset:
+                        continue
+                    part.flush()
+                    print(file=sys.stderr)
+                    # the end CRC only covers what this transfer sent on top of ours, so also check against the list
+                    if part_crc != end_crc or part_crc != crc:
+                        # the pieces don't add up, so start over
+                        print("  CRC mismatch on {}, starting over".format(name), file=sys.stderr)
+                        part.seek(0)
+                        part.truncate(0)
+                        offset = 0
+                        part_crc = 0
+                        break
+                    part.close()
+                    os.replace(part_path, path)
+                    return True
+    print("gave up on {} after {} attempts".format(name, attempts), file=sys.stderr)
+    return False
+
+
+def file_crc(path):
+    crc = 0
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(65536), b""):
+            crc = zlib.crc32(block, crc)
+    return crc
+
+
+def progress(name, offset, size):
+    print("\r  {} {}/{} bytes".format(name, offset, size), end="", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Download logs from the dummy's SD card over serial or Bluetooth")
+    parser.add_argument("--port", required=True, help="serial port or Bluetooth serial port of the dummy")
+    parser.add_argument("--baud", type=int, default=921600, help="baud rate, TELEMETRY_BAUD in main.cpp")
+    parser.add_argument("--list", action="store_true", help="only list the files")
+    parser.add_argument("--get", action="append", help="name of a file to download. Can be given more than once")
+    parser.add_argument("--all", action="store_true", help="download every file")
+    parser.add_argument("--out", default=".", help="directory to put the files in")
+    parser.add_argument("--timeout", type=float, default=3, help="seconds without data before a transfer is resumed")
+    parser.add_argument("--retries", type=int, default=20, help="how many times a file is resumed before giving up")
+    args = parser.parse_args()
+
+    import serial
+    link = Link(serial.Serial(args.port, args.baud, timeout=0.1))
+    # the list takes a while since the dummy works out the CRC of every file
+    files = list_files(link, max(args.timeout, 30))
+    if args.list or not (args.get or args.all):
+        for index, name, size, crc in files:
+            print("{:>3} {:<24} {:>10} {:08x}".format(index, name, size, crc))
+        return
+
+    os.makedirs(args.out, exist_ok=True)
+    ok = True
+    for index, name, size, crc in files:
+        if args.all or name in args.get:
+            ok = download(link, index, name, size, crc, args.out, args.timeout, args.retries) and ok
+    missing = set(args.get or []) - set(name for _, name, _, _ in files)
+    for name in missing:
+        print("{} is not on the card".format(name), file=sys.stderr)
+    if link.bad_frames:
+        print("{} damaged frames were sent again".format(link.bad_frames), file=sys.stderr)
+    sys.exit(0 if ok and not missing else 1)
+
+
+if __name__ == "__main__":
+    main()
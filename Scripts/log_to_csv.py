@@ -0,0 +1,431 @@
+import argparse
+import bisect
+import csv
+import math
+import os
+import struct
+import sys
+import zlib
+
+import cfc_filter
+
+BINARY_LOG_MAGIC = b"STDL"
+BINARY_RECORD_ROW = 0x52
+BINARY_RECORD_KEYFRAME = 0x4B
+BINARY_RECORD_DELTA = 0x44
+BINARY_RECORD_FOOTER = 0x46
+BINARY_RECORD_FRAME = 0x4A
+BINARY_RECORD_TIME = 0x54
+BINARY_FLAG_JOURNALED = 0x01
+BINARY_FLAG_CLOSED = 0x02
+# SD_FRAME_OVERHEAD and SD_RESYNC_BYTES in SDCard.h
+FRAME_OVERHEAD = 11
+RESYNC_BYTES = 8192
+SD_OPERATION_NAMES = ["sd_open", "sd_write", "sd_flush", "sd_close", "sd_update"]
+ENCODING_FIXED = 0
+ENCODING_DELTA = 1
+SESSION_MAGIC = b"STDS"
+# SYNC_UNFITTED_DRIFT_PPM in SyncClock.h. How fast the error bound grows away from a time record
+SYNC_DRIFT_PPM = 100
+
+
+class LogStream:
+    def __init__(self, name, count, value_type, scale, sample_rate, cfc=None):
+        self.name = name
+        self.count = count
+        self.value_type = value_type
+        self.scale = scale
+        self.sample_rate = sample_rate
+        # the CFC the dummy filtered the stream with, 0 if it didn't and None if the log doesn't say
+        self.cfc = cfc
+
+    def columns(self):
+        # match the column names the firmware uses for CSV logs
+        if self.count == 1:
+            return [self.name]
+        return [self.name + ":X", self.name + ":Y", self.name + ":Z", self.name + ":Magnitude"]
+
+
+class BinaryLog:
+    """
+    Reads the binary logs written by SDCard. See SDCard::writeBinaryHeader for the layout
+    """
+
+    def __init__(self, data):
+        self.data = data
+        self.offset = 0
+        self.streams = []
+        self.footer = None
+        # (rows, device us, unix us or None, error bound us or None) from each time record
+        self.times = []
+        # offsets in the unwrapped records where damaged frames were skipped
+        self.gaps = []
+        self.read_header()
+
+    def take(self, fmt):
+        values = struct.unpack_from("<" + fmt, self.data, self.offset)
+        self.offset += struct.calcsize("<" + fmt)
+        return values
+
+    def read_header(self):
+        if self.data[:4] != BINARY_LOG_MAGIC:
+            raise ValueError("not a binary impact log")
+        self.offset = 4
+        self.version, self.encoding, stream_count, self.flags, self.row_length = self.take("BBBBH")
+        for _ in range(stream_count):
+            # version 3 added the CFC
+            if self.version >= 3:
+                count, value_type, scale, sample_rate, cfc, name_length = self.take("BBfffB")
+            else:
+                count, value_type, scale, sample_rate, name_length = self.take("BBffB")
+                cfc = None
+            name = self.data[self.offset:self.offset + name_length].decode("ascii", "replace")
+            self.offset += name_length
+            self.streams.append(LogStream(name, count, chr(value_type), scale, sample_rate, cfc))
+        if self.flags & BINARY_FLAG_JOURNALED:
+            self.unwrap_frames()
+        if not self.flags & BINARY_FLAG_CLOSED:
+            print("The log was never closed, so its end may be missing", file=sys.stderr)
+
+    def read_frame(self, offset):
+        """
+        Return (sequence, payload) for a good frame at offset, or None. See SDCard::commitFrame for the layout
+        """
+        if offset + FRAME_OVERHEAD > len(self.data):
+            return None
+        tag, length, frame_sequence = struct.unpack_from("<BHI", self.data, offset)
+        payload = self.data[offset + 7:offset + 7 + length]
+        crc_bytes = self.data[offset + 7 + length:offset + 11 + length]
+        if tag != BINARY_RECORD_FRAME or length == 0 or len(crc_bytes) != 4:
+            return None
+        crc = zlib.crc32(payload, zlib.crc32(self.data[offset + 3:offset + 7]))
+        if struct.unpack("<I", crc_bytes)[0] != crc:
+            return None
+        return frame_sequence, payload
+
+    def unwrap_frames(self):
+        """
+        Replace the frames of a journaled log with the records inside them. Damaged frames are skipped the same way
+        SDCard::scanJournal skips them and everything from the last good frame on is ignored
+        """
+        records = bytearray()
+        offset = self.offset
+        sequence = 0
+        while offset + FRAME_OVERHEAD <= len(self.data):
+            frame = self.read_frame(offset)
+            if frame is not None and frame[0] == sequence:
+                records += frame[1]
+                offset += FRAME_OVERHEAD + len(frame[1])
+                sequence += 1
+                continue
+            # look for the next good frame within reach of the damage
+            found = None
+            limit = min(len(self.data), offset + RESYNC_BYTES)
+            next_offset = self.data.find(bytes([BINARY_RECORD_FRAME]), offset + 1, limit)
+            while next_offset >= 0 and next_offset + FRAME_OVERHEAD <= limit:
+                frame = self.read_frame(next_offset)
+                max_sequence = sequence + (next_offset - offset) // (FRAME_OVERHEAD + 1)
+                if frame is not None and sequence <= frame[0] <= max_sequence:
+                    found = next_offset
+                    break
+                next_offset = self.data.find(bytes([BINARY_RECORD_FRAME]), next_offset + 1, limit)
+            if found is None:
+                break
+            print("Skipping {} damaged bytes at byte {}".format(found - offset, offset), file=sys.stderr)
+            self.gaps.append(len(records))
+            offset = found
+            sequence = frame[0]
+        if offset < len(self.data):
+            print("Ignoring {} bytes after the last good frame at byte {}".format(len(self.data) - offset, offset), file=sys.stderr)
+        # the records go right after the header
+        self.gaps = [self.offset + gap for gap in self.gaps]
+        self.data = self.data[:self.offset] + bytes(records)
+
+    def header(self):
+        return [column for stream in self.streams for column in stream.columns()]
+
+    def take_varint(self):
+        value = 0
+        shift = 0
+        while True:
+            if self.offset >= len(self.data):
+                raise EOFError()
+            byte = self.data[self.offset]
+            self.offset += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        # undo the zigzag mapping
+        return (value >> 1) ^ -(value & 1)
+
+    def rows(self):
+        if self.encoding not in (ENCODING_FIXED, ENCODING_DELTA):
+            raise ValueError("unknown encoding {}".format(self.encoding))
+        value_count = sum(stream.count for stream in self.streams)
+        previous = [0] * value_count
+        gaps = list(self.gaps)
+        # delta rows after a skipped frame are relative to rows that were lost, so wait for the next keyframe
+        lost = False
+        while self.offset < len(self.data):
+            start = self.offset
+            while gaps and gaps[0] <= start:
+                gaps.pop(0)
+                lost = True
+            tag = self.data[self.offset]
+            self.offset += 1
+            if self.encoding == ENCODING_FIXED and tag == BINARY_RECORD_ROW:
+                if self.offset + 4 * value_count > len(self.data):
+                    # a partial record at the end of the file means the logger lost power mid write
+                    print("Ignoring truncated record at byte {}".format(start), file=sys.stderr)
+                    return
+                yield self.scale_row(self.take("i" * value_count))
+            elif self.encoding == ENCODING_DELTA and tag in (BINARY_RECORD_KEYFRAME, BINARY_RECORD_DELTA):
+                try:
+                    values = [self.take_varint() for _ in range(value_count)]
+                except EOFError:
+                    print("Ignoring truncated record at byte {}".format(start), file=sys.stderr)
+                    return
+                if tag == BINARY_RECORD_KEYFRAME:
+                    lost = False
+                elif lost:
+                    continue
+                if tag == BINARY_RECORD_DELTA:
+                    values = [p + v for p, v in zip(previous, values)]
+                # the firmware adds in 32 bits and lets the sum wrap
+                previous = [((v + 0x80000000) & 0xFFFFFFFF) - 0x80000000 for v in values]
+                yield self.scale_row(previous)
+            elif tag == BINARY_RECORD_FOOTER:
+                self.read_footer()
+            elif tag == BINARY_RECORD_TIME:
+                if self.offset + 24 > len(self.data):
+                    print("Ignoring truncated record at byte {}".format(start), file=sys.stderr)
+                    return
+                # see SDCard::writeTimeRecord
+                rows, device, unix, bound = self.take("IqqI")
+                synced = unix != 0
+                self.times.append((rows, device, unix if synced else None, bound if synced else None))
+            else:
+                raise ValueError("unknown record 0x{:02x} at byte {}".format(tag, start))
+
+    def read_footer(self):
+        """
+        Read the counters the firmware writes when it closes a log. See SDCard::writeBinaryFooter for the layout
+        """
+        (length,) = self.take("H")
+        end = self.offset + length
+        rows, overruns, dropped_bytes, stream_count = self.take("IIIB")
+        dropped = self.take("I" * stream_count)
+        (operation_count,) = self.take("B")
+        latency = {}
+        for i in range(operation_count):
+            count, max_us, mean_us, bucket_count = self.take("IIIB")
+            buckets = self.take("I" * bucket_count)
+            name = SD_OPERATION_NAMES[i] if i < len(SD_OPERATION_NAMES) else "op{}".format(i)
+            latency[name] = {"count": count, "max_us": max_us, "mean_us": mean_us, "buckets": list(buckets)}
+        # skip anything a newer firmware added
+        self.offset = end
+        self.footer = {
+            "rows_written": rows,
+            "overruns": overruns,
+            "dropped_bytes": dropped_bytes,
+            "dropped_samples": {stream.name: count for stream, count in zip(self.streams, dropped)},
+            "latency": latency,
+        }
+
+    def row_times(self, row_count):
+        """
+        Work out when each row was sampled from the time records. Returns a list of (device s, unix s, error bound s)
+        per row, with None for what isn't known. Logs from before version 2 have no time records
+        """
+        # the last row counted by each record was taken at the record's device time
+        points = sorted({rows - 1: device for rows, device, _, _ in self.times if rows > 0}.items())
+        if not points:
+            return [(None, None, None)] * row_count
+        rates = [stream.sample_rate for stream in self.streams if stream.sample_rate > 0]
+        default_period = 1e6 / max(rates) if rates else None
+        indexes = [row for row, _ in points]
+
+        def device_time(row):
+            # rows between two records are evenly spaced. Past the ends, keep the spacing of the nearest two records
+            if len(points) == 1:
+                if default_period is None:
+                    return points[0][1] if row == points[0][0] else None
+                return points[0][1] + (row - points[0][0]) * default_period
+            k = min(max(bisect.bisect_left(indexes, row), 1), len(points) - 1)
+            (row0, time0), (row1, time1) = points[k - 1], points[k]
+            return time0 + (row - row0) * (time1 - time0) / (row1 - row0)
+
+        synced = [(rows - 1, device, unix, bound) for rows, device, unix, bound in self.times if unix is not None]
+        synced_indexes = [row for row, _, _, _ in synced]
+        times = []
+        for row in range(row_count):
+            device = device_time(row)
+            if device is None:
+                times.append((None, None, None))
+                continue
+            if not synced:
+                times.append((device / 1e6, None, None))
+                continue
+            # map through the nearest record that had a synced clock
+            k = bisect.bisect_left(synced_indexes, row)
+            if k == len(synced) or (k > 0 and row - synced_indexes[k - 1] < synced_indexes[k] - row):
+                k -= 1
+            _, record_device, unix, bound = synced[k]
+            age = abs(device - record_device)
+            times.append((device / 1e6, (unix + device - record_device) / 1e6, (bound + age * SYNC_DRIFT_PPM / 1e6) / 1e6))
+        return times
+
+    def scale_row(self, raw):
+        row = []
+        index = 0
+        for stream in self.streams:
+            values = [v * stream.scale for v in raw[index:index + stream.count]]
+            index += stream.count
+            row.extend(values)
+            if stream.count == 3:
+                row.append(math.sqrt(sum(v * v for v in values)))
+        return row
+
+
+class SessionEvent:
+    def __init__(self, offset, length, timestamp, peak_g, risk):
+        self.offset = offset
+        self.length = length
+        self.timestamp = timestamp
+        self.peak_g = peak_g
+        self.risk = risk
+
+
+class SessionContainer:
+    """
+    Reads the session containers written by SDCard. See the SESSION_ defines in SDCard.h for the layout
+    """
+
+    def __init__(self, data):
+        if data[:4] != SESSION_MAGIC:
+            raise ValueError("not a session container")
+        self.data = data
+        self.version, _, self.max_events, count, _, self.data_offset = struct.unpack_from("<BBHHHI", data, 4)
+        self.events = []
+        for i in range(count):
+            entry = struct.unpack_from("<IIIff", data, 16 + 20 * i)
+            self.events.append(SessionEvent(*entry))
+
+    def event_data(self, index):
+        event = self.events[index]
+        return self.data[event.offset:event.offset + event.length]
+
+
+def print_footer(footer, name):
+    print("{}: {} rows written, {} overruns, {} bytes dropped".format(
+        name, footer["rows_written"], footer["overruns"], footer["dropped_bytes"]))
+    for stream, count in footer["dropped_samples"].items():
+        print("  {} dropped {} samples".format(stream, count))
+    for operation, latency in footer["latency"].items():
+        print("  {}: {} calls, max {} us, mean {} us".format(operation, latency["count"], latency["max_us"], latency["mean_us"]))
+
+
+def print_times(log, name):
+    synced = [record for record in log.times if record[2] is not None]
+    print("{}: {} time records, {} with a synced clock".format(name, len(log.times), len(synced)))
+    if synced:
+        print("  first synced row at {:.6f} Unix time, best error bound {} us".format(
+            synced[0][2] / 1e6, min(record[3] for record in synced)))
+
+
+def write_csv(log_data, output, args):
+    # CSV recordings are stored as is
+    if log_data[:4] != BINARY_LOG_MAGIC:
+        with open(output, "wb") as f:
+            f.write(log_data)
+        return
+
+    log = BinaryLog(log_data)
+    header = log.header()
+    rows = list(log.rows())
+
+    if args.stats and log.footer is not None:
+        print_footer(log.footer, output)
+    if args.stats:
+        print_times(log, output)
+
+    if args.filter:
+        streams = {column: stream for stream in log.streams for column in stream.columns()}
+        rates = {column: stream.sample_rate for column, stream in streams.items()}
+        filtered = [stream.name for stream in log.streams if stream.cfc]
+        if filtered:
+            print("{}: not filtering {}, the dummy already filtered them".format(output, ", ".join(filtered)))
+        if any(stream.cfc is None for stream in log.streams):
+            print("{}: version {} logs don't say which streams the dummy filtered, so they are all filtered".format(
+                output, log.version))
+
+        def cfc_for_column(name):
+            # filtering a stream twice leaves it steeper than its class
+            if name.endswith(":Magnitude") or rates[name] <= 0 or streams[name].cfc:
+                return 0
+            if "Accel" in name:
+                return args.accel_cfc
+            if "Gyro" in name:
+                return args.gyro_cfc
+            return 0
+
+        # every filtered stream is sampled in the same loop, so they share one rate
+        sample_rate = max(rates.values())
+        rows = cfc_filter.filter_columns(header, rows, cfc_for_column, sample_rate)
+
+    # logs with time records get the time each row was sampled, on the dummy and on the synced host clock, in seconds
+    if log.times:
+        header = ["DeviceTime", "UnixTime", "TimeErrorBound"] + header
+        rows = [list(times) + row for times, row in zip(log.row_times(len(rows)), rows)]
+
+    with open(output, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(header)
+        for row in rows:
+            writer.writerow(["" if v is None else "{:.6f}".format(v) for v in row])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert a binary impact log or session container to CSV")
+    parser.add_argument("input", help="the binary log (.bin) or session container (.ses) to convert")
+    parser.add_argument("output", nargs="?", help="where to write the csv. Each event in a container gets its own file, output_<event>.csv")
+    parser.add_argument("--list", action="store_true", help="list the events in a session container")
+    parser.add_argument("--event", type=int, help="only convert this event from a session container")
+    parser.add_argument("--stats", action="store_true", help="print the SD counters and latency stored in each log footer and the time records")
+    parser.add_argument("--filter", action="store_true", help="apply zero phase SAE J211 filters to the acceleration and gyro columns the dummy didn't filter already")
+    parser.add_argument("--accel-cfc", type=float, default=60, help="CFC for acceleration columns when filtering")
+    parser.add_argument("--gyro-cfc", type=float, default=60, help="CFC for angular rate columns when filtering")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    if data[:4] != SESSION_MAGIC:
+        if args.list or args.output is None:
+            parser.error("an output file is required for a single log")
+        write_csv(data, args.output, args)
+        return
+
+    session = SessionContainer(data)
+    if args.list:
+        print("event,offset,length,timestamp_ms,peak_g,risk")
+        for i, event in enumerate(session.events):
+            print("{},{},{},{},{:.2f},{:.4f}".format(i, event.offset, event.length, event.timestamp, event.peak_g, event.risk))
+        return
+    if args.output is None:
+        parser.error("an output file is required unless --list is used")
+
+    if args.event is not None:
+        if not 0 <= args.event < len(session.events):
+            parser.error("the container has {} events".format(len(session.events)))
+        write_csv(session.event_data(args.event), args.output, args)
+        return
+
+    stem, ext = os.path.splitext(args.output)
+    for i in range(len(session.events)):
+        write_csv(session.event_data(i), "{}_{}{}".format(stem, i, ext or ".csv"), args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,346 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Measures how many commands per second MessageParser handles on a computer, next to the strtok and atoi
+ * parsing SerialMessage used before it, and then fuzzes it with random and damaged input.
+ * Build and run from the top of the repo:
+ * g++ -O2 -std=c++17 -Ilib/SerialMessage -Ilib/Checksum Scripts/message_parser_bench.cpp lib/SerialMessage/MessageParser.cpp lib/Checksum/CRC32.cpp -o message_parser_bench
+ * ./message_parser_bench [messages] [fuzz rounds]
+*/
+
+#include "MessageParser.h"
+#include "CRC32.h"
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LEGACY_NUM_CHARS 50
+#define LEGACY_ARGS 30
+
+static int failures = 0;
+
+#define CHECK(condition) do{ if(!(condition)){ printf("FAIL line %d: %s\n", __LINE__, #condition); failures++; } }while(0)
+
+/**
+ * @brief the byte at a time parsing SerialMessage did before MessageParser, kept here to compare against
+ */
+class LegacyParser{
+    public:
+        bool feed(char c){
+            if(recvInProgress){
+                if(c == ';'){
+                    data[ndx] = '\0';
+                    recvInProgress = false;
+                    ndx = 0;
+                    strcpy(temp_data, data);
+                    populated = 0;
+                    char* indx = strtok(temp_data, ",");
+                    while(indx != NULL){
+                        args[populated++] = atoi(indx);
+                        indx = strtok(NULL, ",");
+                    }
+                    return true;
+                }
+                data[ndx] = c;
+                ndx++;
+                if(ndx >= LEGACY_NUM_CHARS){
+                    ndx = LEGACY_NUM_CHARS - 1;
+                }
+            }
+            else if(c == '!'){
+                recvInProgress = true;
+            }
+            return false;
+        }
+        int args[LEGACY_ARGS];
+        int populated = 0;
+    private:
+        char data[LEGACY_NUM_CHARS];
+        char temp_data[LEGACY_NUM_CHARS];
+        bool recvInProgress = false;
+        uint8_t ndx = 0;
+};
+
+static void appendBinary(std::string& out, uint8_t command, const std::vector<int32_t>& args){
+    std::string payload(1, (char)command);
+    for(int32_t arg : args){
+        for(int i = 0; i < 4; i++){
+            payload += (char)((uint32_t)arg >> (8 * i));
+        }
+    }
+    out += (char)MESSAGE_BINARY_START;
+    out += (char)(payload.size() & 0xFF);
+    out += (char)(payload.size() >> 8);
+    out += payload;
+    uint32_t crc = crc32((const uint8_t*)payload.data(), payload.size(), 0);
+    for(int i = 0; i < 4; i++){
+        out += (char)(crc >> (8 * i));
+    }
+}
+
+/**
+ * @brief feed everything and collect the messages as text so runs can be compared
+ */
+static std::vector<std::string> parseAll(MessageParser& parser, const std::string& input, size_t chunk){
+    std::vector<std::string> messages;
+    const uint8_t* data = (const uint8_t*)input.data();
+    size_t position = 0;
+    while(position < input.size()){
+        size_t length = std::min(chunk, input.size() - position);
+        size_t used = parser.feed(&data[position], length);
+        position += used;
+        if(parser.available()){
+            std::string message(1, parser.getType() == MESSAGE_TEXT ? 'T' : 'B');
+            for(uint8_t i = 0; i < parser.getFieldCount(); i++){
+                uint16_t fieldLength = 0;
+                const uint8_t* field = parser.getBlob(i, &fieldLength);
+                CHECK(field != nullptr);
+                CHECK(fieldLength <= MESSAGE_MAX_LENGTH);
+                message += '|';
+                message.append((const char*)field, fieldLength);
+            }
+            messages.push_back(message);
+            parser.next();
+        }
+        else{
+            // without a message waiting the parser always takes everything it is given
+            CHECK(used == length);
+        }
+    }
+    return messages;
+}
+
+static void testKnownMessages(){
+    MessageParser parser;
+    std::string input = "noise!21;!18,3,-250;garbage;!;!4,abc,2.5;";
+    appendBinary(input, 24, {2, 4096});
+    input += "!12";
+
+    const uint8_t* data = (const uint8_t*)input.data();
+    size_t position = 0;
+    int32_t value;
+    float number;
+    uint16_t length;
+
+    position += parser.feed(&data[position], input.size() - position);
+    CHECK(parser.getType() == MESSAGE_TEXT);
+    CHECK(parser.getFieldCount() == 1);
+    CHECK(parser.getInt(0, &value) && value == 21);
+    CHECK(!parser.getInt(1, &value));
+    parser.next();
+
+    position += parser.feed(&data[position], input.size() - position);
+    CHECK(parser.getFieldCount() == 3);
+    CHECK(parser.getInt(1, &value) && value == 3);
+    CHECK(parser.getInt(2, &value) && value == -250);
+    parser.next();
+
+    position += parser.feed(&data[position], input.size() - position);
+    CHECK(parser.available() && parser.getFieldCount() == 0);
+    parser.next();
+
+    position += parser.feed(&data[position], input.size() - position);
+    CHECK(parser.getFieldCount() == 3);
+    CHECK(!parser.getInt(1, &value));
+    CHECK(strcmp(parser.getString(1, &length), "abc") == 0 && length == 3);
+    CHECK(!parser.getInt(2, &value));
+    CHECK(parser.getFloat(2, &number) && number == 2.5f);
+    parser.next();
+
+    position += parser.feed(&data[position], input.size() - position);
+    CHECK(parser.getType() == MESSAGE_BINARY);
+    CHECK(parser.getInt(0, &value) && value == 24);
+    const uint8_t* blob = parser.getBlob(1, &length);
+    CHECK(blob != nullptr && length == 8 && blob[0] == 2 && blob[5] == 0x10);
+    CHECK(parser.getString(1) == nullptr);
+    parser.next();
+
+    // the last message never ended
+    position += parser.feed(&data[position], input.size() - position);
+    CHECK(position == input.size());
+    CHECK(!parser.available());
+    CHECK(parser.getMessageCount() == 5);
+    CHECK(parser.getErrorCount() == 0);
+
+    // a message that is too long is dropped and the one after it still parses
+    parser = MessageParser();
+    std::string tooLong = "!" + std::string(MESSAGE_MAX_LENGTH * 2, '7') + ";!5;";
+    std::vector<std::string> messages = parseAll(parser, tooLong, tooLong.size());
+    CHECK(messages.size() == 1 && messages[0] == "T|5");
+    CHECK(parser.getErrorCount() == 1);
+
+    // so is one with too many fields
+    std::string tooMany = "!";
+    for(int i = 0; i <= MESSAGE_MAX_FIELDS; i++){
+        tooMany += "1,";
+    }
+    tooMany += "1;!6;";
+    messages = parseAll(parser, tooMany, tooMany.size());
+    CHECK(messages.size() == 1 && messages[0] == "T|6");
+    CHECK(parser.getErrorCount() == 2);
+
+    // and a binary message with a bad CRC
+    std::string damaged;
+    appendBinary(damaged, 9, {1});
+    damaged[4] ^= 0x01;
+    damaged += "!7;";
+    messages = parseAll(parser, damaged, damaged.size());
+    CHECK(messages.size() == 1 && messages[0] == "T|7");
+    CHECK(parser.getErrorCount() == 3);
+
+    // bytes lost in the middle of a message drop it, and the tail isn't read as a message of its own
+    std::string head = "!12,3";
+    std::string tail = "4;!8;";
+    parser.feed((const uint8_t*)head.data(), head.size());
+    parser.resync();
+    messages = parseAll(parser, tail, tail.size());
+    CHECK(messages.size() == 1 && messages[0] == "T|8");
+    CHECK(parser.getErrorCount() == 4);
+
+    // a message that already arrived is kept
+    std::string whole = "!9;";
+    parser.feed((const uint8_t*)whole.data(), whole.size());
+    parser.resync();
+    CHECK(parser.available());
+    CHECK(parser.getErrorCount() == 4);
+    parser.next();
+}
+
+static std::string makeCommands(size_t count){
+    std::mt19937 random(1);
+    std::string input;
+    char message[64];
+    for(size_t i = 0; i < count; i++){
+        // the commands the dummy actually gets: a command and up to two small args
+        switch(random() % 3){
+            case 0:
+                snprintf(message, sizeof(message), "!%u;", (unsigned)(random() % 26));
+                break;
+            case 1:
+                snprintf(message, sizeof(message), "!%u,%u;", (unsigned)(random() % 26), (unsigned)(random() % 100));
+                break;
+            default:
+                snprintf(message, sizeof(message), "!%u,%u,%d;", (unsigned)(random() % 26), (unsigned)(random() % 8), (int)(random() % 20000) - 10000);
+                break;
+        }
+        input += message;
+    }
+    return input;
+}
+
+static void benchmark(size_t count){
+    std::string input = makeCommands(count);
+    const uint8_t* data = (const uint8_t*)input.data();
+    long long checksum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    LegacyParser legacy;
+    size_t legacyMessages = 0;
+    for(char c : input){
+        if(legacy.feed(c)){
+            legacyMessages++;
+            checksum += legacy.args[legacy.populated - 1];
+        }
+    }
+    double legacySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    MessageParser parser;
+    size_t messages = 0;
+    size_t position = 0;
+    int32_t args[MESSAGE_MAX_FIELDS];
+    while(position < input.size()){
+        // a read from the port is at most SERIAL_READ_CHUNK bytes
+        size_t length = std::min((size_t)64, input.size() - position);
+        position += parser.feed(&data[position], length);
+        if(parser.available()){
+            uint8_t fields = parser.getFieldCount();
+            for(uint8_t i = 0; i < fields; i++){
+                parser.getInt(i, &args[i]);
+            }
+            checksum -= args[fields - 1];
+            messages++;
+            parser.next();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK(messages == count && legacyMessages == count);
+    CHECK(checksum == 0);
+    printf("%zu messages, %zu bytes\n", count, input.size());
+    printf("strtok/atoi:   %12.0f messages/s\n", legacyMessages / legacySeconds);
+    printf("MessageParser: %12.0f messages/s (%.2fx)\n", messages / seconds, legacySeconds / seconds);
+}
+
+static void fuzz(size_t rounds){
+    std::mt19937 random(2);
+    const char alphabet[] = "!,;0123456789-.abc \x02\x00\xff";
+    for(size_t round = 0; round < rounds; round++){
+        std::string input;
+        size_t pieces = random() % 16;
+        for(size_t i = 0; i < pieces; i++){
+            switch(random() % 4){
+                case 0:
+                    // random bytes, mostly ones the parser cares about
+                    for(size_t n = random() % 40; n > 0; n--){
+                        input += random() % 2 ? alphabet[random() % (sizeof(alphabet) - 1)] : (char)random();
+                    }
+                    break;
+                case 1:
+                    input += makeCommands(1 + random() % 3);
+                    break;
+                case 2:{
+                    std::vector<int32_t> args(random() % 5);
+                    for(int32_t& arg : args){
+                        arg = random();
+                    }
+                    appendBinary(input, random(), args);
+                    break;
+                }
+                default:
+                    // a length that is too big or a frame cut short
+                    input += (char)MESSAGE_BINARY_START;
+                    input += (char)random();
+                    input += (char)random();
+                    break;
+            }
+        }
+        // flip a few bits in some rounds
+        if(!input.empty() && random() % 4 == 0){
+            for(size_t n = 1 + random() % 3; n > 0; n--){
+                input[random() % input.size()] ^= 1 << (random() % 8);
+            }
+        }
+
+        // the messages can't depend on how the bytes are split up
+        MessageParser whole;
+        MessageParser pieced;
+        std::vector<std::string> expected = parseAll(whole, input, input.size() + 1);
+        std::vector<std::string> split = parseAll(pieced, input, 1 + random() % 7);
+        CHECK(expected == split);
+        CHECK(whole.getErrorCount() == pieced.getErrorCount());
+        CHECK(whole.getMessageCount() == expected.size());
+        if(failures > 0){
+            printf("failed on round %zu\n", round);
+            return;
+        }
+    }
+    printf("%zu fuzz rounds passed\n", rounds);
+}
+
+int main(int argc, char** argv){
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+    size_t rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200000;
+    testKnownMessages();
+    benchmark(count);
+    fuzz(rounds);
+    if(failures > 0){
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+TELEMETRY_FRAME_SAMPLES = 0x01
+TELEMETRY_FRAME_DESCRIPTION = 0x02
+TELEMETRY_FRAME_IMPACTS = 0x05
+IMPACT_SUMMARY = struct.Struct("<IIqHHHHiibbb")
+
+
+def cobs_decode(data):
+    """
+    Undo the COBS encoding done by cobsEncode in COBS.h. Returns None if the data isn't valid COBS
+    """
+    out = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        if code == 0 or index + code > len(data) + 1:
+            return None
+        out += data[index + 1:index + code]
+        index += code
+        # a code of 255 means the run ended without a zero, and the last run never has one
+        if code < 0xFF and index < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class TelemetryStream:
+    def __init__(self, name, axes, scale, sample_rate):
+        self.name = name
+        self.axes = axes
+        self.scale = scale
+        self.sample_rate = sample_rate
+        self.next_index = None
+        self.samples = 0
+        self.missed = 0
+
+
+class TelemetryDecoder:
+    """
+    Splits a byte stream into the frames sent by the Telemetry class and decodes them. See Telemetry.h for the layout
+    """
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.streams = {}
+        self.frames = 0
+        self.bad_frames = 0
+        self.text = []
+        self.impacts = []
+
+    def feed(self, data):
+        """
+        Add received bytes and yield (stream, first index, time, samples) for every complete sample frame.
+        The time is the Unix time of the first sample in seconds, or None if the dummy's clock wasn't synced
+        """
+        self.buffer += data
+        while True:
+            end = self.buffer.find(b"\x00")
+            if end < 0:
+                return
+            chunk = bytes(self.buffer[:end])
+            del self.buffer[:end + 1]
+            if chunk:
+                result = self.decode(chunk)
+                if result is not None:
+                    yield result
+
+    def decode(self, chunk):
+        frame = cobs_decode(chunk)
+        if frame is None or len(frame) < 5 or zlib.crc32(frame[:-4]) != struct.unpack_from("<I", frame, len(frame) - 4)[0]:
+            # anything the firmware printed as text lands here too
+            if all(32 <= b < 127 or b in (9, 10, 13) for b in chunk):
+                self.text.append(chunk.decode("ascii").strip())
+            else:
+                self.bad_frames += 1
+            return None
+        self.frames += 1
+        frame = frame[:-4]
+        if frame[0] == TELEMETRY_FRAME_DESCRIPTION:
+            stream_id, axes, scale, sample_rate, name_length = struct.unpack_from("<BBffB", frame, 1)
+            name = frame[12:12 + name_length].decode("ascii", "replace")
+            if stream_id not in self.streams or self.streams[stream_id].name != name:
+                self.streams[stream_id] = TelemetryStream(name, axes, scale, sample_rate)
+            return None
+        if frame[0] == TELEMETRY_FRAME_SAMPLES:
+            stream_id, first_index, count, axes, scale, time_us = struct.unpack_from("<BIBBfq", frame, 1)
+            raw = struct.unpack_from("<" + "h" * (count * axes), frame, 20)
+            stream = self.streams.get(stream_id)
+            if stream is None:
+                # samples arrived before the description. Name it by id until the description comes
+                stream = self.streams[stream_id] = TelemetryStream("stream{}".format(stream_id), axes, scale, 0)
+            if stream.next_index is not None and first_index > stream.next_index:
+                stream.missed += first_index - stream.next_index
+            stream.next_index = first_index + count
+            stream.samples += count
+            samples = [[v * scale for v in raw[i * axes:(i + 1) * axes]] for i in range(count)]
+            return stream, first_index, time_us / 1e6 if time_us else None, samples
+        if frame[0] == TELEMETRY_FRAME_IMPACTS:
+            # impact summaries sent over Bluetooth. See ImpactPublisher.h
+            for i in range(frame[1]):
+                (sequence, start, synced, duration, peak_linear, peak_rotational, risk, left_load, right_load,
+                 x, y, z) = IMPACT_SUMMARY.unpack_from(frame, 2 + i * IMPACT_SUMMARY.size)
+                self.impacts.append((sequence, start, format_time(synced / 1e6 if synced else None), duration,
+                                     peak_linear / 10, peak_rotational, risk / 1000, left_load, right_load,
+                                     x / 127, y / 127, z / 127))
+            return None
+        self.bad_frames += 1
+        return None
+
+
+def format_time(seconds):
+    # an empty column until the dummy's clock has been synced with Scripts/time_sync.py
+    return "" if seconds is None else "{:.6f}".format(seconds)
+
+
+def open_source(args):
+    if args.file:
+        return open(args.file, "rb")
+    import serial
+    return serial.Serial(args.port, args.baud, timeout=0.1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode binary telemetry from the dummy")
+    parser.add_argument("--port", help="serial port the dummy is connected to")
+    parser.add_argument("--baud", type=int, default=921600, help="baud rate, TELEMETRY_BAUD in main.cpp")
+    parser.add_argument("--file", help="decode a capture of the serial port instead")
+    parser.add_argument("--stats", action="store_true", help="print samples per second for each stream instead of the samples")
+    args = parser.parse_args()
+    if not args.port and not args.file:
+        parser.error("give a --port or a --file")
+
+    decoder = TelemetryDecoder()
+    source = open_source(args)
+    start = time.time()
+    last_report = start
+    received = 0
+    try:
+        while True:
+            data = source.read(4096)
+            if not data:
+                if args.file:
+                    break
+                continue
+            received += len(data)
+            for stream, first_index, first_time, samples in decoder.feed(data):
+                if not args.stats:
+                    for i, sample in enumerate(samples):
+                        # only the first sample is stamped. The rest follow at the stream's forwarded rate
+                        sample_time = first_time
+                        if first_time is not None and stream.sample_rate > 0:
+                            sample_time = first_time + i / stream.sample_rate
+                        print("{},{},{},{}".format(stream.name, first_index + i, format_time(sample_time),
+                                                   ",".join("{:.3f}".format(v) for v in sample)))
+            for line in decoder.text:
+                print("#" + line, file=sys.stderr)
+            decoder.text = []
+            for impact in decoder.impacts:
+                print("Impact,{},{},{},{},{:.1f},{},{:.3f},{},{},{:.2f},{:.2f},{:.2f}".format(*impact))
+            decoder.impacts = []
+            now = time.time()
+            if args.stats and not args.file and now - last_report >= 1:
+                report(decoder, received, now - start)
+                last_report = now
+    except KeyboardInterrupt:
+        pass
+    if args.stats:
+        report(decoder, received, max(time.time() - start, 1e-6) if not args.file else 1)
+
+
+def report(decoder, received, elapsed):
+    print("{} bytes, {} frames, {} bad frames".format(received, decoder.frames, decoder.bad_frames))
+    for stream_id, stream in sorted(decoder.streams.items()):
+        print("  {:>2} {:<14} {:>8} samples {:>9.1f}/s {:>6} missed".format(
+            stream_id, stream.name, stream.samples, stream.samples / elapsed, stream.missed))
+
+
+if __name__ == "__main__":
+    main()
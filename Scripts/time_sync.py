@@ -0,0 +1,92 @@
+import argparse
+import statistics
+import sys
+import time
+
+from log_download import Link
+
+TIME_SYNC = 28
+TIME_SYNC_RESULT = 29
+
+
+def split_time(ns):
+    """
+    Split a time.time_ns() value into the whole seconds and us the sync commands take, since each arg is an int32
+    """
+    us = ns // 1000
+    return us // 1000000, us % 1000000
+
+
+def wait_for(link, prefix, timeout):
+    """
+    Wait for a line starting with prefix. Returns the line and the time.time_ns() its bytes arrived, or (None, None)
+    """
+    start = time.time()
+    for kind, value in link.read():
+        if time.time() - start > timeout:
+            return None, None
+        if kind != "text":
+            continue
+        if value.startswith(prefix):
+            return value, link.read_time
+        if value.startswith("!ERR,{},".format(TIME_SYNC)) or value.startswith("!ERR,{},".format(TIME_SYNC_RESULT)):
+            print(value, file=sys.stderr)
+            return None, None
+
+
+def exchange(link, sequence, timeout):
+    """
+    Run one exchange. See SyncClock.h for what each time means.
+    Returns (offset us, round trip us, error bound us, prediction error us, drift ppb, clock error bound us) or None
+    """
+    link.send(TIME_SYNC, sequence, *split_time(time.time_ns()))
+    reply, received = wait_for(link, "!Sync,{};".format(sequence), timeout)
+    if reply is None:
+        return None
+    link.send(TIME_SYNC_RESULT, sequence, *split_time(received))
+    result, _ = wait_for(link, "!SyncResult,{},".format(sequence), timeout)
+    if result is None:
+        return None
+    return tuple(int(v) for v in result[len("!SyncResult,"):].rstrip(";").split(",")[1:])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sync the dummy's clock with this computer's clock so its logs and "
+                                                 "telemetry are stamped with Unix time. Keep it running during a session")
+    parser.add_argument("--port", required=True, help="serial port or Bluetooth serial port of the dummy")
+    parser.add_argument("--baud", type=int, default=921600, help="baud rate, TELEMETRY_BAUD in main.cpp")
+    parser.add_argument("--count", type=int, default=0, help="how many exchanges to run. 0 runs until stopped")
+    parser.add_argument("--interval", type=float, default=10, help="seconds between exchanges. The drift is fitted "
+                                                                    "once the exchanges span 30 seconds")
+    parser.add_argument("--timeout", type=float, default=2, help="seconds to wait for each reply")
+    args = parser.parse_args()
+
+    import serial
+    link = Link(serial.Serial(args.port, args.baud, timeout=0.01))
+    # numbered from the time so a restarted script never finishes an exchange started by the last one
+    sequence = int(time.time()) % 1000000 * 100
+    delays = []
+    attempts = 0
+    print("seq,offset_us,round_trip_us,error_bound_us,prediction_error_us,drift_ppb,clock_error_bound_us")
+    try:
+        while args.count == 0 or attempts < args.count:
+            if attempts > 0:
+                time.sleep(args.interval)
+            attempts += 1
+            sequence += 1
+            result = exchange(link, sequence, args.timeout)
+            if result is None:
+                # the dummy doesn't read commands while it is recording an impact. Try again next time
+                print("exchange {} got no reply".format(sequence), file=sys.stderr)
+            else:
+                delays.append(result[1])
+                print("{},{}".format(sequence, ",".join(str(v) for v in result)), flush=True)
+    except KeyboardInterrupt:
+        pass
+    if delays:
+        print("{} exchanges, round trip median {} us, best {} us".format(len(delays), statistics.median(delays), min(delays)),
+              file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -51,6 +51,12 @@ class I2C_Accel : public I2C_Device{
          */
         double* getData() override;
 
+        /**
+         * @brief get the last data read from the device
+         * @returns a pointer to the last acceleration in m/s^2
+         */
+        xyzData* getAccelData(){return accel.getData();};
+
         /**
          * @brief gets a pointer to the DataStream object for this device
          * @returns a pointer to the DataStream object for this device
@@ -75,6 +81,14 @@ class I2C_Accel : public I2C_Device{
         */
         void resetPeaks(){accel.resetPeaks();};
 
+        /**
+         * @brief filter the acceleration data with an SAE J211 filter
+         * @param cfc the channel frequency class. 0 turns the filter off
+         * @param sampleRate the rate update() is called at in Hz
+         * @returns true if the filter could be configured
+         */
+        bool setFilter(float cfc, float sampleRate){return accel.setFilter(cfc, sampleRate);};
+
         /**
          * @brief returns if the device is initialized
          * @returns true if the device is initialized
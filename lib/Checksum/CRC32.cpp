@@ -0,0 +1,22 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief The standard CRC-32 used by zlib, so host tools can check it with zlib.crc32
+*/
+
+#include "CRC32.h"
+
+// the reflected 0xEDB88320 polynomial four bits at a time. 64 bytes instead of the usual 1KB table
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc){
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++){
+        crc = crcTable[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+        crc = crcTable[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
@@ -0,0 +1,19 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief The standard CRC-32 used by zlib, so host tools can check it with zlib.crc32
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief compute the CRC-32 of some data
+ * @param data the bytes to check
+ * @param length the number of bytes
+ * @param crc the CRC of the data before this, to check data in pieces. 0 to start
+ * @returns the CRC-32 of everything so far
+ */
+uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
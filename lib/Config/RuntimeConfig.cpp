@@ -0,0 +1,79 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Settings that can be read and changed over the command channel and kept in flash
+*/
+
+#include "RuntimeConfig.h"
+
+RuntimeConfig::RuntimeConfig(const ConfigEntry* entries, uint8_t count) :
+entries(entries), count(min(count, (uint8_t)CONFIG_MAX_ENTRIES)){
+    for(uint8_t i = 0; i < this->count; i++){
+        this->values[i] = entries[i].defaultValue;
+    }
+}
+
+bool RuntimeConfig::init(){
+    this->storageOpen = this->storage.begin("config", false);
+    if(!this->storageOpen){
+        Serial.println("Failed to open config storage. Using the default settings.");
+        return false;
+    }
+    for(uint8_t i = 0; i < this->count; i++){
+        // a saved value from an older firmware with a different range falls back to the default
+        int32_t value = this->storage.getInt(this->entries[i].name, this->entries[i].defaultValue);
+        if(!this->set(i, value)){
+            this->values[i] = this->entries[i].defaultValue;
+        }
+    }
+    return true;
+}
+
+bool RuntimeConfig::set(uint8_t id, int32_t value){
+    if(id >= this->count || value < this->entries[id].min || value > this->entries[id].max){
+        return false;
+    }
+    this->values[id] = value;
+    return true;
+}
+
+bool RuntimeConfig::save(){
+    if(!this->storageOpen){
+        return false;
+    }
+    for(uint8_t i = 0; i < this->count; i++){
+        this->storage.putInt(this->entries[i].name, this->values[i]);
+    }
+    return true;
+}
+
+void RuntimeConfig::resetDefaults(){
+    for(uint8_t i = 0; i < this->count; i++){
+        this->values[i] = this->entries[i].defaultValue;
+    }
+    if(this->storageOpen){
+        this->storage.clear();
+    }
+}
+
+void RuntimeConfig::print(Print* out, uint8_t id){
+    if(id >= this->count){
+        return;
+    }
+    const ConfigEntry* entry = &this->entries[id];
+    out->print("!Config,");
+    out->print(id);
+    out->print(",");
+    out->print(entry->name);
+    out->print(",");
+    out->print(this->values[id]);
+    out->print(",");
+    out->print(entry->min);
+    out->print(",");
+    out->print(entry->max);
+    out->print(",");
+    out->print(entry->defaultValue);
+    out->print(",");
+    out->print(entry->needsRestart ? 1 : 0);
+    out->println(";");
+}
@@ -0,0 +1,83 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Settings that can be read and changed over the command channel and kept in flash
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define CONFIG_MAX_ENTRIES 16
+
+// describes one setting. The values are whole numbers because commands only carry ints, so the name has the unit
+struct ConfigEntry{
+    const char* name; // also the flash key, so at most 15 characters
+    int32_t defaultValue;
+    int32_t min;
+    int32_t max;
+    bool needsRestart; // the value is only used at startup
+};
+
+class RuntimeConfig{
+    public:
+        /**
+         * @brief Construct a new Runtime Config object. Every setting starts at its default
+         * @param entries the settings. The index of each entry is its id. Must stay valid for the life of the program
+         * @param count the number of entries, at most CONFIG_MAX_ENTRIES
+         */
+        RuntimeConfig(const ConfigEntry* entries, uint8_t count);
+        ~RuntimeConfig() = default;
+
+        /**
+         * @brief load the saved settings from flash. Settings that were never saved or are out of range keep their default
+         * @returns true if flash storage could be opened
+         */
+        bool init();
+
+        /**
+         * @brief get a setting. Safe to call from any task
+         * @param id the setting id
+         * @returns the value or 0 if the id is invalid
+         */
+        int32_t get(uint8_t id){return id < count ? values[id] : 0;};
+
+        /**
+         * @brief change a setting until the next restart
+         * @param id the setting id
+         * @param value the new value
+         * @returns false if the id is invalid or the value is out of range
+         */
+        bool set(uint8_t id, int32_t value);
+
+        /**
+         * @brief save every setting to flash so it is used after a restart
+         * @returns false if flash storage isn't available
+         */
+        bool save();
+
+        /**
+         * @brief put every setting back to its default and remove the saved settings
+         */
+        void resetDefaults();
+
+        /**
+         * @brief get the number of settings
+         */
+        uint8_t size(){return count;};
+
+        /**
+         * @brief print a setting in the form !Config,<id>,<name>,<value>,<min>,<max>,<default>,<needs restart>;
+         * @param out where to print
+         * @param id the setting id
+         */
+        void print(Print* out, uint8_t id);
+
+    private:
+        const ConfigEntry* entries;
+        uint8_t count;
+        int32_t values[CONFIG_MAX_ENTRIES];
+        Preferences storage;
+        bool storageOpen = false;
+};
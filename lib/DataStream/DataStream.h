@@ -7,6 +7,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include "esp_timer.h"
 
 #define MAX_STREAM_LENGTH 100
 
@@ -31,6 +32,13 @@ class DataStream{
          */
         void prepend(ItemType item);
 
+        /**
+         * @brief prepend an item that was acquired before it was added
+         * @param item the item to prepend
+         * @param time when the item was acquired, from esp_timer_get_time in us
+         */
+        void prepend(ItemType item, int64_t time);
+
         /**
          * @brief get the item at the given index
          * @param index the index to get the item at
@@ -45,6 +53,35 @@ class DataStream{
          */
         ItemType pop(unsigned int index = 0);
 
+        /**
+         * @brief copy the items in the stream in one pass, so a caller holding a lock can release it quickly
+         * @param out where to copy the items, newest first like peek
+         * @param maxItems the number of items out can hold
+         * @returns the number of items copied
+         */
+        unsigned int snapshot(ItemType* out, unsigned int maxItems);
+
+        /**
+         * @brief make this a copy of another stream so it can be read and popped without holding the other stream's lock.
+         * While drops are counted, items the other stream pushed out since the last copy before they were popped from this
+         * one are counted as dropped here
+         * @param other the stream to copy. The caller holds its lock
+         */
+        void copyFrom(DataStream<ItemType>* other);
+
+        /**
+         * @brief put what is left of a copy back in place of the items it was copied from. Items added since the copy
+         * was made stay in front of them
+         * @param copy a copy made from this stream with copyFrom. Items may have been popped or truncated from it
+         */
+        void restoreFrom(DataStream<ItemType>* copy);
+
+        /**
+         * @brief remove the oldest items so at most newSize are left
+         * @param newSize the number of newest items to keep
+         */
+        void truncate(unsigned int newSize);
+
         /**
          * @brief get the length of the stream
          * @returns the length of the stream
@@ -83,6 +120,41 @@ class DataStream{
          */
         unsigned int getHeaderLength();
 
+        /**
+         * @brief get the number of items lost because they were added to a full stream while drops were counted
+         * @return the number of dropped items since the stream was created
+         */
+        uint32_t getDroppedCount(){
+            return this->droppedCount;
+        };
+
+        /**
+         * @brief count the items a full stream pushes out as dropped. Only turn this on while the items are being
+         * recorded. An idle stream is a history that overwrites its oldest item with every new one
+         * @param countDrops true to count dropped items
+         */
+        void setCountDrops(bool countDrops){
+            this->countDrops = countDrops;
+        };
+
+        /**
+         * @brief get the number of items ever added to the stream. The newest item is number getTotalCount() - 1,
+         * so a reader can tell how many items arrived since it last looked
+         * @return the number of items added since the stream was created
+         */
+        uint32_t getTotalCount(){
+            return this->totalCount;
+        };
+
+        /**
+         * @brief get when the newest item was acquired. Items prepended without a time are stamped as they are added,
+         * which for the sensors is right after they are read
+         * @return the time from esp_timer_get_time in us, 0 if nothing has been prepended
+         */
+        int64_t getNewestTime(){
+            return this->newestTime;
+        };
+
         /**
          * @brief set the initialized flag
          * @param isInitialized the new value for the initialized flag
@@ -105,6 +177,10 @@ class DataStream{
         char * header = nullptr;
         unsigned int headerLength = 0;
         bool isInitialized = false;
+        uint32_t droppedCount = 0;
+        uint32_t totalCount = 0;
+        bool countDrops = false;
+        int64_t newestTime = 0;
 
         /**
          * @brief shift all items in the stream to the right by one
@@ -146,8 +222,15 @@ template <typename ItemType>
 void DataStream<ItemType>::insert(ItemType item, unsigned int index){
     // don't add the item if the index is out of bounds
     if(index >= MAX_STREAM_LENGTH - 1){
+        if(this->countDrops){
+            this->droppedCount++;
+        }
         return;
     }
+    // a full stream loses its oldest item to make room
+    if(this->currentSize == MAX_STREAM_LENGTH && this->countDrops){
+        this->droppedCount++;
+    }
 
     // if the index is greater than the current length of the stream, add the item to the end
     if(index >= this->currentSize){
@@ -163,11 +246,18 @@ void DataStream<ItemType>::insert(ItemType item, unsigned int index){
     if(this->currentSize < MAX_STREAM_LENGTH){
         this->currentSize++;
     }
+    this->totalCount++;
 }
 
 template <typename ItemType>
 void DataStream<ItemType>::prepend(ItemType item){
+    this->prepend(item, esp_timer_get_time());
+}
+
+template <typename ItemType>
+void DataStream<ItemType>::prepend(ItemType item, int64_t time){
     this->insert(item, 0);
+    this->newestTime = time;
 }
 
 template <typename ItemType>
@@ -192,6 +282,51 @@ ItemType DataStream<ItemType>::pop(unsigned int index){
     return item;
 }
 
+template <typename ItemType>
+unsigned int DataStream<ItemType>::snapshot(ItemType* out, unsigned int maxItems){
+    unsigned int count = min(this->currentSize, maxItems);
+    for(unsigned int i = 0; i < count; i++){
+        out[i] = this->stream[i];
+    }
+    return count;
+}
+
+template <typename ItemType>
+void DataStream<ItemType>::copyFrom(DataStream<ItemType>* other){
+    // the items left in this copy and the items added since should all still be in the other stream
+    uint32_t expected = this->currentSize + (other->totalCount - this->totalCount);
+    if(this->countDrops && expected > other->currentSize){
+        this->droppedCount += expected - other->currentSize;
+    }
+    for(unsigned int i = 0; i < other->currentSize; i++){
+        this->stream[i] = other->stream[i];
+    }
+    this->currentSize = other->currentSize;
+    this->totalCount = other->totalCount;
+    this->newestTime = other->newestTime;
+    this->header = other->header;
+    this->headerLength = other->headerLength;
+}
+
+template <typename ItemType>
+void DataStream<ItemType>::restoreFrom(DataStream<ItemType>* copy){
+    // the newest items are at the front, so the ones added since the copy come before what is left of it
+    unsigned int added = min(this->totalCount - copy->totalCount, (uint32_t)this->currentSize);
+    unsigned int newSize = min(added + copy->currentSize, (unsigned int)MAX_STREAM_LENGTH);
+    for(unsigned int i = added; i < newSize; i++){
+        this->stream[i] = copy->stream[i - added];
+    }
+    this->currentSize = newSize;
+}
+
+template <typename ItemType>
+void DataStream<ItemType>::truncate(unsigned int newSize){
+    // the newest items are at the front, so dropping the oldest is just a shorter size
+    if(newSize < this->currentSize){
+        this->currentSize = newSize;
+    }
+}
+
 template <typename ItemType>
 unsigned int DataStream<ItemType>::size(){
     return this->currentSize;
@@ -0,0 +1,108 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Keeps a running total of head impact exposure for the session and for each player
+*/
+
+#include "ExposureTracker.h"
+
+bool ExposureTracker::init(){
+    this->storageOpen = this->storage.begin("exposure", false);
+    if(!this->storageOpen){
+        Serial.println("Failed to open exposure storage. Totals will not survive a reboot.");
+        return false;
+    }
+
+    // anything that doesn't match the current record size is from an old firmware and is ignored
+    if(this->storage.getBytesLength("session") == sizeof(ExposureRecord)){
+        this->storage.getBytes("session", &this->session, sizeof(ExposureRecord));
+    }
+    char key[4];
+    for(uint8_t i = 0; i < EXPOSURE_MAX_PLAYERS; i++){
+        snprintf(key, sizeof(key), "p%d", i);
+        if(this->storage.getBytesLength(key) == sizeof(ExposureRecord)){
+            this->storage.getBytes(key, &this->players[i], sizeof(ExposureRecord));
+        }
+    }
+    this->currentPlayer = this->storage.getUInt("player", 0) % EXPOSURE_MAX_PLAYERS;
+    return true;
+}
+
+void ExposureTracker::addImpact(ExposureRecord* record, float peakG, float risk, float duration){
+    record->impacts++;
+    record->riskSum += risk;
+    record->load += peakG * duration;
+    if(risk > record->maxRisk) record->maxRisk = risk;
+    if(peakG > record->maxG) record->maxG = peakG;
+
+    // find the highest bin the peak reaches
+    uint8_t bin = 0;
+    for(uint8_t i = 1; i < EXPOSURE_HISTOGRAM_BINS; i++){
+        if(peakG >= exposureBinEdges[i]) bin = i;
+    }
+    // saturate rather than roll over so a full season can't wrap a bin back to 0
+    if(record->histogram[bin] < UINT16_MAX) record->histogram[bin]++;
+}
+
+void ExposureTracker::recordImpact(float peakG, float risk, float duration){
+    addImpact(&this->session, peakG, risk, duration);
+    addImpact(&this->players[this->currentPlayer], peakG, risk, duration);
+    // only the two records that changed are written so this stays the same cost no matter the history
+    saveSession();
+    savePlayer(this->currentPlayer);
+}
+
+void ExposureTracker::resetSession(){
+    this->session = {};
+    saveSession();
+}
+
+void ExposureTracker::resetPlayer(uint8_t player){
+    if(player >= EXPOSURE_MAX_PLAYERS) return;
+    this->players[player] = {};
+    savePlayer(player);
+}
+
+bool ExposureTracker::setPlayer(uint8_t player){
+    if(player >= EXPOSURE_MAX_PLAYERS) return false;
+    this->currentPlayer = player;
+    if(this->storageOpen) this->storage.putUInt("player", player);
+    return true;
+}
+
+ExposureRecord* ExposureTracker::getPlayerRecord(uint8_t player){
+    if(player >= EXPOSURE_MAX_PLAYERS) return nullptr;
+    return &this->players[player];
+}
+
+void ExposureTracker::saveSession(){
+    if(!this->storageOpen) return;
+    this->storage.putBytes("session", &this->session, sizeof(ExposureRecord));
+}
+
+void ExposureTracker::savePlayer(uint8_t player){
+    if(!this->storageOpen) return;
+    char key[4];
+    snprintf(key, sizeof(key), "p%d", player);
+    this->storage.putBytes(key, &this->players[player], sizeof(ExposureRecord));
+}
+
+void ExposureTracker::print(Print* out, String label, ExposureRecord* record){
+    out->print("!Exposure,");
+    out->print(label);
+    out->print(",");
+    out->print(record->impacts);
+    out->print(",");
+    out->print(record->riskSum, 4);
+    out->print(",");
+    out->print(record->maxRisk, 4);
+    out->print(",");
+    out->print(record->maxG, 2);
+    out->print(",");
+    out->print(record->load, 4);
+    for(uint8_t i = 0; i < EXPOSURE_HISTOGRAM_BINS; i++){
+        out->print(",");
+        out->print(record->histogram[i]);
+    }
+    out->println(";");
+}
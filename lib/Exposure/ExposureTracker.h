@@ -0,0 +1,111 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Keeps a running total of head impact exposure for the session and for each player
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#define EXPOSURE_HISTOGRAM_BINS 8
+#define EXPOSURE_MAX_PLAYERS 16
+
+// lower edge of each peak g histogram bin. The last bin holds everything above its edge
+const float exposureBinEdges[EXPOSURE_HISTOGRAM_BINS] = {0, 10, 20, 40, 60, 80, 100, 150};
+
+// a fixed size summary of every impact seen. This is stored as is in flash so don't reorder it
+struct ExposureRecord{
+    uint32_t impacts; // number of impacts recorded
+    float riskSum; // sum of the concussion probability of every impact
+    float maxRisk; // highest concussion probability of any impact
+    float maxG; // highest peak linear acceleration of any impact in g
+    float load; // sum of peak g times the time spent above the impact threshold, in g*s
+    uint16_t histogram[EXPOSURE_HISTOGRAM_BINS]; // impact count by peak g
+};
+
+class ExposureTracker{
+    public:
+        ExposureTracker() = default;
+        ~ExposureTracker() = default;
+
+        /**
+         * @brief load the stored session and player totals from flash
+         * @returns true if flash storage could be opened
+         */
+        bool init();
+
+        /**
+         * @brief add one impact to the session and the current player. This is O(1)
+         * @param peakG the peak linear acceleration of the impact in g
+         * @param risk the concussion probability of the impact
+         * @param duration the time the impact spent above the impact threshold in seconds
+         */
+        void recordImpact(float peakG, float risk, float duration);
+
+        /**
+         * @brief clear the session totals. Player totals are kept
+         */
+        void resetSession();
+
+        /**
+         * @brief clear the totals for one player
+         * @param player the player number
+         */
+        void resetPlayer(uint8_t player);
+
+        /**
+         * @brief set the player who is being hit
+         * @param player the player number (0 to EXPOSURE_MAX_PLAYERS - 1)
+         * @returns true if the player number is valid
+         */
+        bool setPlayer(uint8_t player);
+
+        /**
+         * @brief get the player who is being hit
+         */
+        uint8_t getPlayer(){return currentPlayer;};
+
+        /**
+         * @brief get the session totals
+         */
+        ExposureRecord* getSession(){return &session;};
+
+        /**
+         * @brief get the totals for a player
+         * @param player the player number
+         * @returns a pointer to the player's totals or nullptr if the player number is invalid
+         */
+        ExposureRecord* getPlayerRecord(uint8_t player);
+
+        /**
+         * @brief print a record in the form !Exposure,<label>,<impacts>,<riskSum>,<maxRisk>,<maxG>,<load>,<bin 0>,...,<bin n>;
+         * @param out where to print the record
+         * @param label a label for the record (ex: "Session" or the player number)
+         * @param record the record to print
+         */
+        static void print(Print* out, String label, ExposureRecord* record);
+
+    private:
+        Preferences storage;
+        bool storageOpen = false;
+        uint8_t currentPlayer = 0;
+        ExposureRecord session = {};
+        ExposureRecord players[EXPOSURE_MAX_PLAYERS] = {};
+
+        /**
+         * @brief add an impact to a record
+         */
+        void addImpact(ExposureRecord* record, float peakG, float risk, float duration);
+
+        /**
+         * @brief write the session record to flash
+         */
+        void saveSession();
+
+        /**
+         * @brief write one player record to flash
+         */
+        void savePlayer(uint8_t player);
+};
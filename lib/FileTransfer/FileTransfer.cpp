@@ -0,0 +1,215 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Lists the logs on the SD card and sends them to the host in chunks. See Scripts/log_download.py for the host side
+*/
+
+#include "FileTransfer.h"
+#include "CRC32.h"
+#include "SerialMessage.h"
+
+FileTransfer::FileTransfer(const char* directory) :
+directory(directory){
+}
+
+void FileTransfer::init(){
+    if(this->requests == nullptr){
+        // only the newest request matters, so the queue holds one
+        this->requests = xQueueCreate(1, sizeof(TransferRequest));
+        this->runLock = xSemaphoreCreateMutex();
+    }
+}
+
+bool FileTransfer::submit(const TransferRequest& request){
+    if(this->requests == nullptr){
+        return false;
+    }
+    TransferRequest stale;
+    xQueueReceive(this->requests, &stale, 0);
+    this->cancelRequested = true;
+    return xQueueSend(this->requests, &request, 0) == pdTRUE;
+}
+
+bool FileTransfer::requestList(Print* out, Telemetry* link){
+    TransferRequest request = {TRANSFER_LIST, 0, 0, 0, out, link};
+    return submit(request);
+}
+
+bool FileTransfer::requestFile(Print* out, Telemetry* link, int file, uint32_t offset, uint32_t crc){
+    if(file < 0 || file >= this->fileCount){
+        return false;
+    }
+    TransferRequest request = {TRANSFER_FILE, (uint8_t)file, offset, crc, out, link};
+    return submit(request);
+}
+
+void FileTransfer::cancel(){
+    if(this->requests != nullptr){
+        TransferRequest stale;
+        xQueueReceive(this->requests, &stale, 0);
+    }
+    this->cancelRequested = true;
+}
+
+void FileTransfer::suspend(){
+    if(this->runLock == nullptr){
+        return;
+    }
+    // the running transfer stops at its next chunk and lets go of the card
+    cancel();
+    xSemaphoreTake(this->runLock, portMAX_DELAY);
+}
+
+void FileTransfer::resume(){
+    if(this->runLock != nullptr){
+        xSemaphoreGive(this->runLock);
+    }
+}
+
+void FileTransfer::run(TickType_t wait){
+    TransferRequest request;
+    if(this->requests == nullptr || xQueueReceive(this->requests, &request, wait) != pdTRUE){
+        return;
+    }
+    // a request that comes in while transfers are suspended runs once they resume
+    xSemaphoreTake(this->runLock, portMAX_DELAY);
+    this->cancelRequested = false;
+    if(request.type == TRANSFER_LIST){
+        list(request);
+    }
+    else{
+        sendFile(request);
+    }
+    xSemaphoreGive(this->runLock);
+}
+
+bool FileTransfer::waitUntilIdle(){
+    while(this->paused != nullptr && this->paused()){
+        if(this->cancelRequested){
+            return false;
+        }
+        delay(FILE_TRANSFER_PAUSE_MS);
+    }
+    return !this->cancelRequested;
+}
+
+bool FileTransfer::retrySend(unsigned long start){
+    if(this->cancelRequested || millis() - start >= FILE_TRANSFER_SEND_TIMEOUT_MS){
+        return false;
+    }
+    delay(FILE_TRANSFER_RETRY_MS);
+    return true;
+}
+
+void FileTransfer::getPath(uint8_t file, char* path, size_t length){
+    size_t directoryLength = strlen(this->directory);
+    bool slash = directoryLength > 0 && this->directory[directoryLength - 1] == '/';
+    snprintf(path, length, "%s%s%s", this->directory, slash ? "" : "/", this->names[file]);
+}
+
+void FileTransfer::list(const TransferRequest& request){
+    // the list is rebuilt from scratch, so nothing can be fetched until it's done
+    this->fileCount = 0;
+    uint8_t count = 0;
+    File dir = SD.open(this->directory);
+    if(dir && dir.isDirectory()){
+        File entry = dir.openNextFile();
+        while(entry && count < FILE_TRANSFER_MAX_FILES){
+            // some versions of the SD library return the full path instead of the name
+            const char* name = strrchr(entry.name(), '/');
+            name = (name == nullptr) ? entry.name() : name + 1;
+            // a file that is still being written would change under the host, so it isn't offered
+            bool busy = this->inUse != nullptr && this->inUse(name);
+            if(!entry.isDirectory() && !busy && strlen(name) < FILE_TRANSFER_NAME_LENGTH){
+                strcpy(this->names[count++], name);
+            }
+            entry.close();
+            entry = dir.openNextFile();
+        }
+        entry.close();
+    }
+    dir.close();
+
+    uint8_t buffer[FILE_TRANSFER_CHUNK_SIZE];
+    char path[FILE_TRANSFER_NAME_LENGTH + 40];
+    for(uint8_t i = 0; i < count; i++){
+        if(!waitUntilIdle()){
+            return;
+        }
+        getPath(i, path, sizeof(path));
+        File file = SD.open(path, FILE_READ);
+        uint32_t size = 0;
+        uint32_t crc = 0;
+        while(file && !this->cancelRequested){
+            size_t read = file.read(buffer, sizeof(buffer));
+            if(read == 0){
+                break;
+            }
+            crc = crc32(buffer, read, crc);
+            size += read;
+        }
+        file.close();
+        if(this->cancelRequested){
+            return;
+        }
+        request.out->println("!File," + String(i) + "," + this->names[i] + "," + String(size) + "," + String(crc) + ";");
+    }
+    this->fileCount = count;
+    request.out->println("!FileListEnd," + String(count) + ";");
+}
+
+void FileTransfer::sendFile(const TransferRequest& request){
+    char path[FILE_TRANSFER_NAME_LENGTH + 40];
+    getPath(request.file, path, sizeof(path));
+    if(this->inUse != nullptr && this->inUse(this->names[request.file])){
+        request.out->println("!ERR," + String(FILE_GET) + "," + String(path) + " is being written;");
+        return;
+    }
+    File file = SD.open(path, FILE_READ);
+    if(!file || file.size() < request.offset || !file.seek(request.offset)){
+        request.out->println("!ERR," + String(FILE_GET) + ",Can't read " + String(path) + ";");
+        file.close();
+        return;
+    }
+
+    // the whole file CRC lets the host check a download that was put together from several transfers.
+    // The host has the bytes before the offset, so it sends their CRC instead of the card reading them again
+    uint8_t buffer[FILE_TRANSFER_CHUNK_SIZE];
+    uint32_t crc = request.crc;
+    uint32_t offset = request.offset;
+    uint32_t sequence = 0;
+    while(true){
+        if(!waitUntilIdle()){
+            file.close();
+            return;
+        }
+        size_t read = file.read(buffer, sizeof(buffer));
+        if(read == 0){
+            break;
+        }
+        // a full link only means the host is slow, so keep trying for a while before giving up on it
+        unsigned long start = millis();
+        while(!request.link->sendFileChunk(request.file, sequence, offset, buffer, read)){
+            if(!retrySend(start)){
+                if(!this->cancelRequested){
+                    request.out->println("!ERR," + String(FILE_GET) + ",Link stalled at " + String(offset) + ";");
+                }
+                file.close();
+                return;
+            }
+        }
+        crc = crc32(buffer, read, crc);
+        sequence++;
+        offset += read;
+    }
+    file.close();
+    unsigned long start = millis();
+    while(!request.link->sendFileEnd(request.file, sequence, offset, crc)){
+        if(!retrySend(start)){
+            if(!this->cancelRequested){
+                request.out->println("!ERR," + String(FILE_GET) + ",Link stalled at " + String(offset) + ";");
+            }
+            return;
+        }
+    }
+}
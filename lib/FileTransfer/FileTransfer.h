@@ -0,0 +1,148 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Lists the logs on the SD card and sends them to the host in chunks. See Scripts/log_download.py for the host side
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+#include "Telemetry.h"
+
+// the most files that can be listed. The rest are left out of the list
+#define FILE_TRANSFER_MAX_FILES 64
+#define FILE_TRANSFER_NAME_LENGTH 32
+// bytes of file data in each chunk frame
+#define FILE_TRANSFER_CHUNK_SIZE 224
+// how long a transfer waits while a recording is being written before it checks again, in ms
+#define FILE_TRANSFER_PAUSE_MS 100
+// how long a chunk keeps being retried while the link can't take it before the transfer gives up, in ms
+#define FILE_TRANSFER_SEND_TIMEOUT_MS 5000
+// the wait between tries, in ms
+#define FILE_TRANSFER_RETRY_MS 10
+
+typedef enum{
+    TRANSFER_LIST,
+    TRANSFER_FILE
+}TransferType;
+
+// a request handed from the command task to the transfer task
+struct TransferRequest{
+    TransferType type;
+    uint8_t file;
+    uint32_t offset;
+    uint32_t crc; // CRC-32 of the bytes before offset
+    Print* out; // where text replies go
+    Telemetry* link; // where chunk frames go. Must write to the same port as out
+};
+
+class FileTransfer{
+    public:
+        /**
+         * @brief Construct a new File Transfer object
+         * @param directory the directory whose files are listed
+         */
+        FileTransfer(const char* directory = "/");
+        ~FileTransfer() = default;
+
+        /**
+         * @brief create the request queue. Call once from setup before any requests are made
+         */
+        void init();
+
+        /**
+         * @brief pause transfers while this returns true so they don't compete with a recording for the card
+         * @param paused a function that returns true while transfers should wait. nullptr never pauses
+         */
+        void setPauseCheck(bool (*paused)()){this->paused = paused;};
+
+        /**
+         * @brief leave out files that are still being written. They are not listed and can't be fetched
+         * @param inUse a function that returns true if the named file is open for writing. nullptr sends every file
+         */
+        void setInUseCheck(bool (*inUse)(const char* name)){this->inUse = inUse;};
+
+        /**
+         * @brief list every file as !File,<index>,<name>,<size>,<crc32>; followed by !FileListEnd,<count>;
+         * The CRCs are worked out by the transfer task, so this returns right away
+         * @returns false if the request couldn't be queued
+         */
+        bool requestList(Print* out, Telemetry* link);
+
+        /**
+         * @brief send a file from the last list as chunk frames followed by an end frame. A request made while another
+         * transfer is running replaces it, so a host resumes after a dropped connection by asking again from the first
+         * offset it is missing. A chunk the link can't take is retried for FILE_TRANSFER_SEND_TIMEOUT_MS and then the
+         * transfer stops with an error
+         * @param file the file's index in the last list
+         * @param offset where to start in the file
+         * @param crc the CRC-32 of the bytes the host already has. The end frame carries it on over the rest of the file
+         * @returns false if the file isn't in the last list or the request couldn't be queued
+         */
+        bool requestFile(Print* out, Telemetry* link, int file, uint32_t offset, uint32_t crc);
+
+        /**
+         * @brief stop the transfer that is running and drop any that are waiting
+         */
+        void cancel();
+
+        /**
+         * @brief stop the running transfer and hold off new ones until resume(), so the card can be restarted
+         */
+        void suspend();
+
+        /**
+         * @brief let transfers run again after suspend()
+         */
+        void resume();
+
+        /**
+         * @brief wait for a request and run it. Call this in a loop from a low priority task
+         * @param wait how long to wait for a request
+         */
+        void run(TickType_t wait);
+
+        /**
+         * @brief get the number of files found by the last list
+         */
+        uint8_t getFileCount(){return fileCount;};
+
+    private:
+        const char* directory;
+        QueueHandle_t requests = nullptr;
+        bool (*paused)() = nullptr;
+        bool (*inUse)(const char* name) = nullptr;
+        // held while a request runs and by suspend()
+        SemaphoreHandle_t runLock = nullptr;
+        // set to stop the running transfer at the next chunk
+        volatile bool cancelRequested = false;
+        char names[FILE_TRANSFER_MAX_FILES][FILE_TRANSFER_NAME_LENGTH];
+        volatile uint8_t fileCount = 0;
+
+        /**
+         * @brief queue a request in place of any that haven't started and stop the running one
+         */
+        bool submit(const TransferRequest& request);
+
+        void list(const TransferRequest& request);
+        void sendFile(const TransferRequest& request);
+
+        /**
+         * @brief wait while a recording is being written
+         * @returns false if the transfer was cancelled while waiting
+         */
+        bool waitUntilIdle();
+
+        /**
+         * @brief wait before trying a send again
+         * @param start when the first try was made
+         * @returns false if the transfer was cancelled or has been trying for FILE_TRANSFER_SEND_TIMEOUT_MS
+         */
+        bool retrySend(unsigned long start);
+
+        /**
+         * @brief build the full path of a listed file
+         */
+        void getPath(uint8_t file, char* path, size_t length);
+};
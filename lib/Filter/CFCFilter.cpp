@@ -0,0 +1,127 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief SAE J211 channel frequency class (CFC) filters for the impact data streams
+*/
+
+#include "CFCFilter.h"
+
+bool Biquad::configure(float cfc, float sampleRate){
+    // these equations come straight from SAE J211-1 appendix C
+    double wd = 2 * PI * cfc * CFC_DESIGN_RATIO;
+    double halfAngle = wd / (2 * sampleRate);
+    // the pre-warped frequency has to be below nyquist or the filter is unstable
+    if(cfc <= 0 || sampleRate <= 0 || halfAngle >= PI / 2){
+        return false;
+    }
+    double wa = tan(halfAngle);
+    double denominator = 1 + sqrt(2) * wa + wa * wa;
+    a0 = wa * wa / denominator;
+    a1 = 2 * a0;
+    a2 = a0;
+    b1 = -2 * (wa * wa - 1) / denominator;
+    b2 = (-1 + sqrt(2) * wa - wa * wa) / denominator;
+    reset();
+    return true;
+}
+
+void Biquad::reset(float value){
+    // the filter has unity gain at DC so this is its steady state for a constant input
+    x1 = value;
+    x2 = value;
+    y1 = value;
+    y2 = value;
+}
+
+bool CFCFilter::configure(float cfc, float sampleRate){
+    enabled = false;
+    primed = false;
+    if(cfc == 0){
+        return true;
+    }
+    if(!sections[0].configure(cfc, sampleRate) || !sections[1].configure(cfc, sampleRate)){
+        Serial.println("CFC " + String(cfc) + " can not be realized at " + String(sampleRate) + "Hz. Filter disabled.");
+        return false;
+    }
+    enabled = true;
+    return true;
+}
+
+float CFCFilter::update(float x){
+    if(!enabled){
+        return x;
+    }
+    // settle the filter on the first sample so sensor offsets don't ring through the output
+    if(!primed){
+        sections[0].reset(x);
+        sections[1].reset(x);
+        primed = true;
+    }
+    return sections[1].step(sections[0].step(x));
+}
+
+bool CFCFilter::filtfilt(double* data, unsigned int length, float cfc, float sampleRate){
+    Biquad section;
+    if(length == 0 || !section.configure(cfc, sampleRate)){
+        return false;
+    }
+
+    // forward pass
+    section.reset(data[0]);
+    for(unsigned int i = 0; i < length; i++){
+        data[i] = section.step(data[i]);
+    }
+
+    // backward pass cancels the phase shift of the forward pass
+    section.reset(data[length - 1]);
+    for(unsigned int i = length; i > 0; i--){
+        data[i - 1] = section.step(data[i - 1]);
+    }
+    return true;
+}
+
+bool XYZFilter::configure(float cfc, float sampleRate){
+    bool success = true;
+    for(int i = 0; i < 3; i++){
+        success &= axes[i].configure(cfc, sampleRate);
+    }
+    // don't leave the axes in a half configured state
+    if(!success){
+        for(int i = 0; i < 3; i++){
+            axes[i].configure(0, sampleRate);
+        }
+    }
+    return success;
+}
+
+void XYZFilter::update(double* data){
+    data[0] = axes[0].update(data[0]);
+    data[1] = axes[1].update(data[1]);
+    data[2] = axes[2].update(data[2]);
+}
+
+void XYZFilter::reset(){
+    axes[0].reset();
+    axes[1].reset();
+    axes[2].reset();
+}
+
+float XYZFilter::benchmark(unsigned int samples){
+    XYZFilter filter;
+    filter.configure(60, 500);
+    double data[3] = {0, 0, 0};
+    unsigned long start = micros();
+    for(unsigned int i = 0; i < samples; i++){
+        // alternate the input so the compiler can't fold the loop away
+        data[0] = (i & 1) ? 1.0 : -1.0;
+        data[1] = data[0] * 2;
+        data[2] = data[0] * 3;
+        filter.update(data);
+    }
+    unsigned long elapsed = micros() - start;
+    // make sure the result is used
+    if(isnan(data[0] + data[1] + data[2])){
+        Serial.println("Filter benchmark produced NaN");
+    }
+    return float(elapsed) / samples;
+}
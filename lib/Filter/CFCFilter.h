@@ -0,0 +1,144 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief SAE J211 channel frequency class (CFC) filters for the impact data streams
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+// SAE J211 places the -3dB point of a CFC filter at 1.65*CFC which puts the design frequency at 2.0775*CFC
+#define CFC_DESIGN_RATIO 2.0775
+
+// the ESP32 FPU is single precision only, so all filter math is done in floats.
+// doubles are emulated in software and cost several times more per sample.
+class Biquad{
+    public:
+        Biquad() = default;
+        ~Biquad() = default;
+
+        /**
+         * @brief calculate the SAE J211 2-pole butterworth coefficients for a given CFC
+         * @param cfc the channel frequency class (60, 180, 600, 1000, ...)
+         * @param sampleRate the rate the filter will be run at in Hz
+         * @returns true if the CFC can be realized at the given sample rate
+         */
+        bool configure(float cfc, float sampleRate);
+
+        /**
+         * @brief run one sample through the filter
+         * @param x the new input sample
+         * @returns the filtered output sample
+         */
+        float step(float x){
+            float y = a0*x + a1*x1 + a2*x2 + b1*y1 + b2*y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            return y;
+        };
+
+        /**
+         * @brief preload the filter history so a constant input of value passes through with no transient
+         * @param value the value to settle the filter at
+         */
+        void reset(float value = 0);
+
+    private:
+        // feed forward coefficients
+        float a0 = 1, a1 = 0, a2 = 0;
+        // feedback coefficients (J211 sign convention, they are added)
+        float b1 = 0, b2 = 0;
+        // filter history
+        float x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+};
+
+class CFCFilter{
+    public:
+        CFCFilter() = default;
+        ~CFCFilter() = default;
+
+        /**
+         * @brief configure the filter for a channel frequency class
+         * @param cfc the channel frequency class. 0 disables the filter
+         * @param sampleRate the rate update() will be called at in Hz
+         * @returns true if the filter was configured. On failure the filter is left disabled
+         */
+        bool configure(float cfc, float sampleRate);
+
+        /**
+         * @brief filter one sample with two cascaded J211 sections (4-pole, causal)
+         * @param x the new input sample
+         * @returns the filtered sample, or x if the filter is disabled
+         */
+        float update(float x);
+
+        /**
+         * @brief clear the filter history. The next sample will be used to settle the filter
+         */
+        void reset(){primed = false;};
+
+        /**
+         * @brief returns true if the filter has been configured and will modify data
+         */
+        bool isEnabled(){return enabled;};
+
+        /**
+         * @brief filter a complete recording with zero phase shift as described in SAE J211.
+         * A single 2-pole section is run forward and then backward over the data, which gives a 4-pole
+         * magnitude response with no phase lag. Use this on a finished recording, not in the acquisition loop.
+         * @param data the samples to filter. They are overwritten with the filtered samples
+         * @param length the number of samples in data
+         * @param cfc the channel frequency class
+         * @param sampleRate the rate the data was sampled at in Hz
+         * @returns true if the data was filtered
+         */
+        static bool filtfilt(double* data, unsigned int length, float cfc, float sampleRate);
+
+    private:
+        Biquad sections[2];
+        bool enabled = false;
+        bool primed = false;
+};
+
+class XYZFilter{
+    public:
+        XYZFilter() = default;
+        ~XYZFilter() = default;
+
+        /**
+         * @brief configure all three axes with the same channel frequency class
+         * @param cfc the channel frequency class. 0 disables the filter
+         * @param sampleRate the rate update() will be called at in Hz
+         * @returns true if the filter was configured
+         */
+        bool configure(float cfc, float sampleRate);
+
+        /**
+         * @brief filter a 3 element array in place
+         * @param data an array of x, y and z samples
+         */
+        void update(double* data);
+
+        /**
+         * @brief clear the filter history on all axes
+         */
+        void reset();
+
+        /**
+         * @brief returns true if the filter will modify data
+         */
+        bool isEnabled(){return axes[0].isEnabled();};
+
+        /**
+         * @brief time the incremental filter on all three axes
+         * @param samples the number of samples to run through the filter
+         * @returns the average cost of one 3 axis sample in microseconds
+         */
+        static float benchmark(unsigned int samples = 10000);
+
+    private:
+        CFCFilter axes[3];
+};
@@ -0,0 +1,74 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Blends the low g IMU accelerometer with the high g accelerometer into one linear acceleration stream
+*/
+
+#include "AccelFusion.h"
+
+AccelFusion::AccelFusion(double blendStart, double blendEnd) :
+    blendStart(blendStart), blendEnd(blendEnd){}
+
+bool AccelFusion::init(){
+    this->initialized = true;
+    this->getDataStream()->setInitialized(true);
+    return true;
+}
+
+void AccelFusion::update(xyzData* lowG, xyzData* highG, xyzData* lowGRaw){
+    if(lowG == nullptr && highG == nullptr){
+        return;
+    }
+
+    // the high g accelerometer reports in m/s^2. Everything downstream works in g
+    xyzData high = {0, 0, 0};
+    if(highG != nullptr){
+        high = {highG->x / STANDARD_GRAVITY, highG->y / STANDARD_GRAVITY, highG->z / STANDARD_GRAVITY};
+    }
+
+    if(lowG == nullptr){
+        this->highGWeight = 1;
+    }
+    else if(highG == nullptr){
+        this->highGWeight = 0;
+    }
+    else{
+        // the low g accelerometer saturates per axis, so look at the largest axis in either direction. A filter smooths a
+        // clipped peak below the blend window, so this has to be the reading before it was filtered
+        xyzData* reading = lowGRaw == nullptr ? lowG : lowGRaw;
+        double largestAxis = max(fabs(reading->x), max(fabs(reading->y), fabs(reading->z)));
+        // crossfade linearly across the blend window so the output doesn't step when switching sensors
+        double weight = (largestAxis - blendStart) / (blendEnd - blendStart);
+        this->highGWeight = min(1.0, max(0.0, weight));
+    }
+
+    double data[3];
+    if(this->highGWeight <= 0){
+        data[0] = lowG->x;
+        data[1] = lowG->y;
+        data[2] = lowG->z;
+    }
+    else if(this->highGWeight >= 1){
+        data[0] = high.x;
+        data[1] = high.y;
+        data[2] = high.z;
+    }
+    else{
+        double lowWeight = 1 - this->highGWeight;
+        data[0] = lowWeight * lowG->x + this->highGWeight * high.x;
+        data[1] = lowWeight * lowG->y + this->highGWeight * high.y;
+        data[2] = lowWeight * lowG->z + this->highGWeight * high.z;
+    }
+    this->sensorTemplate::update(data);
+}
+
+void AccelFusion::setHeader(char * header, unsigned int length){
+    char accel[] = "FusedAccel";
+    // create a new header that is the old header + the fused header
+    char* newHeader = new char[length + sizeof(accel)];
+    // copy the old header and the fused header into the new header
+    memcpy(newHeader, header, length);
+    memcpy(newHeader + length, accel, sizeof(accel));
+    // call the parent class's setHeader function
+    sensorTemplate::setHeader(newHeader, length + sizeof(accel));
+}
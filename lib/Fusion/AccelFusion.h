@@ -0,0 +1,60 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Blends the low g IMU accelerometer with the high g accelerometer into one linear acceleration stream
+*/
+
+#pragma once
+
+#include "sensorTemplate.h"
+
+// standard gravity. used to convert the high g accelerometer from m/s^2 to g
+#define STANDARD_GRAVITY 9.80665
+
+class AccelFusion : public sensorTemplate{
+    public:
+        /**
+         * @brief Construct a new Accel Fusion object
+         * @param blendStart the low g reading (in g on any axis) where the high g accelerometer starts being mixed in
+         * @param blendEnd the low g reading (in g on any axis) where only the high g accelerometer is used.
+         * This should be a little below the full scale range of the low g accelerometer
+         */
+        AccelFusion(double blendStart = 12, double blendEnd = 15);
+
+        /**
+         * @brief there is no hardware to initialize
+         * @returns true
+         */
+        bool init() override;
+
+        /**
+         * @brief there is nothing to calibrate. Both input sensors calibrate themselves
+         */
+        void calibrate() override {};
+
+        /**
+         * @brief combine one sample from each accelerometer and store the result
+         * @param lowG the low g accelerometer sample in g, or nullptr if that sensor is not available
+         * @param highG the high g accelerometer sample in m/s^2, or nullptr if that sensor is not available
+         * @param lowGRaw the low g sample before it was filtered, which saturation is judged on. lowG if nullptr
+         */
+        void update(xyzData* lowG, xyzData* highG, xyzData* lowGRaw = nullptr);
+
+        /**
+         * @brief get the weight given to the high g accelerometer in the last sample
+         * @returns a number from 0 (only low g) to 1 (only high g)
+         */
+        double getHighGWeight(){return highGWeight;};
+
+        /**
+         * @brief Set the header for the data stream
+         * @param header A pointer to the header array
+         * @param length The length of the header array
+        */
+        void setHeader(char* header, unsigned int length) override;
+
+    private:
+        double blendStart;
+        double blendEnd;
+        double highGWeight = 0;
+};
@@ -8,6 +8,9 @@
 #include <Arduino.h>
 
 void sensorTemplate::update(double* data){
+    this->raw = {data[0], data[1], data[2]};
+    // filter the raw data before anything downstream sees it
+    this->filter.update(data);
     // use the xyzData struct to store the data
     this->data = {data[0], data[1], data[2]};
     this->stream.prepend(this->data);
@@ -37,4 +40,8 @@ DataStream<xyzData>* sensorTemplate::getDataStream(){
 
 void sensorTemplate::setHeader(char * header, unsigned int length){
     this->stream.setHeader(header, length);
+}
+
+bool sensorTemplate::setFilter(float cfc, float sampleRate){
+    return this->filter.configure(cfc, sampleRate);
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #pragma once
 #include "DataStream.h"
+#include "CFCFilter.h"
 #include <Arduino.h>
 
 struct xyzData{
@@ -54,6 +55,12 @@ class sensorTemplate{
          */
         virtual xyzData* getData();
 
+        /**
+         * @brief get the last data read from the device before it was filtered
+         * @returns the last unfiltered data. The same as getData if there is no filter
+         */
+        xyzData* getRawData(){return &(this->raw);};
+
         /**
          * @brief reset the peak data to 0
          * @returns None.
@@ -79,8 +86,17 @@ class sensorTemplate{
         */
         virtual void setHeader(char * header, unsigned int length);
 
+        /**
+         * @brief filter all new data with an SAE J211 filter before it is stored
+         * @param cfc the channel frequency class to filter with. 0 turns the filter off
+         * @param sampleRate the rate update() is called at in Hz
+         * @returns true if the filter could be configured
+        */
+        bool setFilter(float cfc, float sampleRate);
+
     protected:
         xyzData data = {0,0,0};
+        xyzData raw = {0,0,0}; // the last data before the filter
         xyzData offset = {0,0,0};
         xyzData peak_data = {0,0,0};
         double peak_mag = 0;
@@ -89,4 +105,5 @@ class sensorTemplate{
         unsigned long lastUpdateTime = 0;
 
         DataStream<xyzData> stream;
+        XYZFilter filter; // passes data through untouched until setFilter() is called
 };
\ No newline at end of file
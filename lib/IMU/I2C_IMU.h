@@ -48,6 +48,24 @@ class I2C_IMU : public I2C_Device{
          */
         double* getData() override;
 
+        /**
+         * @brief get the last accelerometer sample
+         * @returns a pointer to the last acceleration in g
+         */
+        xyzData* getAccelData(){return accel.getData();};
+
+        /**
+         * @brief get the last accelerometer sample before it was filtered
+         * @returns a pointer to the last unfiltered acceleration in g
+         */
+        xyzData* getRawAccelData(){return accel.getRawData();};
+
+        /**
+         * @brief get the last gyroscope sample
+         * @returns a pointer to the last gyroscope sample
+         */
+        xyzData* getGyroData(){return gyro.getData();};
+
         /**
          * @brief Get the current rotation as measured by the gyro
          * @return xyzData* of accumulated rotation (current angle in radians
@@ -90,6 +108,22 @@ class I2C_IMU : public I2C_Device{
          */
         DataStream<xyzData>* getGyroStream();
 
+        /**
+         * @brief filter the accelerometer data with an SAE J211 filter
+         * @param cfc the channel frequency class. 0 turns the filter off
+         * @param sampleRate the rate update() is called at in Hz
+         * @returns true if the filter could be configured
+         */
+        bool setAccelFilter(float cfc, float sampleRate){return accel.setFilter(cfc, sampleRate);};
+
+        /**
+         * @brief filter the gyroscope data with an SAE J211 filter
+         * @param cfc the channel frequency class. 0 turns the filter off
+         * @param sampleRate the rate update() is called at in Hz
+         * @returns true if the filter could be configured
+         */
+        bool setGyroFilter(float cfc, float sampleRate){return gyro.setFilter(cfc, sampleRate);};
+
         /**
          * @brief returns true if properly initialized
         */
@@ -70,15 +70,33 @@ void LoadCell::calibrate(double *calibrationTemps, double *outputValues, double
     Serial.println(tempFactor);
 }
 
+bool LoadCell::sample(){
+    if(!initialized){
+        return false;
+    }
+    // the HX711 only has a new reading at 10 or 80Hz. Waiting for it would spin the task, so a cell that isn't ready is skipped
+    if(!loadCell.is_ready()){
+        return false;
+    }
+    this->pendingReading = loadCell.read();
+    this->pendingTime = esp_timer_get_time();
+    this->hasPending = true;
+    return true;
+}
+
 void LoadCell::update(){
     if(!initialized){
         Serial.println("Load cell on pin: " + String(dataPin) + "not initialized.");
         return;
     }
-    double reading = this->getWeight();
+    if(!this->hasPending){
+        return;
+    }
+    this->hasPending = false;
+    double reading = this->getWeight(this->pendingReading);
     if(reading > 0){
         lastReading = reading;
-        dataStream.prepend(lastReading);
+        dataStream.prepend(lastReading, this->pendingTime);
         if(abs(reading) > abs(peakImpact)) peakImpact = reading;
     }
 }
@@ -95,12 +113,9 @@ void LoadCell::resetPeaks(){
     peakImpact = 0;
 }
 
-double LoadCell::getWeight(){
-    if(loadCell.wait_ready_timeout(10)){
-        double reading = double(loadCell.read());
-        return a * pow(reading, 2) + b * reading + c + (tempFactor * (currentTemp - calibrationTemp));
-    }
-    return -1;
+double LoadCell::getWeight(long raw){
+    double reading = double(raw);
+    return a * pow(reading, 2) + b * reading + c + (tempFactor * (currentTemp - calibrationTemp));
 }
 
 DataStream<double> *LoadCell::getDataStream(){
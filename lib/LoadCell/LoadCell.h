@@ -32,7 +32,14 @@ class LoadCell{
         void calibrate(double* calibration_temp, double *outputValues, double* weightValues);
 
         /**
-         * @brief Read new load cell data
+         * @brief Read the HX711 if it has a new reading. Never waits for one. Only this and update touch the reading,
+         * so the owning task can call this without holding the lock other tasks use for the load cell
+         * @return true if a new reading was taken
+         */
+        bool sample();
+
+        /**
+         * @brief Add the reading taken by sample to the data stream and peaks. Does nothing without a new reading
          */
         void update();
 
@@ -102,9 +109,15 @@ class LoadCell{
 
         /**
          * @brief Given a load cell reading, return the actual weight
+         * @param raw the reading from the HX711
          * @return double The actual weight
          */
-        double getWeight();
+        double getWeight(long raw);
+
+        // the reading taken by sample and not yet added by update
+        long pendingReading = 0;
+        int64_t pendingTime = 0; // when the pending reading was taken
+        bool hasPending = false;
 
         double lastReading = 0;
         double tempFactor = 0;
@@ -7,23 +7,87 @@
 #include "SDCard.h"
 #include <SPI.h>
 #include <SD.h>
+#include <unistd.h>
+#include "CRC32.h"
+#include "ByteOrder.h"
+
+// the most values in a binary row
+#define MAX_BINARY_ROW_VALUES (4 * MAX_SD_STREAMS)
+// the largest binary row: a tag byte plus a 5 byte varint per value
+#define MAX_BINARY_ROW_LENGTH (1 + 5 * MAX_BINARY_ROW_VALUES)
+// the most characters formatDouble writes for one CSV value, not counting the terminator
+#define CSV_VALUE_LENGTH 32
+// the largest CSV row: each value and its separator plus the line ending
+#define MAX_CSV_ROW_LENGTH (CSV_VALUE_LENGTH * MAX_BINARY_ROW_VALUES + 2)
+
+// names used when printing the latency of each SDOperation
+static const char* sdOperationNames[SD_OPERATION_COUNT] = {"sd_open", "sd_write", "sd_flush", "sd_close", "sd_update"};
+
+// write 7 bits per byte, low bits first, with the top bit set on every byte but the last
+static uint8_t* putVarint(uint8_t* buffer, uint32_t value){
+    while(value >= 0x80){
+        *buffer++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *buffer++ = value;
+    return buffer;
+}
+
+// map signed values to unsigned so small negative numbers also make short varints: 0, -1, 1, -2 -> 0, 1, 2, 3
+static uint32_t zigzag(int32_t value){
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+// convert a value to a fixed point integer with the given resolution
+static int32_t quantize(double value, float scale){
+    double scaled = round(value / scale);
+    if(isnan(scaled)){
+        return 0;
+    }
+    // clamp instead of wrapping so an out of range value is obvious in the log
+    if(scaled >= (double)INT32_MAX){
+        return INT32_MAX;
+    }
+    if(scaled <= (double)INT32_MIN){
+        return INT32_MIN;
+    }
+    return (int32_t)scaled;
+}
 
 SDCard::SDCard(uint8_t CS_PIN) :
-CS_PIN(CS_PIN){}
+CS_PIN(CS_PIN){
+    // every block starts out free
+    this->freeBlocks = xQueueCreate(SD_BLOCK_COUNT, sizeof(uint8_t));
+    this->fullBlocks = xQueueCreate(SD_BLOCK_COUNT, sizeof(uint8_t));
+    this->writerLock = xSemaphoreCreateMutex();
+    for(uint8_t i = 0; i < SD_BLOCK_COUNT; i++){
+        xQueueSend(this->freeBlocks, &i, 0);
+    }
+}
 
 bool SDCard::initReader(){
-    if(!SD.begin(this->CS_PIN)){
+    if(!SD.begin(this->CS_PIN, SPI, this->frequency)){
         Serial.println("SD Card failed to initialize.");
         this->readerInitialized = false;
         return false;
     }
     Serial.println("SD Card succesfully initialized.");
     this->readerInitialized = true;
+    // a different card may have been inserted so its index has to be read again
+    this->fileIndexLoaded = false;
+    loadFileIndex();
     return true;
 }
 
 bool SDCard::init(uint8_t CS_PIN){
     this->CS_PIN = CS_PIN;
+    // use the clock the last autotune picked for this card
+    if(!this->settingsOpen){
+        this->settingsOpen = this->settings.begin("sdcard", false);
+    }
+    if(this->settingsOpen){
+        this->frequency = this->settings.getUInt("freq", SD_DEFAULT_FREQUENCY);
+    }
 
     for(int i = 0; i < 10; i++){
         if(initReader()){
@@ -47,64 +111,789 @@ void SDCard::openFile(bool newFile, const char * mode){
     // check to see if the dynamic file name is set
     if(this->dynamicFilename == nullptr){
         Serial.println("Error opening file: Dynamic file name is not set.");
-        this->fileOpen = false;
+        this->fileReady = false;
         return;
     }
 
     // check to see if the file is already open
-    if(this->fileOpen){
+    if(this->fileReady){
         Serial.println("Error opening file: A file is already open.");
         return;
     }
 
-    // create a temporary file name
-    char tempFilename[50];
-    // store the current file number in a temporary variable
-    uint32_t tempFileNumber = this->fileNumber;
-    strcpy(tempFilename, this->dynamicFilename);
-    strcat(tempFilename, "_");
-    char tempFileNumberStr[10];
-    snprintf(tempFileNumberStr, 10, "%d", this->fileNumber);
-    strcat(tempFilename, tempFileNumberStr);
-    strcat(tempFilename, extension);
-
-    // check to see if the file already exists
-    while(SD.exists(tempFilename) && *mode == *FILE_WRITE){
-        // if the file already exists, increment the file number
+    // store the current file number in a temporary variable. The recording task can change it at any time
+    portENTER_CRITICAL(&this->fileNumberLock);
+    uint32_t requestedFileNumber = this->fileNumber;
+    portEXIT_CRITICAL(&this->fileNumberLock);
+    uint32_t tempFileNumber = requestedFileNumber;
+    // the index holds the first number that has never been used, so normally the first name tried is free
+    if(!this->fileIndexLoaded){
+        loadFileIndex();
+    }
+    if(*mode == *FILE_WRITE && tempFileNumber < this->nextFileNumber){
+        tempFileNumber = this->nextFileNumber;
+    }
+
+    // FILE_WRITE empties an existing file, so never trust the index alone. It can be stale if the card was
+    // written by another device or the power went out before it was saved
+    char name[sizeof(this->filename)];
+    snprintf(name, sizeof(name), "%s_%lu%s", this->dynamicFilename, (unsigned long)tempFileNumber, this->extension);
+    while(SD.exists(name)){
         tempFileNumber++;
-        // create a new temporary file name
-        strcpy(tempFilename, this->dynamicFilename);
-        strcat(tempFilename, "_");
-        char tempFileNumberStr[10];
-        snprintf(tempFileNumberStr, 10, "%d", tempFileNumber);
-        strcat(tempFilename, tempFileNumberStr);
-        strcat(tempFilename, extension);
+        snprintf(name, sizeof(name), "%s_%lu%s", this->dynamicFilename, (unsigned long)tempFileNumber, this->extension);
     }
+    // file transfers check the name from their own task
+    portENTER_CRITICAL(&this->fileNumberLock);
+    memcpy(this->filename, name, sizeof(name));
+    portEXIT_CRITICAL(&this->fileNumberLock);
 
-    strcpy(this->filename, tempFilename);
+    // save the index first so a power loss while the file is open can't lead to the same number being used again
+    if(tempFileNumber >= this->nextFileNumber){
+        this->nextFileNumber = tempFileNumber + 1;
+        saveFileIndex();
+    }
 
-    // open the file
-    this->file = SD.open(this->filename, FILE_APPEND);
+    // open the file. Each recording file is only opened once so it can be opened for writing, which allows seeking
+    this->file = SD.open(this->filename, FILE_WRITE);
     // check to see if the file was opened successfully
     if(!this->file){
         Serial.print("Error opening file: ");
         Serial.println(this->filename);
-        this->fileOpen = false;
+        this->fileReady = false;
         return;
     }
-    // set the file number to the temporary file number
-    this->fileNumber = tempFileNumber;
+    // set the file number to the temporary file number, unless a newer file was asked for while this one was opening
+    portENTER_CRITICAL(&this->fileNumberLock);
+    if(this->fileNumber == requestedFileNumber){
+        this->fileNumber = tempFileNumber;
+    }
+    portEXIT_CRITICAL(&this->fileNumberLock);
     // set the file open flag to true
-    this->fileOpen = true;
+    this->fileReady = true;
+}
+
+bool SDCard::readFrame(File& log, uint32_t position, uint32_t size, uint8_t* buffer, uint32_t* sequence, uint16_t* length){
+    uint8_t header[7];
+    uint8_t crc[4];
+    log.seek(position);
+    if(log.read(header, sizeof(header)) != sizeof(header) || header[0] != BINARY_RECORD_FRAME){
+        return false;
+    }
+    *length = header[1] | (header[2] << 8);
+    *sequence = getUInt32(header + 3);
+    return *length > 0 && *length <= SD_FRAME_SIZE && position + SD_FRAME_OVERHEAD + *length <= size
+        && log.read(buffer, *length) == *length && log.read(crc, sizeof(crc)) == sizeof(crc)
+        && getUInt32(crc) == crc32(buffer, *length, crc32(header + 3, 4));
+}
+
+bool SDCard::scanJournal(File& log, uint32_t start, uint32_t size, uint32_t* end, uint32_t* skipped){
+    uint8_t buffer[SD_FRAME_SIZE];
+    *skipped = 0;
+    // the binary header
+    log.seek(start);
+    if(log.read(buffer, 10) != 10 || memcmp(buffer, BINARY_LOG_MAGIC, 4) != 0){
+        return false;
+    }
+    // without a journal there is no way to tell where good data ends, so keep all of it
+    if(!(buffer[7] & BINARY_FLAG_JOURNALED)){
+        *end = size;
+        return true;
+    }
+    uint8_t streamCount = buffer[6];
+    // the fields before each stream's name. Version 3 added the CFC
+    uint32_t fieldsLength = buffer[4] >= 3 ? 14 : 10;
+    uint32_t position = start + 10;
+    for(uint8_t i = 0; i < streamCount; i++){
+        log.seek(position + fieldsLength);
+        int nameLength = log.read();
+        if(nameLength < 0){
+            *end = start;
+            return true;
+        }
+        position += fieldsLength + 1 + nameLength;
+    }
+    *end = min(position, size);
+
+    // every good frame. A dropped frame keeps its sequence number, so the numbers only skip where frames were damaged
+    uint32_t sequence = 0;
+    uint32_t frameSequence;
+    uint16_t length;
+    while(position + SD_FRAME_OVERHEAD <= size){
+        if(readFrame(log, position, size, buffer, &frameSequence, &length) && frameSequence == sequence){
+            position += SD_FRAME_OVERHEAD + length;
+            *end = position;
+            sequence++;
+            continue;
+        }
+        // look for the next good frame past the damage. A frame takes at least SD_FRAME_OVERHEAD + 1 bytes,
+        // which limits how far its sequence number can have moved on. Anything past the search is the unwritten tail
+        uint32_t next = position + 1;
+        uint32_t limit = min(size, position + SD_RESYNC_BYTES);
+        bool found = false;
+        while(!found && next + SD_FRAME_OVERHEAD <= limit){
+            // find the next frame tag a chunk at a time instead of reading the file a byte at a time
+            log.seek(next);
+            size_t chunk = log.read(buffer, min((uint32_t)sizeof(buffer), limit - next));
+            uint8_t* tag = (uint8_t*)memchr(buffer, BINARY_RECORD_FRAME, chunk);
+            if(tag == nullptr){
+                if(chunk == 0){
+                    break;
+                }
+                next += chunk;
+                continue;
+            }
+            next += tag - buffer;
+            uint32_t maxSequence = sequence + (next - position) / (SD_FRAME_OVERHEAD + 1);
+            found = readFrame(log, next, size, buffer, &frameSequence, &length)
+                && frameSequence >= sequence && frameSequence <= maxSequence;
+            if(!found){
+                next++;
+            }
+        }
+        if(!found){
+            break;
+        }
+        *skipped += next - position;
+        position = next;
+        sequence = frameSequence;
+    }
+    return true;
+}
+
+bool SDCard::recover(){
+    if(!this->readerInitialized || this->dynamicFilename == nullptr || this->fileOpen || this->fileReady){
+        return false;
+    }
+    if(!this->fileIndexLoaded){
+        loadFileIndex();
+    }
+    if(this->nextFileNumber == 0){
+        return false;
+    }
+    // only the newest file can have been open when the power went out
+    char path[50];
+    snprintf(path, sizeof(path), "%s_%lu%s", this->dynamicFilename, (unsigned long)(this->nextFileNumber - 1), this->extension);
+    File log = SD.open(path, FILE_READ);
+    if(!log){
+        return false;
+    }
+    uint32_t size = log.size();
+
+    // in a container only the data after the last indexed event can be unfinished
+    uint32_t start = 0;
+    uint16_t events = 0;
+    bool container = false;
+    uint8_t header[SESSION_HEADER_SIZE];
+    size_t headerLength = log.read(header, sizeof(header));
+    // a log the writer closed has nothing to repair, so don't read through it
+    if(headerLength >= 8 && memcmp(header, BINARY_LOG_MAGIC, 4) == 0 && (header[7] & BINARY_FLAG_CLOSED)){
+        log.close();
+        return false;
+    }
+    if(headerLength == sizeof(header) && memcmp(header, SESSION_MAGIC, 4) == 0){
+        container = true;
+        events = header[8] | (header[9] << 8);
+        start = SESSION_DATA_OFFSET;
+        uint8_t entry[8];
+        if(events > 0 && log.seek(SESSION_HEADER_SIZE + (events - 1) * SESSION_ENTRY_SIZE) && log.read(entry, sizeof(entry)) == sizeof(entry)){
+            start = getUInt32(entry) + getUInt32(entry + 4);
+        }
+    }
+
+    uint32_t end = start;
+    uint32_t skipped = 0;
+    bool binaryLog = scanJournal(log, start, size, &end, &skipped);
+    log.close();
+    if(!container && !binaryLog){
+        return false;
+    }
+    if(end >= size){
+        return false;
+    }
+
+    // index the recovered event. Its summary was never known so it is marked with -1
+    if(container && end > start && events < SESSION_MAX_EVENTS){
+        File session = SD.open(path, "r+");
+        if(session){
+            uint8_t entry[SESSION_ENTRY_SIZE];
+            uint8_t* entryEnd = putUInt32(entry, start);
+            entryEnd = putUInt32(entryEnd, end - start);
+            entryEnd = putUInt32(entryEnd, 0);
+            entryEnd = putFloat(entryEnd, -1);
+            putFloat(entryEnd, -1);
+            session.seek(SESSION_HEADER_SIZE + events * SESSION_ENTRY_SIZE);
+            session.write(entry, sizeof(entry));
+            uint8_t count[2];
+            putUInt16(count, events + 1);
+            session.seek(8);
+            session.write(count, sizeof(count));
+            session.close();
+        }
+    }
+
+    // drop the damaged tail and any pre-allocated space after it
+    String fullPath = String(SD_MOUNT_POINT) + path;
+    if(truncate(fullPath.c_str(), end) != 0){
+        Serial.println("Error truncating file: " + String(path));
+        return false;
+    }
+    Serial.print("Recovered ");
+    Serial.print(path);
+    Serial.print(": kept ");
+    Serial.print(end);
+    Serial.print(" of ");
+    Serial.print(size);
+    Serial.print(" bytes, ");
+    Serial.print(skipped);
+    Serial.println(" of them damaged");
+    return true;
+}
+
+void SDCard::getIndexFilename(char* indexFilename, size_t length){
+    snprintf(indexFilename, length, "%s.idx", this->dynamicFilename);
+}
+
+void SDCard::loadFileIndex(){
+    if(!this->readerInitialized || this->dynamicFilename == nullptr){
+        return;
+    }
+    this->fileIndexLoaded = true;
+
+    char indexFilename[50];
+    getIndexFilename(indexFilename, sizeof(indexFilename));
+    File indexFile = SD.open(indexFilename, FILE_READ);
+    if(indexFile){
+        char number[12] = {0};
+        size_t length = indexFile.read((uint8_t*)number, sizeof(number) - 1);
+        indexFile.close();
+        char* end;
+        unsigned long value = strtoul(number, &end, 10);
+        if(length > 0 && end != number){
+            this->nextFileNumber = value;
+            return;
+        }
+    }
+
+    // there is no usable index, so scan the directory once and continue after the highest numbered file
+    const char* base = strrchr(this->dynamicFilename, '/');
+    base = (base == nullptr) ? this->dynamicFilename : base + 1;
+    char directory[50] = "/";
+    size_t directoryLength = base - this->dynamicFilename;
+    if(directoryLength > 1 && directoryLength < sizeof(directory)){
+        // drop the trailing slash
+        strncpy(directory, this->dynamicFilename, directoryLength - 1);
+        directory[directoryLength - 1] = '\0';
+    }
+    size_t baseLength = strlen(base);
+
+    uint32_t next = 0;
+    File dir = SD.open(directory);
+    if(dir && dir.isDirectory()){
+        File entry = dir.openNextFile();
+        while(entry){
+            // some versions of the SD library return the full path instead of the name
+            const char* name = strrchr(entry.name(), '/');
+            name = (name == nullptr) ? entry.name() : name + 1;
+            if(strncmp(name, base, baseLength) == 0 && name[baseLength] == '_'){
+                char* end;
+                unsigned long number = strtoul(name + baseLength + 1, &end, 10);
+                if(end != name + baseLength + 1 && strcmp(end, this->extension) == 0 && number + 1 > next){
+                    next = number + 1;
+                }
+            }
+            entry.close();
+            entry = dir.openNextFile();
+        }
+    }
+    dir.close();
+
+    this->nextFileNumber = next;
+    saveFileIndex();
+}
+
+void SDCard::saveFileIndex(){
+    char indexFilename[50];
+    getIndexFilename(indexFilename, sizeof(indexFilename));
+    File indexFile = SD.open(indexFilename, FILE_WRITE);
+    if(!indexFile){
+        Serial.println("Error saving file index: " + String(indexFilename));
+        return;
+    }
+    indexFile.print(this->nextFileNumber);
+    indexFile.close();
 }
 
 void SDCard::closeFile(){
-    this->file.close();
-    this->file = File();
+    if(this->fileOpen){
+        writeFooter();
+        commitFrame();
+        // the writer also uses this if the close is dropped and it finishes the event when the next one opens
+        this->finishedEvent = this->currentEvent;
+        submitBlock(BLOCK_CLOSE);
+    }
+    // retry anything that is still waiting on a free block from an earlier overrun
+    else if(this->pendingFlags != 0){
+        submitBlock(0);
+    }
     fileOpen = false;
+    // the next file needs its own header
+    fileInitialized = false;
+    // between recordings the streams are only a history, so an overwritten sample isn't lost
+    countDrops(false);
 }
 
-bool SDCard::write(const char* line){
+void SDCard::countDrops(bool enabled){
+    for(auto i = 0; i < registeredDoubleStreams; i++){
+        doubleStreams[i]->setCountDrops(enabled);
+    }
+    for(auto i = 0; i < registeredXYZStreams; i++){
+        XYZStreams[i]->setCountDrops(enabled);
+    }
+}
+
+void SDCard::flush(){
+    if(!this->fileOpen){
+        return;
+    }
+    commitFrame();
+    submitBlock(BLOCK_FLUSH);
+    this->lastCheckpoint = millis();
+}
+
+bool SDCard::writeRecord(const uint8_t* data, size_t length){
+    if(!this->fileJournaled){
+        return write(data, length);
+    }
+    // records never span frames, so recovery always cuts the log between records
+    if(this->frameLength + length > SD_FRAME_SIZE){
+        commitFrame();
+    }
+    if(length > SD_FRAME_SIZE){
+        return false;
+    }
+    memcpy(this->frame + this->frameLength, data, length);
+    this->frameLength += length;
+    return true;
+}
+
+void SDCard::commitFrame(){
+    if(!this->fileJournaled || this->frameLength == 0){
+        return;
+    }
+    // tag u8, payload length u16, sequence u32, payload, CRC-32 of the sequence and payload u32
+    // the frame goes out in one write so an overrun drops all of it or none of it
+    uint8_t buffer[7 + SD_FRAME_SIZE + 4];
+    buffer[0] = BINARY_RECORD_FRAME;
+    putUInt16(buffer + 1, this->frameLength);
+    putUInt32(buffer + 3, this->frameSequence);
+    memcpy(buffer + 7, this->frame, this->frameLength);
+    putUInt32(buffer + 7 + this->frameLength, crc32(this->frame, this->frameLength, crc32(buffer + 3, 4)));
+    // a dropped frame keeps its sequence number so the journal has no gap
+    if(write(buffer, 7 + this->frameLength + 4)){
+        this->frameSequence++;
+        countRows(this->frameRows);
+    }
+    else{
+        // the rows in the frame are gone, so the next row can't be a delta from them
+        this->rowsSinceKeyframe = 0;
+    }
+    this->frameLength = 0;
+    this->frameRows = 0;
+}
+
+void SDCard::startFile(){
+    // the writer closes the previous file when it opens the next one, so a close that is still waiting for a block is dropped
+    this->pendingFlags = (this->pendingFlags & ~(BLOCK_CLOSE | BLOCK_FLUSH)) | BLOCK_OPEN;
+    this->fileOpen = true;
+    this->lastCheckpoint = millis();
+    this->currentEvent.timestamp = millis();
+    this->currentEvent.peakG = 0;
+    this->currentEvent.risk = 0;
+}
+
+void SDCard::endEvent(float peakG, float risk){
+    this->currentEvent.peakG = peakG;
+    this->currentEvent.risk = risk;
+    closeFile();
+}
+
+size_t SDCard::freeRoom(){
+    size_t room = uxQueueMessagesWaiting(this->freeBlocks) * SD_BUFFER_SIZE;
+    if(this->currentBlock != nullptr){
+        room += SD_BUFFER_SIZE - this->currentBlock->length;
+    }
+    return room;
+}
+
+bool SDCard::acquireBlock(){
+    if(this->currentBlock != nullptr){
+        return true;
+    }
+    uint8_t index;
+    // never wait here. If the writer has fallen behind the data is dropped instead of stalling acquisition
+    if(xQueueReceive(this->freeBlocks, &index, 0) != pdTRUE){
+        return false;
+    }
+    this->currentBlock = &this->blocks[index];
+    this->currentBlock->length = 0;
+    this->currentBlock->flags = this->pendingFlags;
+    this->pendingFlags = 0;
+
+    UBaseType_t occupancy = SD_BLOCK_COUNT - uxQueueMessagesWaiting(this->freeBlocks);
+    if(occupancy > this->blockHighWaterMark){
+        this->blockHighWaterMark = occupancy;
+    }
+    return true;
+}
+
+void SDCard::submitBlock(uint8_t flags){
+    this->pendingFlags |= flags;
+    // if no block is free the flags stay pending and go out with the next block
+    if(!acquireBlock()){
+        return;
+    }
+    this->currentBlock->flags |= this->pendingFlags;
+    this->pendingFlags = 0;
+    this->currentBlock->event = this->finishedEvent;
+    uint8_t index = this->currentBlock - this->blocks;
+    // the queue can hold every block so this never fails
+    xQueueSend(this->fullBlocks, &index, 0);
+    this->currentBlock = nullptr;
+
+    // without a writer task the block is written right away
+    if(!this->backgroundWriter){
+        writeBlocks(0);
+    }
+}
+
+void SDCard::writeBlocks(TickType_t wait){
+    uint8_t index;
+    // only peek while waiting, so autotune can take the lock and finish the queued blocks itself in order
+    while(xQueuePeek(this->fullBlocks, &index, wait) == pdTRUE){
+        xSemaphoreTake(this->writerLock, portMAX_DELAY);
+        if(xQueueReceive(this->fullBlocks, &index, 0) == pdTRUE){
+            writeBlock(index);
+        }
+        xSemaphoreGive(this->writerLock);
+        // only wait for the first block. Drain the rest of the queue and return
+        wait = 0;
+    }
+}
+
+void SDCard::writeBlock(uint8_t index){
+    SDBlock* block = &this->blocks[index];
+    unsigned long start = micros();
+    if(block->flags & BLOCK_OPEN && this->sessionContainer){
+        startContainerEvent(block->event);
+    }
+    else if(block->flags & BLOCK_OPEN){
+        if(this->fileReady){
+            this->file.close();
+            truncateFile();
+            this->fileReady = false;
+        }
+        openFile(true, FILE_WRITE);
+        if(this->fileReady){
+            preallocateFile();
+        }
+    }
+    if(block->flags & BLOCK_OPEN){
+        this->latency[SD_OPEN].record(micros() - start);
+        // remember where the binary header is so the log can be marked closed when it ends
+        this->logHeaderKnown = this->fileReady && block->length >= 8 && memcmp(block->data, BINARY_LOG_MAGIC, 4) == 0;
+        this->logStart = this->fileLength;
+        this->logFlags = block->data[7];
+    }
+    // if the file could not be opened the data is dropped until the next file is started
+    if(this->fileReady && block->length > 0){
+        start = micros();
+        this->file.write(block->data, block->length);
+        this->latency[SD_WRITE].record(micros() - start);
+        this->fileLength += block->length;
+    }
+    if(this->fileReady && (block->flags & BLOCK_FLUSH)){
+        start = micros();
+        this->file.flush();
+        this->latency[SD_FLUSH].record(micros() - start);
+    }
+    start = micros();
+    if(block->flags & BLOCK_CLOSE && this->sessionContainer){
+        // the container stays open for the next event
+        endContainerEvent(block->event);
+    }
+    else if(block->flags & BLOCK_CLOSE){
+        markLogClosed();
+        this->file.close();
+        this->file = File();
+        if(this->fileReady){
+            truncateFile();
+        }
+        this->fileReady = false;
+    }
+    if(block->flags & BLOCK_CLOSE){
+        this->latency[SD_CLOSE].record(micros() - start);
+    }
+    xQueueSend(this->freeBlocks, &index, 0);
+}
+
+void SDCard::startContainerEvent(const SDEvent& previous){
+    if(this->eventOpen){
+        endContainerEvent(previous);
+    }
+    // a full container is finished and the event goes in a new one
+    if(this->fileReady && this->eventCount >= SESSION_MAX_EVENTS){
+        this->file.close();
+        truncateFile();
+        this->fileReady = false;
+    }
+    if(!this->fileReady){
+        openFile(true, FILE_WRITE);
+        if(!this->fileReady){
+            return;
+        }
+        preallocateFile();
+
+        // write the header and an empty index table, one sector at a time
+        uint8_t sector[SD_SECTOR_SIZE] = {0};
+        uint8_t* end = sector;
+        memcpy(end, SESSION_MAGIC, 4);
+        end += 4;
+        *end++ = SESSION_VERSION;
+        *end++ = 0;
+        end = putUInt16(end, SESSION_MAX_EVENTS);
+        end = putUInt16(end, 0);
+        end = putUInt16(end, 0);
+        putUInt32(end, SESSION_DATA_OFFSET);
+        for(uint32_t i = 0; i < SESSION_DATA_OFFSET; i += SD_SECTOR_SIZE){
+            this->file.write(sector, SD_SECTOR_SIZE);
+            if(i == 0){
+                memset(sector, 0, SESSION_HEADER_SIZE);
+            }
+        }
+        this->file.flush();
+        this->fileLength = SESSION_DATA_OFFSET;
+        this->eventCount = 0;
+    }
+    // the reservation is sized for one recording, so make room for this one before its rows arrive
+    extendPreallocation();
+    this->eventOffset = this->fileLength;
+    this->eventOpen = true;
+}
+
+void SDCard::endContainerEvent(const SDEvent& event){
+    if(!this->eventOpen || !this->fileReady){
+        this->eventOpen = false;
+        return;
+    }
+    markLogClosed();
+    uint8_t entry[SESSION_ENTRY_SIZE];
+    uint8_t* end = entry;
+    end = putUInt32(end, this->eventOffset);
+    end = putUInt32(end, this->fileLength - this->eventOffset);
+    end = putUInt32(end, event.timestamp);
+    end = putFloat(end, event.peakG);
+    putFloat(end, event.risk);
+    this->file.seek(SESSION_HEADER_SIZE + this->eventCount * SESSION_ENTRY_SIZE);
+    this->file.write(entry, SESSION_ENTRY_SIZE);
+
+    // the count is written last so a reader never sees an entry that isn't finished
+    this->eventCount++;
+    uint8_t count[2];
+    putUInt16(count, this->eventCount);
+    this->file.seek(8);
+    this->file.write(count, sizeof(count));
+
+    // go back to the end for the next event and make sure the index is on the card
+    this->file.seek(this->fileLength);
+    this->file.flush();
+    this->eventOpen = false;
+}
+
+void SDCard::markLogClosed(){
+    if(!this->logHeaderKnown || !this->fileReady){
+        return;
+    }
+    this->file.seek(this->logStart + 7);
+    this->file.write((uint8_t)(this->logFlags | BINARY_FLAG_CLOSED));
+    this->file.seek(this->fileLength);
+    this->logHeaderKnown = false;
+}
+
+void SDCard::preallocateFile(){
+    this->fileLength = 0;
+    this->reservedLength = 0;
+    this->preallocated = false;
+    extendPreallocation();
+}
+
+void SDCard::extendPreallocation(){
+    uint32_t end = this->fileLength + this->preallocateSize;
+    if(this->preallocateSize == 0 || end <= this->reservedLength){
+        return;
+    }
+    // seeking past the end of a file that is open for writing makes FatFs allocate the whole cluster chain now.
+    // FatFs hands out free clusters in order, so on a card that isn't fragmented the chain is contiguous.
+    // After this every write lands in clusters that already exist and never has to touch the FAT.
+    if(!this->file.seek(end - 1) || this->file.write((uint8_t)0) != 1){
+        Serial.println("Error pre-allocating file: " + String(this->filename));
+    }
+    else{
+        this->reservedLength = end;
+    }
+    this->file.flush();
+    this->file.seek(this->fileLength);
+    this->preallocated = true;
+}
+
+void SDCard::truncateFile(){
+    if(!this->preallocated){
+        return;
+    }
+    // the Arduino File class can't shrink a file, so go through the VFS mount
+    String path = String(SD_MOUNT_POINT) + this->filename;
+    if(truncate(path.c_str(), this->fileLength) != 0){
+        Serial.println("Error truncating file: " + String(this->filename));
+    }
+    this->preallocated = false;
+}
+
+void SDCard::printWriterStats(Print* out){
+    out->print("!SDWriter,");
+    out->print(this->blockHighWaterMark);
+    out->print(",");
+    out->print(SD_BLOCK_COUNT);
+    out->print(",");
+    out->print(this->overruns);
+    out->print(",");
+    out->print(this->droppedBytes);
+    out->print(",");
+    out->print(this->latency[SD_WRITE].getMax());
+    out->println(";");
+}
+
+void SDCard::printStats(Print* out){
+    out->print("!SDRows,");
+    out->print(this->rowsWritten);
+    out->print(",");
+    out->print(this->overruns);
+    out->print(",");
+    out->print(this->droppedBytes);
+    out->println(";");
+    for(int i = 0; i < registeredDoubleStreams + registeredXYZStreams; i++){
+        bool isDouble = i < registeredDoubleStreams;
+        int index = isDouble ? i : i - registeredDoubleStreams;
+        out->print("!SDStream,");
+        out->print(isDouble ? doubleStreams[index]->getHeader() : XYZStreams[index]->getHeader());
+        out->print(",");
+        out->print(isDouble ? doubleWritten[index] : XYZWritten[index]);
+        out->print(",");
+        out->print(isDouble ? doubleStreams[index]->getDroppedCount() : XYZStreams[index]->getDroppedCount());
+        out->println(";");
+    }
+    for(int i = 0; i < SD_OPERATION_COUNT; i++){
+        this->latency[i].print(out, sdOperationNames[i]);
+    }
+}
+
+void SDCard::countRows(uint32_t rows){
+    this->rowsWritten += rows;
+    this->fileRows += rows;
+    // every row holds a sample from each stream
+    for(auto i = 0; i < registeredDoubleStreams; i++){
+        doubleWritten[i] += rows;
+    }
+    for(auto i = 0; i < registeredXYZStreams; i++){
+        XYZWritten[i] += rows;
+    }
+}
+
+void SDCard::writeFooter(){
+    if(format == LOG_BINARY){
+        writeBinaryFooter();
+        return;
+    }
+    // comment lines so CSV readers can skip them
+    write("#SDRows,");
+    write((int)this->rowsWritten);
+    write(",");
+    write((int)this->overruns);
+    write(",");
+    writeln((int)this->droppedBytes);
+    for(int i = 0; i < registeredDoubleStreams + registeredXYZStreams; i++){
+        bool isDouble = i < registeredDoubleStreams;
+        int index = isDouble ? i : i - registeredDoubleStreams;
+        write("#SDStream,");
+        write(isDouble ? doubleStreams[index]->getHeader() : XYZStreams[index]->getHeader());
+        write(",");
+        writeln((int)(isDouble ? doubleStreams[index]->getDroppedCount() : XYZStreams[index]->getDroppedCount()));
+    }
+    for(int i = 0; i < SD_OPERATION_COUNT; i++){
+        write("#Latency,");
+        write(sdOperationNames[i]);
+        write(",");
+        write((int)this->latency[i].getCount());
+        write(",");
+        write((int)this->latency[i].getMax());
+        write(",");
+        write((int)this->latency[i].getMean());
+        for(uint8_t j = 0; j < LATENCY_BUCKETS; j++){
+            write(",");
+            write((int)this->latency[i].getBucket(j));
+        }
+        writeln("");
+    }
+}
+
+void SDCard::writeBinaryFooter(){
+    /** Binary footer layout. All values are little endian:
+     * tag u8, payload length u16, rows written u32, overruns u32, dropped bytes u32,
+     * stream count u8, dropped samples u32 per stream in header order,
+     * operation count u8, then per operation in SDOperation order:
+     * count u32, max us u32, mean us u32, bucket count u8, u32 per bucket
+     */
+    uint8_t streamCount = registeredDoubleStreams + registeredXYZStreams;
+    uint16_t payloadLength = 12 + 1 + 4 * streamCount + 1 + SD_OPERATION_COUNT * (13 + 4 * LATENCY_BUCKETS);
+    uint8_t buffer[16 + 4 * LATENCY_BUCKETS];
+    uint8_t* end = buffer;
+    // the footer fits in one frame by itself
+    commitFrame();
+    // without a journal it goes out in pieces, so it is only started if all of them fit
+    if(!this->fileJournaled && freeRoom() < 3 + (size_t)payloadLength){
+        this->overruns++;
+        this->droppedBytes += 3 + payloadLength;
+        return;
+    }
+    *end++ = BINARY_RECORD_FOOTER;
+    end = putUInt16(end, payloadLength);
+    end = putUInt32(end, this->rowsWritten);
+    end = putUInt32(end, this->overruns);
+    end = putUInt32(end, this->droppedBytes);
+    *end++ = streamCount;
+    writeRecord(buffer, end - buffer);
+
+    for(int i = 0; i < streamCount; i++){
+        bool isDouble = i < registeredDoubleStreams;
+        int index = isDouble ? i : i - registeredDoubleStreams;
+        putUInt32(buffer, isDouble ? doubleStreams[index]->getDroppedCount() : XYZStreams[index]->getDroppedCount());
+        writeRecord(buffer, 4);
+    }
+
+    buffer[0] = SD_OPERATION_COUNT;
+    writeRecord(buffer, 1);
+    for(int i = 0; i < SD_OPERATION_COUNT; i++){
+        end = buffer;
+        end = putUInt32(end, this->latency[i].getCount());
+        end = putUInt32(end, this->latency[i].getMax());
+        end = putUInt32(end, this->latency[i].getMean());
+        *end++ = LATENCY_BUCKETS;
+        for(uint8_t j = 0; j < LATENCY_BUCKETS; j++){
+            end = putUInt32(end, this->latency[i].getBucket(j));
+        }
+        writeRecord(buffer, end - buffer);
+    }
+}
+
+bool SDCard::write(const uint8_t* data, size_t length){
     if(!this->readerInitialized){
         Serial.println("Error writing to file: SD Card reader is not initialized.");
         this->fileInitialized = false;
@@ -115,15 +904,34 @@ bool SDCard::write(const char* line){
         this->fileInitialized = false;
         return false;
     }
-    if(this->fileOpen && !this->file){
-        Serial.println("Error writing to file: File is not available for write.");
+    
+    // make sure the whole record fits before copying any of it, so an overrun drops whole records and never leaves
+    // half of one in the file. Only the writer frees blocks, so the room can only grow while this copies
+    if(length > freeRoom()){
+        this->overruns++;
+        this->droppedBytes += length;
         return false;
     }
-    
-    file.print(line);
+
+    // copy the data into a RAM block. Full blocks are whole sectors and are handed to the writer
+    while(length > 0){
+        acquireBlock();
+        size_t chunk = min(length, SD_BUFFER_SIZE - this->currentBlock->length);
+        memcpy(this->currentBlock->data + this->currentBlock->length, data, chunk);
+        this->currentBlock->length += chunk;
+        data += chunk;
+        length -= chunk;
+        if(this->currentBlock->length == SD_BUFFER_SIZE){
+            submitBlock(0);
+        }
+    }
     return true;
 }
 
+bool SDCard::write(const char* line){
+    return write((const uint8_t*)line, strlen(line));
+}
+
 bool SDCard::write(String line){
     // convert the string to a char array
     char lineArray[line.length() + 1];
@@ -141,17 +949,13 @@ bool SDCard::write(int line){
 }
 
 bool SDCard::write(float line){
-    // convert the float to a char array
-    char lineArray[10];
-    snprintf(lineArray, 10, "%f", line);
-    // write the line
-    return write(lineArray);
+    return write((double)line);
 }
 
 bool SDCard::write(double line){
-    // convert the float to a char array
-    char lineArray[10];
-    snprintf(lineArray, 10, "%f", line);
+    // convert the double to a char array
+    char lineArray[32];
+    formatDouble(lineArray, sizeof(lineArray), line);
     // write the line
     return write(lineArray);
 }
@@ -182,28 +986,46 @@ bool SDCard::writeln(int line){
 }
 
 bool SDCard::writeln(float line){
-    // convert the float to a char array
-    char lineArray[10];
-    snprintf(lineArray, 10, "%f", line);
-    // write the line
-    return writeln(lineArray);
+    return writeln((double)line);
 }
 
 bool SDCard::writeln(double line){
-    // convert the float to a char array
-    char lineArray[10];
-    snprintf(lineArray, 10, "%f", line);
+    // convert the double to a char array
+    char lineArray[32];
+    formatDouble(lineArray, sizeof(lineArray), line);
     // write the line
     return writeln(lineArray);
 }
 
-void SDCard::registerDoubleDatastream(DataStream<double>* stream){
+void SDCard::formatDouble(char* buffer, size_t length, double value){
+    // %f can need hundreds of characters for a large value, so fall back to scientific notation if it won't fit
+    int written = snprintf(buffer, length, "%f", value);
+    if(written < 0 || (size_t)written >= length){
+        snprintf(buffer, length, "%e", value);
+    }
+}
+
+void SDCard::registerDoubleDatastream(DataStream<double>* stream, float scale, float sampleRate, float cfc){
+    if(registeredDoubleStreams >= MAX_SD_STREAMS){
+        Serial.println("Error registering data stream: Too many double streams.");
+        return;
+    }
     doubleStreams[registeredDoubleStreams] = stream;
+    doubleScales[registeredDoubleStreams] = scale;
+    doubleRates[registeredDoubleStreams] = sampleRate;
+    doubleCFCs[registeredDoubleStreams] = cfc;
     registeredDoubleStreams++;
 }
 
-void SDCard::registerXYZDatastream(DataStream<xyzData>* stream){
+void SDCard::registerXYZDatastream(DataStream<xyzData>* stream, float scale, float sampleRate, float cfc){
+    if(registeredXYZStreams >= MAX_SD_STREAMS){
+        Serial.println("Error registering data stream: Too many XYZ streams.");
+        return;
+    }
     XYZStreams[registeredXYZStreams] = stream;
+    XYZScales[registeredXYZStreams] = scale;
+    XYZRates[registeredXYZStreams] = sampleRate;
+    XYZCFCs[registeredXYZStreams] = cfc;
     registeredXYZStreams++;
 }
 
@@ -213,55 +1035,84 @@ void SDCard::update(bool writeDestructive){
      * Data_1, Data_2, Data_3, ..., Data_n
      * Data_1, Data_2, Data_3, ..., Data_n
      */    
+    unsigned long start = micros();
 
-    // if the file is not open, print an error message and try to open it.
-    if(!fileOpen){
-        Serial.println("Error updating file: File is not open.");
-        Serial.println("Attempting to reopen SD card for next write...");
-        this->fileInitialized = false;
+    // a new file was requested with setFileNumber(), so finish the current one
+    if(fileOpen && !fileInitialized){
         closeFile();
-        this->file = File();
-        openFile(true, FILE_WRITE);
-        return;
     }
-    // if the file has been initialized, close it and reopen it for appending
-    if(fileInitialized){
-        closeFile();
-        openFile(false, FILE_APPEND);
-    }
-    // otherwise, write the header
-    else{
-        closeFile();
-        openFile(true, FILE_WRITE);
+    // the file stays open for the whole recording. Only open it and write the header at the start
+    if(!fileOpen){
+        // the header has to be the first thing in the file. It is a few bytes and a name for each stream, well under a
+        // block, so until the writer frees one the recording waits in the streams and the open is tried on the next pass
+        if(freeRoom() < SD_BUFFER_SIZE){
+            this->latency[SD_UPDATE].record(micros() - start);
+            return;
+        }
+        startFile();
         writeHeader();
         fileInitialized = true;
+        // drop the history older than the pre-trigger time so every recording starts the same distance before the trigger
+        for(auto i = 0; i < registeredDoubleStreams; i++){
+            doubleStreams[i]->truncate(this->preTriggerRows);
+        }
+        for(auto i = 0; i < registeredXYZStreams; i++){
+            XYZStreams[i]->truncate(this->preTriggerRows);
+        }
     }
+    // from here on a sample pushed out of a full stream never reaches the log
+    countDrops(true);
 
     // write the data
     // figure out which data stream has the least of ammount of data
+    // the newest row holds every stream's newest sample, so it was complete when the last of those was taken
     uint16_t minSize = 1001;
+    int64_t sampleTime = 0;
     for(auto i = 0; i < registeredDoubleStreams; i++){
         if(doubleStreams[i]->size() < minSize){
             minSize = doubleStreams[i]->size();
         }
+        sampleTime = max(sampleTime, doubleStreams[i]->getNewestTime());
     }
     for(auto i = 0; i < registeredXYZStreams; i++){
         if(XYZStreams[i]->size() < minSize){
             minSize = XYZStreams[i]->size();
         }
+        sampleTime = max(sampleTime, XYZStreams[i]->getNewestTime());
     }
 
     // write the data
-    if(writeDestructive){
+    if(format == LOG_BINARY){
+        // rows still in the journal frame go in ahead of a time record written now
+        uint32_t rowsBefore = this->fileRows + this->frameRows;
+        writeBinaryData(minSize, writeDestructive);
+        uint32_t rowsAfter = this->fileRows + this->frameRows;
+        bool resynced = this->clock != nullptr && this->clock->getGeneration() != this->timeGeneration;
+        if(rowsAfter > rowsBefore && (rowsBefore == 0 || resynced || millis() - this->lastTimeRecord >= SD_TIME_RECORD_MS)){
+            writeTimeRecord(sampleTime);
+        }
+    }
+    else if(writeDestructive){
         writeDataDestructive(minSize);
     }
     else{
         writeData(minSize);
     }
-    file.close();
+
+    // a checkpoint makes everything written so far survive a power loss
+    if(this->fileJournaled && this->checkpointInterval > 0 && millis() - this->lastCheckpoint >= this->checkpointInterval){
+        flush();
+    }
+    this->latency[SD_UPDATE].record(micros() - start);
 }
 
 void SDCard::writeHeader(){
+    this->fileJournaled = false;
+    if(format == LOG_BINARY){
+        writeBinaryHeader();
+        return;
+    }
+
     // write the double headers
     
     for(int i = 0; i < registeredDoubleStreams; i++){
@@ -293,88 +1144,444 @@ void SDCard::writeHeader(){
     this->writeln("");
 }
 
+void SDCard::writeBinaryHeader(){
+    /** Binary header layout. All values are little endian:
+     * magic[4], version u8, encoding u8, stream count u8, flags u8, row length u16
+     * then for each stream:
+     * value count u8 (1 or 3), value type u8 ('i' for int32), scale f32, sample rate f32, CFC f32, name length u8, name
+     * The CFC is the class the stream was filtered with on the device, 0 if it wasn't. Version 2 logs don't have it.
+     * Streams are listed in the same order their values appear in each row.
+     * The encoding is a LogEncoding and the row length is the size of an ENCODING_FIXED record.
+     * If flags has BINARY_FLAG_JOURNALED set, every record after the header is inside a BINARY_RECORD_FRAME.
+     * The writer sets BINARY_FLAG_CLOSED once the log is finished, so a log without it was cut off.
+     */
+    uint8_t buffer[16];
+    uint8_t* end = buffer;
+    memcpy(end, BINARY_LOG_MAGIC, 4);
+    end += 4;
+    *end++ = BINARY_LOG_VERSION;
+    // the encoding can't change part way through a file
+    this->fileEncoding = this->encoding;
+    this->rowsSinceKeyframe = 0;
+    *end++ = this->fileEncoding;
+    *end++ = registeredDoubleStreams + registeredXYZStreams;
+    *end++ = this->journaled ? BINARY_FLAG_JOURNALED : 0;
+    end = putUInt16(end, 1 + 4 * (registeredDoubleStreams + 3 * registeredXYZStreams));
+    write(buffer, end - buffer);
+
+    for(int i = 0; i < registeredDoubleStreams + registeredXYZStreams; i++){
+        bool isDouble = i < registeredDoubleStreams;
+        int index = isDouble ? i : i - registeredDoubleStreams;
+        char* name = isDouble ? doubleStreams[index]->getHeader() : XYZStreams[index]->getHeader();
+        uint8_t nameLength = name == nullptr ? 0 : min(strlen(name), (size_t)255);
+
+        end = buffer;
+        *end++ = isDouble ? 1 : 3;
+        *end++ = 'i';
+        end = putFloat(end, isDouble ? doubleScales[index] : XYZScales[index]);
+        end = putFloat(end, isDouble ? doubleRates[index] : XYZRates[index]);
+        end = putFloat(end, isDouble ? doubleCFCs[index] : XYZCFCs[index]);
+        *end++ = nameLength;
+        write(buffer, end - buffer);
+        write((const uint8_t*)name, nameLength);
+    }
+
+    this->fileJournaled = this->journaled;
+    this->frameLength = 0;
+    this->frameRows = 0;
+    this->frameSequence = 0;
+    this->fileRows = 0;
+}
+
+void SDCard::writeTimeRecord(int64_t local){
+    /** Time record layout. All values are little endian:
+     * tag u8, rows u32, device time i64, host time i64, error bound u32
+     * rows is how many rows come before the record in the log. The newest of those rows was complete at the device
+     * time, when the last of its samples was taken, in us since power up. The host time is the same moment in us
+     * since the Unix epoch and the error bound is how far off it can be in us. Until the clock is synced the host time
+     * is 0 and the bound is 0xFFFFFFFF. Rows between two records are spaced evenly between their device times
+     */
+    uint8_t buffer[25];
+    uint8_t* end = buffer;
+    *end++ = BINARY_RECORD_TIME;
+    end = putUInt32(end, this->fileRows + this->frameRows);
+    end = putInt64(end, local);
+    end = putInt64(end, this->clock == nullptr ? 0 : this->clock->toHostTime(local));
+    end = putUInt32(end, this->clock == nullptr ? UINT32_MAX : this->clock->getErrorBound(local));
+    writeRecord(buffer, end - buffer);
+    this->timeGeneration = this->clock == nullptr ? 0 : this->clock->getGeneration();
+    this->lastTimeRecord = millis();
+}
+
+void SDCard::writeBinaryData(uint16_t numLines, bool destructive){
+    int32_t values[MAX_BINARY_ROW_VALUES];
+    uint8_t row[MAX_BINARY_ROW_LENGTH];
+    for(uint16_t i = 0; i < numLines; i++){
+        uint8_t count = 0;
+        for(auto j = 0; j < registeredDoubleStreams; j++){
+            double value = destructive ? doubleStreams[j]->pop() : doubleStreams[j]->peek(i);
+            values[count++] = quantize(value, doubleScales[j]);
+        }
+        // the magnitude is not stored. It can be recomputed from the axes
+        for(auto j = 0; j < registeredXYZStreams; j++){
+            xyzData data = destructive ? XYZStreams[j]->pop() : XYZStreams[j]->peek(i);
+            values[count++] = quantize(data.x, XYZScales[j]);
+            values[count++] = quantize(data.y, XYZScales[j]);
+            values[count++] = quantize(data.z, XYZScales[j]);
+        }
+        // finish the frame first if the row might not fit, so a dropped frame is known about before the row is encoded
+        if(this->fileJournaled && this->frameLength + 1 + 5 * count > SD_FRAME_SIZE){
+            commitFrame();
+        }
+        // build the whole row in memory so it goes to the card in a single write
+        uint8_t* end = encodeRow(values, count, row);
+        // a row that didn't make it to the card can't be the base of the next delta, so start over from a keyframe
+        if(!writeRecord(row, end - row)){
+            this->rowsSinceKeyframe = 0;
+        }
+        // a journaled row is only written once its frame is
+        else if(this->fileJournaled){
+            this->frameRows++;
+        }
+        else{
+            countRows(1);
+        }
+    }
+}
+
+uint8_t* SDCard::encodeRow(const int32_t* values, uint8_t count, uint8_t* buffer){
+    if(this->fileEncoding == ENCODING_FIXED){
+        *buffer++ = BINARY_RECORD_ROW;
+        for(uint8_t i = 0; i < count; i++){
+            buffer = putUInt32(buffer, values[i]);
+        }
+        return buffer;
+    }
+
+    // sensor values change little from one sample to the next, so the differences fit in one or two bytes.
+    // The subtraction wraps the same way in the decoder, so even a jump between the clamp limits round trips
+    bool keyframe = this->rowsSinceKeyframe == 0;
+    *buffer++ = keyframe ? BINARY_RECORD_KEYFRAME : BINARY_RECORD_DELTA;
+    for(uint8_t i = 0; i < count; i++){
+        uint32_t value = keyframe ? (uint32_t)values[i] : (uint32_t)values[i] - (uint32_t)this->previousRow[i];
+        buffer = putVarint(buffer, zigzag((int32_t)value));
+        this->previousRow[i] = values[i];
+    }
+    this->rowsSinceKeyframe = (this->rowsSinceKeyframe + 1) % DELTA_KEYFRAME_INTERVAL;
+    return buffer;
+}
+
 void SDCard::writeData(uint16_t numLines){
+    char row[MAX_CSV_ROW_LENGTH];
     // for each row in numLines
     for(uint16_t i = 0; i < numLines; i++){
-        // write that row of data
+        // build the whole row first so it is written all at once, or dropped all at once if the writer is behind
+        size_t length = 0;
         // write the double data
         for(auto j = 0; j < registeredDoubleStreams; j++){
-            this->write(doubleStreams[j]->peek(i));
-            if(j < registeredDoubleStreams - 1){
-                this->write(",");
-            }
-        }
-
-        // if there is both double and XYZ data, write a comma
-        if(registeredDoubleStreams > 0 && registeredXYZStreams > 0){
-            this->write(",");
+            appendValue(row, &length, doubleStreams[j]->peek(i));
         }
         // write the XYZ data
         for(auto j = 0; j < registeredXYZStreams; j++){
             xyzData data = XYZStreams[j]->peek(i);
-            this->write(data.x);
-            this->write(",");
-            this->write(data.y);
-            this->write(",");
-            this->write(data.z);
-            this->write(",");
-            this->write(data.magnitude());
-            if(j < registeredXYZStreams - 1){
-                this->write(",");
-            }
-            
+            appendValue(row, &length, data.x);
+            appendValue(row, &length, data.y);
+            appendValue(row, &length, data.z);
+            appendValue(row, &length, data.magnitude());
+        }
+        endRow(row, &length);
+        if(this->write((const uint8_t*)row, length)){
+            countRows(1);
         }
-        this->writeln("");
     }
 }
 
 void SDCard::writeDataDestructive(uint16_t numLines){
-    
+    char row[MAX_CSV_ROW_LENGTH];
     // for each row in numLines
     for(auto i = 0; i < numLines; i++){
-        // write that row of data
+        size_t length = 0;
         // write the double data
         for(auto j = 0; j < registeredDoubleStreams; j++){
-            this->write(doubleStreams[j]->pop());
-            if(j < registeredDoubleStreams - 1){
-            this->write(",");
-            }
-            
-        }
-
-        if(registeredDoubleStreams > 0 && registeredXYZStreams > 0){
-            this->write(",");
+            appendValue(row, &length, doubleStreams[j]->pop());
         }
-
         // write the XYZ data
         for(auto j = 0; j < registeredXYZStreams; j++){
             xyzData data = XYZStreams[j]->pop();
-            this->write(data.x);
-            this->write(",");
-            this->write(data.y);
-            this->write(",");
-            this->write(data.z);
-            this->write(",");
-            this->write(data.magnitude());
-            if(j < registeredXYZStreams - 1){
-                this->write(",");
-            }
-            
+            appendValue(row, &length, data.x);
+            appendValue(row, &length, data.y);
+            appendValue(row, &length, data.z);
+            appendValue(row, &length, data.magnitude());
+        }
+        endRow(row, &length);
+        if(this->write((const uint8_t*)row, length)){
+            countRows(1);
         }
-        this->writeln("");
     }
 }
 
+void SDCard::appendValue(char* row, size_t* length, double value){
+    formatDouble(row + *length, CSV_VALUE_LENGTH, value);
+    *length += strlen(row + *length);
+    row[(*length)++] = ',';
+}
+
+void SDCard::endRow(char* row, size_t* length){
+    // the last value has a comma after it that becomes the line ending
+    if(*length > 0){
+        (*length)--;
+    }
+    row[(*length)++] = '\r';
+    row[(*length)++] = '\n';
+}
+
 void SDCard::setDynamicFilename(char * dynamicFileName, char * extension){
     this->dynamicFilename = dynamicFileName;
     this->extension = extension;
+    // find the next file number now instead of when the first recording starts
+    this->fileIndexLoaded = false;
+    loadFileIndex();
 }
 
 uint32_t SDCard::getFileNumber(){
-    return fileNumber;
+    portENTER_CRITICAL(&this->fileNumberLock);
+    uint32_t number = this->fileNumber;
+    portEXIT_CRITICAL(&this->fileNumberLock);
+    return number;
 }
 
 void SDCard::setFileNumber(uint32_t fileNumber){
-    if(fileNumber != this->fileNumber) this->fileInitialized = false;
+    // the writer updates the number when it opens a file
+    portENTER_CRITICAL(&this->fileNumberLock);
+    bool changed = fileNumber != this->fileNumber;
     this->fileNumber = fileNumber;
+    portEXIT_CRITICAL(&this->fileNumberLock);
+    if(changed) this->fileInitialized = false;
+}
+
+bool SDCard::isFileInUse(const char* name){
+    // compare the names without their directories
+    const char* base = strrchr(name, '/');
+    base = (base == nullptr) ? name : base + 1;
+    portENTER_CRITICAL(&this->fileNumberLock);
+    const char* open = strrchr(this->filename, '/');
+    open = (open == nullptr) ? this->filename : open + 1;
+    bool inUse = this->fileReady && strcmp(base, open) == 0;
+    portEXIT_CRITICAL(&this->fileNumberLock);
+    return inUse;
+}
+
+void SDCard::nextFile(){
+    portENTER_CRITICAL(&this->fileNumberLock);
+    this->fileNumber++;
+    portEXIT_CRITICAL(&this->fileNumberLock);
+    this->fileInitialized = false;
+}
+
+// the test pattern byte for a position in the autotune file. It depends on the position so misplaced sectors are caught
+static uint8_t autotunePattern(uint32_t position){
+    return (uint8_t)((position * 2654435761UL) >> 24);
+}
+
+bool SDCard::probeClock(Print* out, uint32_t frequency, uint32_t testBytes, uint8_t* buffer){
+    const char testFilename[] = "/sdclock.tmp";
+    bool verified = false;
+    LatencyHistogram writes;
+    unsigned long elapsed = 1;
+
+    SD.end();
+    if(SD.begin(this->CS_PIN, SPI, frequency)){
+        SD.remove(testFilename);
+        File test = SD.open(testFilename, FILE_WRITE);
+        if(test){
+            // sequential whole block writes, the same as the writer task does while recording
+            unsigned long start = millis();
+            bool written = true;
+            for(uint32_t position = 0; position < testBytes && written; position += SD_BUFFER_SIZE){
+                for(uint32_t i = 0; i < SD_BUFFER_SIZE; i++){
+                    buffer[i] = autotunePattern(position + i);
+                }
+                unsigned long writeStart = micros();
+                written = test.write(buffer, SD_BUFFER_SIZE) == SD_BUFFER_SIZE;
+                writes.record(micros() - writeStart);
+            }
+            test.close();
+            elapsed = max(millis() - start, 1UL);
+
+            // read everything back to prove the card kept up at this clock
+            test = SD.open(testFilename, FILE_READ);
+            verified = written && test && test.size() == testBytes;
+            for(uint32_t position = 0; position < testBytes && verified; position += SD_BUFFER_SIZE){
+                verified = test.read(buffer, SD_BUFFER_SIZE) == SD_BUFFER_SIZE;
+                for(uint32_t i = 0; i < SD_BUFFER_SIZE && verified; i++){
+                    verified = buffer[i] == autotunePattern(position + i);
+                }
+            }
+            test.close();
+            SD.remove(testFilename);
+        }
+    }
+
+    out->print("!SDClock,");
+    out->print(frequency);
+    out->print(",");
+    out->print(verified ? testBytes / 1.024 / elapsed : 0.0, 1);
+    out->print(",");
+    out->print(writes.getMax());
+    out->print(",");
+    out->print(writes.percentile(0.99));
+    out->print(",");
+    out->print(verified ? 1 : 0);
+    out->println(";");
+    return verified;
+}
+
+bool SDCard::autotune(Print* out, uint32_t testBytes){
+    if(!this->readerInitialized || this->fileOpen){
+        out->println("SD autotune skipped: no card, or a recording is in progress.");
+        return false;
+    }
+    uint8_t* buffer = (uint8_t*)malloc(SD_BUFFER_SIZE);
+    if(buffer == nullptr){
+        out->println("SD autotune skipped: out of memory.");
+        return false;
+    }
+    // keep the writer off the card while it is restarted and write what it was still holding
+    xSemaphoreTake(this->writerLock, portMAX_DELAY);
+    uint8_t index;
+    while(xQueueReceive(this->fullBlocks, &index, 0) == pdTRUE){
+        writeBlock(index);
+    }
+    // the session container stays open between events. It is finished here and the next event starts a new one
+    if(this->fileReady){
+        if(this->sessionContainer){
+            endContainerEvent(this->finishedEvent);
+        }
+        markLogClosed();
+        this->file.close();
+        this->file = File();
+        truncateFile();
+        this->fileReady = false;
+    }
+    // round up to whole blocks
+    testBytes = ((testBytes + SD_BUFFER_SIZE - 1) / SD_BUFFER_SIZE) * SD_BUFFER_SIZE;
+
+    const uint32_t clocks[] = SD_AUTOTUNE_CLOCKS;
+    uint32_t best = 0;
+    for(uint32_t clock : clocks){
+        // stop at the first failure. A card that fails a clock is marginal at every faster one too
+        if(!probeClock(out, clock, testBytes, buffer)){
+            break;
+        }
+        best = clock;
+    }
+    free(buffer);
+
+    if(best == 0){
+        best = SD_DEFAULT_FREQUENCY;
+    }
+    this->frequency = best;
+    if(this->settingsOpen){
+        this->settings.putUInt("freq", best);
+    }
+    out->print("!SDClockSelected,");
+    out->print(best);
+    out->println(";");
+
+    // start the card again at the new clock
+    SD.end();
+    bool restarted = initReader();
+    xSemaphoreGive(this->writerLock);
+    return restarted;
+}
+
+void SDCard::benchmarkEncoding(Print* out, unsigned int rows){
+    if(this->fileOpen){
+        out->println("Encoding benchmark skipped: a recording is in progress.");
+        return;
+    }
+    // the same number of values main logs per row: a load cell and four xyz streams
+    const uint8_t count = 13;
+    int32_t values[count];
+    uint8_t row[MAX_BINARY_ROW_LENGTH];
+    LogEncoding encodings[] = {ENCODING_FIXED, ENCODING_DELTA};
+    const char* names[] = {"fixed", "delta"};
+
+    for(int e = 0; e < 2; e++){
+        this->fileEncoding = encodings[e];
+        this->rowsSinceKeyframe = 0;
+        unsigned long bytes = 0;
+        unsigned long elapsed = 0;
+        for(unsigned int i = 0; i < rows; i++){
+            // a slow swing with some noise, quantized at the IMU resolution
+            for(uint8_t j = 0; j < count; j++){
+                values[j] = quantize(2.0 * sin(i * 0.01 + j) + 0.01 * (int)((i * 7 + j * 13) % 5), 0.0001);
+            }
+            unsigned long start = micros();
+            uint8_t* end = encodeRow(values, count, row);
+            elapsed += micros() - start;
+            bytes += end - row;
+        }
+        out->print("SD ");
+        out->print(names[e]);
+        out->print(" encoding: ");
+        out->print((double)elapsed / rows, 3);
+        out->print(" us/row, ");
+        out->print((double)bytes / rows, 1);
+        out->println(" bytes/row");
+    }
+    this->fileEncoding = this->encoding;
+}
+
+void SDCard::benchmark(Print* out, unsigned int rows){
+    if(!this->readerInitialized || this->fileOpen || this->backgroundWriter){
+        out->println("SD benchmark skipped: run it before recording starts and before the writer task is started.");
+        return;
+    }
+    const char benchFilename[] = "/sdbench.csv";
+    // the same number of values the dummy logs per row
+    const int valuesPerRow = 18;
+    char value[32];
+    formatDouble(value, sizeof(value), -12.345678);
+    size_t bytes = rows * valuesPerRow * (strlen(value) + 1);
+
+    // the old behaviour. Reopen the file for every update and print every value on its own
+    SD.remove(benchFilename);
+    unsigned long start = millis();
+    for(unsigned int i = 0; i < rows; i++){
+        File legacy = SD.open(benchFilename, FILE_APPEND);
+        for(int j = 0; j < valuesPerRow; j++){
+            legacy.print(value);
+            legacy.print(j < valuesPerRow - 1 ? "," : "\r\n");
+        }
+        legacy.close();
+    }
+    unsigned long legacyTime = max(millis() - start, 1UL);
+
+    // the buffered behaviour. One open file and whole sector writes
+    SD.remove(benchFilename);
+    start = millis();
+    this->file = SD.open(benchFilename, FILE_WRITE);
+    this->fileReady = (bool)this->file;
+    this->fileOpen = this->fileReady;
+    for(unsigned int i = 0; i < rows; i++){
+        for(int j = 0; j < valuesPerRow; j++){
+            write(value);
+            write(j < valuesPerRow - 1 ? "," : "\r\n");
+        }
+    }
+    closeFile();
+    unsigned long bufferedTime = max(millis() - start, 1UL);
+    SD.remove(benchFilename);
+
+    out->print("SD reopen per update: ");
+    out->print(bytes / 1.024 / legacyTime, 1);
+    out->print(" KB/s, ");
+    out->print(rows * 1000.0 / legacyTime, 1);
+    out->println(" rows/s");
+    out->print("SD buffered: ");
+    out->print(bytes / 1.024 / bufferedTime, 1);
+    out->print(" KB/s, ");
+    out->print(rows * 1000.0 / bufferedTime, 1);
+    out->println(" rows/s");
 }
\ No newline at end of file
@@ -10,9 +10,120 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <SD.h>
+#include <Preferences.h>
 #include "sensorTemplate.h"
+#include "LatencyHistogram.h"
+#include "SyncClock.h"
 
-#define SPI_SPEED SD_SCK_MHZ(4)
+// SPI clock used until autotune() has found a faster one for the inserted card
+#define SD_DEFAULT_FREQUENCY 4000000
+// the clocks autotune() tries, slowest first. The ESP32 rounds each to the nearest divisor of 80MHz
+#define SD_AUTOTUNE_CLOCKS {4000000, 8000000, 10000000, 16000000, 20000000, 26666666, 40000000}
+// bytes written and read back at each clock
+#define SD_AUTOTUNE_BYTES (256UL * 1024UL)
+
+// where the SD library mounts the card in the VFS
+#ifndef SD_MOUNT_POINT
+#define SD_MOUNT_POINT "/sd"
+#endif
+
+// data is written to the card in whole sectors
+#define SD_SECTOR_SIZE 512
+// each RAM block holds this many sectors before it is written out
+#define SD_BUFFER_SECTORS 4
+#define SD_BUFFER_SIZE (SD_SECTOR_SIZE * SD_BUFFER_SECTORS)
+// the number of blocks shared between acquisition and the writer task
+#define SD_BLOCK_COUNT 4
+
+// what the writer should do with a block besides writing its data
+typedef enum{
+    BLOCK_OPEN = 1, // open a new file before writing the data
+    BLOCK_FLUSH = 2, // sync the file after writing the data
+    BLOCK_CLOSE = 4 // close the file after writing the data
+}BlockFlags;
+
+// the SD operations that are timed
+typedef enum{
+    SD_OPEN, // open a file, including pre-allocation and container setup
+    SD_WRITE, // write one block
+    SD_FLUSH, // sync the file
+    SD_CLOSE, // close a file or finish a container event
+    SD_UPDATE, // SDCard::update, on the acquisition side
+    SD_OPERATION_COUNT
+}SDOperation;
+
+// summary of one recording, stored in the index table of a session container
+struct SDEvent{
+    uint32_t timestamp; // millis() when the recording started
+    float peakG; // peak linear head acceleration in g
+    float risk; // concussion probability
+};
+
+struct SDBlock{
+    uint8_t data[SD_BUFFER_SIZE];
+    size_t length;
+    uint8_t flags;
+    SDEvent event; // the recording being finished when the block has BLOCK_CLOSE or BLOCK_OPEN set
+};
+
+// the max number of streams of each type that can be registered
+#define MAX_SD_STREAMS 10
+
+// binary log files start with these 4 bytes
+#define BINARY_LOG_MAGIC "STDL"
+#define BINARY_LOG_VERSION 3
+// every record in a binary log starts with a one byte tag that says what kind of record it is
+#define BINARY_RECORD_ROW 0x52
+// delta encoded logs use these records. Values are zigzag varints, see SDCard::encodeRow
+#define BINARY_RECORD_KEYFRAME 0x4B
+#define BINARY_RECORD_DELTA 0x44
+// written when a log is closed. Holds the counters and latency histograms, see SDCard::writeBinaryFooter
+#define BINARY_RECORD_FOOTER 0x46
+// journaled logs wrap records in frames with a sequence number and CRC, see SDCard::commitFrame
+#define BINARY_RECORD_FRAME 0x4A
+// ties the rows to the device and host clocks. Added in version 2, see SDCard::writeTimeRecord
+#define BINARY_RECORD_TIME 0x54
+// how often a time record is written in ms. One is also written after the first rows and whenever the clock is synced
+#define SD_TIME_RECORD_MS 1000
+// set in the flags byte of the header when the log is journaled
+#define BINARY_FLAG_JOURNALED 0x01
+// set in the flags byte of the header by the writer once the log is closed, so recover() can leave it alone
+#define BINARY_FLAG_CLOSED 0x02
+// the most record bytes in one frame
+#define SD_FRAME_SIZE 512
+// the bytes a frame adds around its records: tag, length and sequence before and a CRC after
+#define SD_FRAME_OVERHEAD 11
+// how far recover() searches past a damaged frame for the next good one. A torn write loses at most the blocks in flight
+#define SD_RESYNC_BYTES (SD_BUFFER_SIZE * SD_BLOCK_COUNT)
+// a delta encoded log starts over from absolute values this often so a damaged record only loses a few rows
+#define DELTA_KEYFRAME_INTERVAL 250
+
+/** Session container layout. All values are little endian:
+ * magic[4], version u8, reserved u8, max events u16, event count u16, reserved u16, data offset u32
+ * then max events index entries of:
+ * offset u32, length u32, timestamp u32, peak g f32, risk f32
+ * Unused entries are zero. Each event is a complete log in the current format starting at its offset.
+ * An event recovered after a power loss has a timestamp of 0 and a peak g and risk of -1.
+ * The file may be longer than the last event if it was pre-allocated and never closed.
+ */
+#define SESSION_MAGIC "STDS"
+#define SESSION_VERSION 1
+#define SESSION_HEADER_SIZE 16
+#define SESSION_ENTRY_SIZE 20
+#define SESSION_MAX_EVENTS 200
+// events start on a sector boundary after the index table
+#define SESSION_DATA_OFFSET 4096
+
+// how rows are stored in a binary log. The value is written to the encoding byte of the header
+typedef enum{
+    ENCODING_FIXED = 0, // an int32 per value
+    ENCODING_DELTA = 1 // the change from the previous row as a zigzag varint per value
+}LogEncoding;
+
+typedef enum{
+    LOG_CSV, // human readable comma separated values
+    LOG_BINARY // self describing header followed by fixed size little endian records. See Scripts/log_to_csv.py
+}LogFormat;
 
 class SDCard{
     public:
@@ -35,15 +146,92 @@ class SDCard{
         bool init();
 
         /**
-         * @brief Open a file on the SD Card
+         * @brief measure sequential write throughput and block write latency at each clock in SD_AUTOTUNE_CLOCKS,
+         * reading every byte back to check it. The fastest clock that passes is stored in flash and used from then on.
+         * Each clock is reported as !SDClock,<Hz>,<KB/s>,<max write us>,<99th percentile write us>,<1 if verified>;
+         * followed by !SDClockSelected,<Hz>;
+         * @param out where to print the results
+         * @param testBytes how much to write at each clock
+         * @returns false if the test could not run
+         * @pre no recording is in progress. Call it from the task that calls update(). It stops the writer task, writes the
+         * blocks it was still holding and closes the session container, so it takes a few seconds and logging waits meanwhile
+         */
+        bool autotune(Print* out, uint32_t testBytes = SD_AUTOTUNE_BYTES);
+
+        /**
+         * @brief get the SPI clock the card is run at
+         */
+        uint32_t getFrequency(){return frequency;};
+
+        /**
+         * @brief Open a file on the SD Card. This is done by the writer, use update() to start a recording
          * @param filename the name of the file to open
          */
         void openFile(bool newFile, const char* mode);
 
         /**
-         * @brief Close the currently open file
+         * @brief Hand any buffered data to the writer and close the current file once it is written
          */
         void closeFile();
+
+        /**
+         * @brief Hand everything in the RAM buffer to the writer, including a partial sector, and sync the file.
+         * Call this at the end of an event so the data is safe even if the file is not closed
+         */
+        void flush();
+
+        /**
+         * @brief write any full blocks to the card. This is the only place file I/O happens while recording
+         * @param wait how long to wait for the first block. Any other waiting blocks are written without waiting
+         */
+        void writeBlocks(TickType_t wait);
+
+        /**
+         * @brief set whether a separate task calls writeBlocks(). Otherwise blocks are written as soon as they fill
+         * @param backgroundWriter true if a writer task is running
+         */
+        void useBackgroundWriter(bool backgroundWriter){this->backgroundWriter = backgroundWriter;};
+
+        /**
+         * @brief reserve space for each new file when it is opened so writes during a recording never allocate clusters.
+         * A session container reserves more whenever an event starts with less than this left.
+         * The file is truncated to the data actually written when it is closed
+         * @param bytes the size to reserve. 0 turns pre-allocation off
+         */
+        void setPreallocation(uint32_t bytes){this->preallocateSize = bytes;};
+
+        /**
+         * @brief write every recording into one session container file with an index table at the front
+         * instead of a separate file per recording. A new container is started when one fills up
+         * @param sessionContainer true to use session containers
+         * @post takes effect the next time a file is started
+         */
+        void setSessionContainer(bool sessionContainer){this->sessionContainer = sessionContainer;};
+
+        /**
+         * @brief finish the current recording and store its summary in the session index
+         * @param peakG the peak linear head acceleration in g
+         * @param risk the concussion probability
+         */
+        void endEvent(float peakG, float risk);
+
+        /**
+         * @brief print the rows written, the samples each stream dropped before they were written and the latency
+         * of each SDOperation in the form
+         * !SDRows,<rows written>,<overruns>,<dropped bytes>;
+         * !SDStream,<name>,<samples written>,<samples dropped>; for each stream
+         * !Latency,<operation>,...; for each operation. See LatencyHistogram::print
+         * Everything counts from power up. The same values are written to the footer of each log
+         * @param out where to print the statistics
+         */
+        void printStats(Print* out);
+
+        /**
+         * @brief print the writer statistics in the form
+         * !SDWriter,<max blocks in use>,<block count>,<overruns>,<dropped bytes>,<max write latency us>;
+         * @param out where to print the statistics
+         */
+        void printWriterStats(Print* out);
         
         // Add the ability to give a data stream pointer to the SDCard class and have it automatically write its contents to the open file
         //void registerDataStream(DataStream stream);
@@ -54,6 +242,7 @@ class SDCard{
         bool writeln(float line);
         bool writeln(double line);
 
+        bool write(const uint8_t* data, size_t length);
         bool write(const char* line);
         bool write(String line);
         bool write(int line);
@@ -63,14 +252,79 @@ class SDCard{
         /**
          * @brief Add a data stream to the SDCard
          * @param stream a pointer to a datastream which stores type double.
+         * @param scale the resolution of the stream in binary logs. Values are stored as round(value / scale)
+         * @param sampleRate the rate the stream is sampled at in Hz. Recorded in the binary log header, 0 if unknown
+         * @param cfc the CFC the stream was filtered with before it was stored, 0 if it wasn't. Recorded in the binary log
+         * header so the export tool doesn't filter it again
          */
-        void registerDoubleDatastream(DataStream<double>* stream);
+        void registerDoubleDatastream(DataStream<double>* stream, float scale = 0.001, float sampleRate = 0, float cfc = 0);
 
         /**
          * @brief Add a data stream to the SDCard
          * @param stream a pointer to ta datastream which stores type xyzData.
+         * @param scale the resolution of the stream in binary logs. Values are stored as round(value / scale)
+         * @param sampleRate the rate the stream is sampled at in Hz. Recorded in the binary log header, 0 if unknown
+         * @param cfc the CFC the stream was filtered with before it was stored, 0 if it wasn't. Recorded in the binary log
+         * header so the export tool doesn't filter it again
         */
-       void registerXYZDatastream(DataStream<xyzData> * stream);
+       void registerXYZDatastream(DataStream<xyzData> * stream, float scale = 0.001, float sampleRate = 0, float cfc = 0);
+
+        /**
+         * @brief set whether binary logs are journaled. Each group of records is written as a frame with a sequence
+         * number and CRC, so after a power loss recover() can keep every complete frame
+         * @param journaled true to journal binary logs
+         * @post takes effect the next time a file is started
+         */
+        void setJournaled(bool journaled){this->journaled = journaled;};
+
+        /**
+         * @brief set how often a journaled log is synced to the card while recording. Events are always synced when they end.
+         * Each checkpoint hands the writer a partly filled block, so the card sees a partial sector write and a sync
+         * instead of a whole block, and the next block starts early. Longer intervals waste less but lose more on a power loss
+         * @param interval the time between checkpoints in ms. 0 turns periodic checkpoints off
+         */
+        void setCheckpointInterval(uint32_t interval){this->checkpointInterval = interval;};
+
+        /**
+         * @brief stamp binary logs with the host's time so they can be lined up with other recordings.
+         * Without a clock the time records only hold the device time
+         * @param clock the clock synced with the host
+         */
+        void setClock(SyncClock* clock){this->clock = clock;};
+
+        /**
+         * @brief set how much history from before the trigger starts each recording
+         * @param rows the most rows kept from each stream when a file is started. The streams hold at most MAX_STREAM_LENGTH
+         */
+        void setPreTrigger(unsigned int rows){this->preTriggerRows = rows;};
+
+        /**
+         * @brief repair the newest log if the power went out while it was open. Logs marked closed are left alone.
+         * Damaged frames in the middle are skipped over and every good frame after them is kept, then the damaged
+         * tail and unused pre-allocated space are cut off. A container also gets an index entry for the event
+         * @returns true if the file was repaired
+         * @pre the file name is set and nothing is being recorded. Call this once at startup
+         */
+        bool recover();
+
+        /**
+         * @brief set the format new files are written in
+         * @param format the log format
+         * @post takes effect the next time a file is started
+         */
+        void setFormat(LogFormat format){this->format = format;};
+
+        /**
+         * @brief get the format new files are written in
+         */
+        LogFormat getFormat(){return format;};
+
+        /**
+         * @brief set how rows are stored in binary logs
+         * @param encoding the row encoding
+         * @post takes effect the next time a file is started
+         */
+        void setEncoding(LogEncoding encoding){this->encoding = encoding;};
 
         /**
          * @brief Write any new data from the data streams to the file
@@ -98,6 +352,12 @@ class SDCard{
          */
         void setFileNumber(uint32_t fileNumber);
 
+        /**
+         * @brief finish the current file and start the next number. Unlike setFileNumber(getFileNumber() + 1) the
+         * writer can't open a file between reading and setting the number
+         */
+        void nextFile();
+
         /**
          * @brief return true if an SD Card is connected
          * @return true if an SD Card is connected
@@ -110,31 +370,217 @@ class SDCard{
         */
         bool isFileOpen(){return fileOpen;};
 
+        /**
+         * @brief check if the writer has a file open for writing. Safe to call from any task
+         * @param name the file name, with or without its directory
+         * @return true if the file is open. A session container stays open between recordings
+         */
+        bool isFileInUse(const char* name);
+
         /**
          * @brief return true if the file has been initialized
          * @return true if the file has been initialized
         */
         bool isFileInitialized(){return fileInitialized;};
 
+        /**
+         * @brief measure write throughput of the old reopen-per-update behaviour against the buffered writer
+         * @param out where to print the results in KB/s and rows/s
+         * @param rows the number of CSV rows to write in each test
+         * @pre the card is initialized and no recording is in progress
+         */
+        void benchmark(Print* out, unsigned int rows = 500);
+
+        /**
+         * @brief measure the time and space each binary row encoding takes on sensor-like data. No file is written
+         * @param out where to print the results in us/row and bytes/row
+         * @param rows the number of rows to encode
+         * @pre no recording is in progress
+         */
+        void benchmarkEncoding(Print* out, unsigned int rows = 2000);
+
 
     private:
         // keep track of if the file is open or not
         bool readerInitialized = false; // true when controller cna successfully connect to the SD Card reader
-        bool fileOpen = false; // true when a file is open
+        bool fileOpen = false; // true when a recording file has been started and not yet closed
+        bool fileReady = false; // true when the writer actually has a file open
         bool fileInitialized = false; // true when a file has been opened the header has been written to it
         File file;// = File();
         uint8_t CS_PIN;
 
+        LogFormat format = LOG_CSV;
+        LogEncoding encoding = ENCODING_FIXED;
+        LogEncoding fileEncoding = ENCODING_FIXED; // the encoding of the open file
+        // the last row written, for delta encoding
+        int32_t previousRow[4 * MAX_SD_STREAMS] = {0};
+        uint16_t rowsSinceKeyframe = 0;
+
+        // journaling
+        bool journaled = false;
+        bool fileJournaled = false; // the open file is journaled
+        uint8_t frame[SD_FRAME_SIZE]; // records waiting to be written as a frame
+        uint16_t frameLength = 0;
+        uint32_t frameSequence = 0; // the sequence number of the next frame in the file
+        uint32_t checkpointInterval = 0;
+        unsigned int preTriggerRows = MAX_STREAM_LENGTH;
+        unsigned long lastCheckpoint = 0;
+
+        // time records
+        SyncClock* clock = nullptr;
+        uint32_t fileRows = 0; // rows written to the open binary log
+        uint16_t frameRows = 0; // rows in the journal frame being built, counted once it is written
+        uint32_t timeGeneration = 0; // the clock generation in the last time record
+        unsigned long lastTimeRecord = 0;
+
         // linked list of pointers to data streams
-        DataStream<double>* doubleStreams[10] = {nullptr};
-        DataStream<xyzData>* XYZStreams[10] = {nullptr};
+        DataStream<double>* doubleStreams[MAX_SD_STREAMS] = {nullptr};
+        DataStream<xyzData>* XYZStreams[MAX_SD_STREAMS] = {nullptr};
+        // binary log resolution and sample rate of each stream
+        float doubleScales[MAX_SD_STREAMS] = {0};
+        float doubleRates[MAX_SD_STREAMS] = {0};
+        float XYZScales[MAX_SD_STREAMS] = {0};
+        float XYZRates[MAX_SD_STREAMS] = {0};
+        float doubleCFCs[MAX_SD_STREAMS] = {0};
+        float XYZCFCs[MAX_SD_STREAMS] = {0};
         uint8_t registeredDoubleStreams = 0; // keep track of how many data streams have been registered in the array
         uint8_t registeredXYZStreams = 0;
         // configure these for dynamic filename generation
         char * dynamicFilename = nullptr;
         char * extension = nullptr;
         char filename[50];
-        uint32_t fileNumber = 0;
+        uint32_t fileNumber = 0; // shared with the writer task, use fileNumberLock. It also guards filename
+        portMUX_TYPE fileNumberLock = portMUX_INITIALIZER_UNLOCKED;
+        // the first file number that has never been used. It is kept in <dynamicFilename>.idx on the card
+        uint32_t nextFileNumber = 0;
+        bool fileIndexLoaded = false;
+
+        // blocks of data waiting to be written to the card.
+        // acquisition fills them and the writer drains them so neither needs a lock shared with the other
+        SDBlock blocks[SD_BLOCK_COUNT];
+        QueueHandle_t freeBlocks; // indexes of blocks ready to be filled
+        QueueHandle_t fullBlocks; // indexes of blocks ready to be written
+        SemaphoreHandle_t writerLock; // held by the writer for each block, and by autotune to keep the writer off the card
+        SDBlock* currentBlock = nullptr; // the block being filled
+        uint8_t pendingFlags = 0; // flags waiting for a free block
+        bool backgroundWriter = false;
+
+        // writer statistics
+        UBaseType_t blockHighWaterMark = 0; // most blocks in use at once
+        uint32_t overruns = 0; // number of writes that found no free block
+        uint32_t droppedBytes = 0; // bytes lost to overruns
+
+        // SPI clock, loaded from flash in init()
+        uint32_t frequency = SD_DEFAULT_FREQUENCY;
+        Preferences settings;
+        bool settingsOpen = false;
+        LatencyHistogram latency[SD_OPERATION_COUNT]; // time spent in each SDOperation
+        uint32_t rowsWritten = 0; // rows handed to the writer since power up. Rows dropped as overruns aren't counted
+        uint32_t doubleWritten[MAX_SD_STREAMS] = {0}; // samples of each stream in those rows, counted from when it was registered
+        uint32_t XYZWritten[MAX_SD_STREAMS] = {0};
+
+        // pre-allocation
+        uint32_t preallocateSize = 0; // bytes to reserve for each new file
+        bool preallocated = false; // true if the open file was pre-allocated and needs to be truncated
+        uint32_t reservedLength = 0; // bytes allocated to the open file
+        uint32_t fileLength = 0; // bytes of real data in the open file
+
+        // session containers
+        bool sessionContainer = false;
+        SDEvent currentEvent = {0, 0, 0}; // the recording being written, owned by the producer
+        SDEvent finishedEvent = {0, 0, 0}; // the last recording the producer closed
+        bool eventOpen = false; // the writer has started an event in the open container
+        uint32_t eventOffset = 0; // where the open event starts in the container
+        uint16_t eventCount = 0; // events in the open container
+        // the binary header of the log being written, so the writer can mark it closed
+        bool logHeaderKnown = false;
+        uint32_t logStart = 0; // where the header starts in the file
+        uint8_t logFlags = 0; // the flags byte of the header
+
+        /**
+         * @brief get the number of bytes that can be written before the writer has to free another block
+         */
+        size_t freeRoom();
+
+        /**
+         * @brief get a block to fill if there isn't one already
+         * @returns true if currentBlock can be written to
+         */
+        bool acquireBlock();
+
+        /**
+         * @brief hand the current block to the writer
+         * @param flags what the writer should do with the block besides writing it
+         */
+        void submitBlock(uint8_t flags);
+
+        /**
+         * @brief ask the writer to open a new file with the next block
+         */
+        void startFile();
+
+        /**
+         * @brief write one full block to the card and hand it back to the free queue
+         * @pre writerLock is held
+         */
+        void writeBlock(uint8_t index);
+
+        /**
+         * @brief turn counting dropped samples on or off for every registered stream
+         * @param enabled true while a recording is draining the streams
+         */
+        void countDrops(bool enabled);
+
+        /**
+         * @brief get the name of the file that stores nextFileNumber
+         * @param indexFilename buffer to write the name to
+         * @param length size of the buffer
+         */
+        void getIndexFilename(char* indexFilename, size_t length);
+
+        /**
+         * @brief read nextFileNumber from the index file.
+         * If the index file is missing the directory is scanned once and the index file is created
+         */
+        void loadFileIndex();
+
+        /**
+         * @brief write nextFileNumber to the index file
+         */
+        void saveFileIndex();
+
+        /**
+         * @brief start a new event in the session container, opening a new container if needed
+         * @param previous the summary of the event that is still open, if there is one
+         */
+        void startContainerEvent(const SDEvent& previous);
+
+        /**
+         * @brief add the open event to the container index and sync the file
+         * @param event the summary of the event
+         */
+        void endContainerEvent(const SDEvent& event);
+
+        /**
+         * @brief set BINARY_FLAG_CLOSED in the header of the log being finished
+         */
+        void markLogClosed();
+
+        /**
+         * @brief reserve preallocateSize bytes for the file that was just opened
+         */
+        void preallocateFile();
+
+        /**
+         * @brief reserve up to preallocateSize bytes past the data written so far, if that much isn't reserved already
+         */
+        void extendPreallocation();
+
+        /**
+         * @brief cut a pre-allocated file down to the data that was written to it
+         * @pre the file is closed
+         */
+        void truncateFile();
 
 
         /**
@@ -142,12 +588,114 @@ class SDCard{
         */
         void writeHeader();
 
+        /**
+         * @brief Write the self describing binary header to the file
+        */
+        void writeBinaryHeader();
+
+        /**
+         * @brief write one binary record. Journaled records are collected into a frame
+         * @param data the record
+         * @param length the record length, at most SD_FRAME_SIZE
+         */
+        bool writeRecord(const uint8_t* data, size_t length);
+
+        /**
+         * @brief write the records collected so far as one frame
+         */
+        void commitFrame();
+
+        /**
+         * @brief check one frame of a journaled log
+         * @param log the file, open for reading
+         * @param position where the frame starts
+         * @param size the size of the file
+         * @param buffer scratch space of SD_FRAME_SIZE bytes
+         * @param sequence set to the frame's sequence number
+         * @param length set to the frame's payload length
+         * @returns true if the whole frame is there and its CRC matches
+         */
+        bool readFrame(File& log, uint32_t position, uint32_t size, uint8_t* buffer, uint32_t* sequence, uint16_t* length);
+
+        /**
+         * @brief find the end of the last complete frame in a journaled log, skipping over damaged frames
+         * @param log the file, open for reading
+         * @param start where the log starts in the file
+         * @param size the size of the file
+         * @param end set to the end of the last good frame, or the end of the header if there are none.
+         * Set to size if the log isn't journaled
+         * @param skipped set to the damaged bytes between good frames
+         * @returns false if there is no binary log at start
+         */
+        bool scanJournal(File& log, uint32_t start, uint32_t size, uint32_t* end, uint32_t* skipped);
+
+        /**
+         * @brief Write the counters and latency histograms to the end of the file
+         */
+        void writeFooter();
+
+        /**
+         * @brief Write the footer as a binary record
+         */
+        void writeBinaryFooter();
+
+        /**
+         * @brief count rows that were handed to the writer
+         * @param rows the number of rows
+         */
+        void countRows(uint32_t rows);
+
         /**
          * @brief Write the data from the data streams to the file
          * @param numLines the number of lines to write to the file
          */
         void writeData(uint16_t numLines);
 
+        /**
+         * @brief Write a time record for the rows written so far
+         * @param local when the last sample in the newest of those rows was taken, from SyncClock::localTime
+         */
+        void writeTimeRecord(int64_t local);
+
+        /**
+         * @brief Write the data from the data streams to the file as fixed size binary records
+         * @param numLines the number of records to write to the file
+         * @param destructive if true the data is popped from the data streams
+         */
+        void writeBinaryData(uint16_t numLines, bool destructive);
+
+        /**
+         * @brief encode one row of quantized values as a binary record
+         * @param values the values in header order
+         * @param count the number of values
+         * @param buffer where to put the record. Must hold 1 + 5 * count bytes
+         * @return a pointer just past the record
+         */
+        uint8_t* encodeRow(const int32_t* values, uint8_t count, uint8_t* buffer);
+
+        /**
+         * @brief add a value and a comma to a CSV row
+         * @param row the row. Must have room for CSV_VALUE_LENGTH more characters
+         * @param length the characters in the row so far. Updated to include the value
+         * @param value the value to add
+         */
+        void appendValue(char* row, size_t* length, double value);
+
+        /**
+         * @brief replace the comma after the last value of a CSV row with the line ending
+         * @param row the row
+         * @param length the characters in the row. Updated to include the line ending
+         */
+        void endRow(char* row, size_t* length);
+
+        /**
+         * @brief convert a double to text without ever truncating it
+         * @param buffer where to put the text
+         * @param length the size of buffer
+         * @param value the number to convert
+         */
+        void formatDouble(char* buffer, size_t length, double value);
+
         /**
          * @brief Write the data from the data streams to the file and clear the data from the data streams
          * @param numLines the number of lines to write to the file
@@ -158,4 +706,14 @@ class SDCard{
          * @brief attempt to initialize the SD Card reader
         */
         bool initReader();
+
+        /**
+         * @brief write and read back a test file at one SPI clock
+         * @param out where to print the result
+         * @param frequency the clock to test
+         * @param testBytes how much to write
+         * @param buffer a scratch block of SD_BUFFER_SIZE bytes
+         * @returns true if every byte read back correctly
+         */
+        bool probeClock(Print* out, uint32_t frequency, uint32_t testBytes, uint8_t* buffer);
 };
\ No newline at end of file
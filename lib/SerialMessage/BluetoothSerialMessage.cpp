@@ -24,40 +24,48 @@ void BluetoothSerialMessage::printArgs(){
     serial->println();
 }
 
-void BluetoothSerialMessage::readSerial(){
-    boolean recvInProgress = false;
-    byte ndx = 0;
-    char c;
-
-    // read the incoming serial data:
-    while (serial->available() > 0 && data_recieved == false) {
-        // get the neext character in the serial buffer
-        c = serial->read();
-
-        // only execute this if the startMarker has been received
-        if (recvInProgress == true) {
-            // if the incoming character is not the endMarker...
-            if (c != endMarker) {
-                // add it to the data array
-                data[ndx] = c;
-                ndx++; // increment the data array index
-                // if the index is greater than the maximum data array size,
-                // keep overwriting the last element until the endMarker is received.
-                if (ndx >= num_chars) {
-                    ndx = num_chars - 1;
-                }
+bool BluetoothSerialMessage::isConnected(){
+    return serial->hasClient();
+}
+
+size_t BluetoothSerialMessage::send(const uint8_t* data, size_t length){
+    return serial->write(data, length);
+}
+
+void BluetoothSerialMessage::notifyOnReceive(TaskHandle_t task){
+    if(this->rxQueue == nullptr){
+        this->rxQueue = xQueueCreate(BLUETOOTH_RX_QUEUE_LENGTH, sizeof(uint8_t));
+    }
+    QueueHandle_t queue = this->rxQueue;
+    serial->onData([this, queue, task](const uint8_t *buffer, size_t size){
+        for(size_t i = 0; i < size; i++){
+            // a full queue drops the rest. The reader drops the message they cut when it gets to them
+            if(xQueueSend(queue, &buffer[i], 0) != pdTRUE){
+                markLost(this->queued);
+                break;
             }
-            // if the incoming character is the endMarker clean up and set the flags
-            else {
-                data[ndx] = '\0'; // terminate the string
-                recvInProgress = false;
-                ndx = 0;
-                data_recieved = true;
+            this->queued++;
+        }
+        xTaskNotifyGive(task);
+    });
+}
+
+size_t BluetoothSerialMessage::readBytes(uint8_t* buffer, size_t length){
+    // take the bytes from the receive queue, or the serial buffer if there isn't one
+    size_t count = 0;
+    while(count < length){
+        if(this->rxQueue != nullptr){
+            if(xQueueReceive(this->rxQueue, &buffer[count], 0) != pdTRUE){
+                break;
             }
         }
-        // if the incoming character is the startMarker, set the recvInProgress flag
-        else if (c == startMarker) {
-            recvInProgress = true;
+        else if(serial->available() > 0){
+            buffer[count] = serial->read();
+        }
+        else{
+            break;
         }
+        count++;
     }
+    return count;
 }
\ No newline at end of file
@@ -7,8 +7,13 @@
 #pragma once
 #include "SerialMessage.h"
 #include "BluetoothSerial.h"
+#include "ImpactTransport.h"
 
-class BluetoothSerialMessage : public SerialMessage{
+// bytes received over Bluetooth that can wait for the command task
+#define BLUETOOTH_RX_QUEUE_LENGTH 256
+
+// the messages come in over Bluetooth and the impact summaries go out over it
+class BluetoothSerialMessage : public SerialMessage, public ImpactTransport{
     public:
         /**
          * @brief Construct a new Bluetooth Serial Message object
@@ -20,18 +25,37 @@ class BluetoothSerialMessage : public SerialMessage{
          */
         void init(unsigned int baud_rate = 115200) override;
 
+        /**
+         * @brief Wake a task whenever bytes arrive. The Bluetooth stack hands the bytes to a callback instead of
+         * its own buffer once this is called, so they are kept in a queue until the task reads them
+         * @param task the task to notify
+         */
+        void notifyOnReceive(TaskHandle_t task) override;
+
         /**
          * @brief prints the args array to the serial monitor
         */
         void printArgs() override;
+
+        /**
+         * @brief returns true if a device is connected over Bluetooth
+        */
+        bool isConnected() override;
+
+        /**
+         * @brief send bytes to the connected device in one write
+        */
+        size_t send(const uint8_t* data, size_t length) override;
     
     private:
         /**
-         * @brief reads the serial data and stores it in the data array
+         * @brief reads the bytes that have arrived over Bluetooth
         */
-        void readSerial() override;
+        size_t readBytes(uint8_t* buffer, size_t length) override;
 
         BluetoothSerial *serial;
+        QueueHandle_t rxQueue = nullptr;
+        uint32_t queued = 0; // bytes put in the queue, counted like rxCount so a loss lands in the right place
 
 
 };
\ No newline at end of file
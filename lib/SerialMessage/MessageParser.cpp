@@ -0,0 +1,263 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Splits a byte stream into command messages without copying or tokenizing them.
+ * This has no Arduino dependencies so it can be benchmarked and fuzzed on a computer. See Scripts/message_parser_bench.cpp
+*/
+
+#include "MessageParser.h"
+#include "CRC32.h"
+#include <stdlib.h>
+#include <string.h>
+
+void MessageParser::start(ParseState newState){
+    this->state = newState;
+    this->length = 0;
+    this->fieldCount = 0;
+    this->fieldStart[0] = 0;
+}
+
+void MessageParser::drop(){
+    this->errors++;
+    this->state = PARSE_IDLE;
+}
+
+void MessageParser::discard(){
+    this->errors++;
+    this->state = PARSE_DISCARD;
+}
+
+void MessageParser::next(){
+    if(this->state == PARSE_READY){
+        this->state = PARSE_IDLE;
+    }
+}
+
+void MessageParser::resync(){
+    switch(this->state){
+        case PARSE_TEXT:
+        case PARSE_LENGTH_LOW:
+        case PARSE_LENGTH_HIGH:
+        case PARSE_PAYLOAD:
+        case PARSE_CRC:
+            drop();
+            break;
+        case PARSE_DISCARD:
+            // already counted when it was discarded
+            this->state = PARSE_IDLE;
+            break;
+        default:
+            break;
+    }
+}
+
+bool MessageParser::endField(){
+    if(this->fieldCount >= MESSAGE_MAX_FIELDS){
+        return false;
+    }
+    uint16_t start = this->fieldStart[this->fieldCount];
+    this->fieldLength[this->fieldCount] = this->length - start;
+    this->buffer[this->length++] = '\0';
+    this->fieldCount++;
+    if(this->fieldCount < MESSAGE_MAX_FIELDS){
+        this->fieldStart[this->fieldCount] = this->length;
+    }
+    return true;
+}
+
+void MessageParser::finishBinary(){
+    uint32_t expected = (uint32_t)this->crcBytes[0] | ((uint32_t)this->crcBytes[1] << 8) |
+        ((uint32_t)this->crcBytes[2] << 16) | ((uint32_t)this->crcBytes[3] << 24);
+    if(crc32(this->buffer, this->length, 0) != expected){
+        drop();
+        return;
+    }
+    this->fieldStart[0] = 0;
+    this->fieldLength[0] = 1;
+    this->fieldCount = 1;
+    if(this->length > 1){
+        this->fieldStart[1] = 1;
+        this->fieldLength[1] = this->length - 1;
+        this->fieldCount = 2;
+    }
+    this->type = MESSAGE_BINARY;
+    this->state = PARSE_READY;
+    this->messages++;
+}
+
+size_t MessageParser::feed(const uint8_t* data, size_t length){
+    size_t used = 0;
+    while(used < length && this->state != PARSE_READY){
+        uint8_t c = data[used];
+        switch(this->state){
+            case PARSE_IDLE:
+                used++;
+                if(c == MESSAGE_TEXT_START){
+                    start(PARSE_TEXT);
+                }
+                else if(c == MESSAGE_BINARY_START){
+                    start(PARSE_LENGTH_LOW);
+                }
+                break;
+            case PARSE_TEXT:{
+                // scan the ordinary bytes in one pass and only stop on a marker
+                size_t end = used;
+                while(end < length && data[end] != MESSAGE_TEXT_END && data[end] != MESSAGE_TEXT_SEPARATOR && data[end] != MESSAGE_TEXT_START){
+                    end++;
+                }
+                size_t run = end - used;
+                if(this->length + run > MESSAGE_MAX_LENGTH - 1){
+                    // too long. Throw the rest away instead of keeping a message with a clobbered end
+                    used = end;
+                    discard();
+                    break;
+                }
+                memcpy(&this->buffer[this->length], &data[used], run);
+                this->length += run;
+                used = end;
+                if(used >= length){
+                    break;
+                }
+                c = data[used++];
+                if(c == MESSAGE_TEXT_START){
+                    // the last message never ended
+                    this->errors++;
+                    start(PARSE_TEXT);
+                }
+                else if(!endField()){
+                    discard();
+                }
+                else if(c == MESSAGE_TEXT_END){
+                    // !; has no fields rather than one empty one
+                    if(this->fieldCount == 1 && this->fieldLength[0] == 0){
+                        this->fieldCount = 0;
+                    }
+                    this->type = MESSAGE_TEXT;
+                    this->state = PARSE_READY;
+                    this->messages++;
+                }
+                break;
+            }
+            case PARSE_DISCARD:
+                used++;
+                if(c == MESSAGE_TEXT_END){
+                    this->state = PARSE_IDLE;
+                }
+                else if(c == MESSAGE_TEXT_START){
+                    start(PARSE_TEXT);
+                }
+                break;
+            case PARSE_LENGTH_LOW:
+                used++;
+                this->expectedLength = c;
+                this->state = PARSE_LENGTH_HIGH;
+                break;
+            case PARSE_LENGTH_HIGH:
+                used++;
+                this->expectedLength |= (uint16_t)c << 8;
+                if(this->expectedLength == 0 || this->expectedLength > MESSAGE_MAX_LENGTH){
+                    drop();
+                }
+                else{
+                    this->state = PARSE_PAYLOAD;
+                }
+                break;
+            case PARSE_PAYLOAD:{
+                size_t run = this->expectedLength - this->length;
+                if(run > length - used){
+                    run = length - used;
+                }
+                memcpy(&this->buffer[this->length], &data[used], run);
+                this->length += run;
+                used += run;
+                if(this->length == this->expectedLength){
+                    this->crcLength = 0;
+                    this->state = PARSE_CRC;
+                }
+                break;
+            }
+            case PARSE_CRC:
+                used++;
+                this->crcBytes[this->crcLength++] = c;
+                if(this->crcLength == 4){
+                    finishBinary();
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return used;
+}
+
+bool MessageParser::getInt(uint8_t field, int32_t* value){
+    if(!available() || field >= this->fieldCount){
+        return false;
+    }
+    if(this->type == MESSAGE_BINARY){
+        if(field != 0){
+            return false;
+        }
+        *value = this->buffer[0];
+        return true;
+    }
+    // strtol would also take spaces and a + and needs the locale, so do the digits here
+    const uint8_t* text = &this->buffer[this->fieldStart[field]];
+    uint16_t length = this->fieldLength[field];
+    bool negative = length > 0 && text[0] == '-';
+    uint16_t i = negative ? 1 : 0;
+    if(i == length){
+        return false;
+    }
+    int64_t parsed = 0;
+    for(; i < length; i++){
+        uint8_t digit = text[i] - '0';
+        if(digit > 9){
+            return false;
+        }
+        parsed = parsed * 10 + digit;
+        if(parsed > (int64_t)INT32_MAX + 1){
+            return false;
+        }
+    }
+    if(negative){
+        parsed = -parsed;
+    }
+    if(parsed > INT32_MAX){
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+bool MessageParser::getFloat(uint8_t field, float* value){
+    if(!available() || field >= this->fieldCount || this->type != MESSAGE_TEXT){
+        return false;
+    }
+    const char* text = (const char*)&this->buffer[this->fieldStart[field]];
+    char* end;
+    float parsed = strtof(text, &end);
+    if(this->fieldLength[field] == 0 || *end != '\0'){
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+const char* MessageParser::getString(uint8_t field, uint16_t* length){
+    if(!available() || field >= this->fieldCount || this->type != MESSAGE_TEXT){
+        return nullptr;
+    }
+    if(length != nullptr){
+        *length = this->fieldLength[field];
+    }
+    return (const char*)&this->buffer[this->fieldStart[field]];
+}
+
+const uint8_t* MessageParser::getBlob(uint8_t field, uint16_t* length){
+    if(!available() || field >= this->fieldCount){
+        return nullptr;
+    }
+    *length = this->fieldLength[field];
+    return &this->buffer[this->fieldStart[field]];
+}
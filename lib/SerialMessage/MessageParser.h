@@ -0,0 +1,165 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Splits a byte stream into command messages without copying or tokenizing them.
+ * This has no Arduino dependencies so it can be benchmarked and fuzzed on a computer. See Scripts/message_parser_bench.cpp
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Two kinds of messages can arrive on the same stream:
+ * Text: !field,field,...; Fields can't hold '!', ',' or ';'. Bytes outside a message are ignored and a '!' always
+ * starts a new message, so the parser finds its place again after noise
+ * Binary: MESSAGE_BINARY_START, payload length u16 little endian, payload, CRC-32 of the payload u32 little endian.
+ * The first payload byte is the command and the rest is a blob, so field 0 is the command and field 1 the blob
+ * A message that doesn't fit or fails its CRC is dropped and counted as an error. The rest of a text message that
+ * doesn't fit is thrown away too, so none of it can be mistaken for the start of a binary message.
+ * If the receiver loses bytes, resync drops the message they were part of and waits for the next start
+ */
+#define MESSAGE_MAX_LENGTH 128
+#define MESSAGE_MAX_FIELDS 16
+#define MESSAGE_BINARY_START 0x02
+#define MESSAGE_TEXT_START '!'
+#define MESSAGE_TEXT_END ';'
+#define MESSAGE_TEXT_SEPARATOR ','
+
+typedef enum{
+    MESSAGE_NONE,
+    MESSAGE_TEXT,
+    MESSAGE_BINARY
+}MessageType;
+
+class MessageParser{
+    public:
+        MessageParser() = default;
+        ~MessageParser() = default;
+
+        /**
+         * @brief parse received bytes. Stops as soon as a message is complete so the rest can be fed after it is handled
+         * @param data the received bytes
+         * @param length the number of bytes
+         * @returns the number of bytes used. Less than length if a message completed, 0 while a message is waiting
+         */
+        size_t feed(const uint8_t* data, size_t length);
+
+        /**
+         * @brief returns true if a complete message is waiting to be handled
+         */
+        bool available(){return state == PARSE_READY;};
+
+        /**
+         * @brief finish with the current message so the next one can be parsed. Its fields are invalid after this
+         */
+        void next();
+
+        /**
+         * @brief drop the message being parsed because some of its bytes were lost, and wait for the next start
+         * delimiter. A complete message waiting to be handled is kept
+         */
+        void resync();
+
+        /**
+         * @brief get the kind of the current message, MESSAGE_NONE if there isn't one
+         */
+        MessageType getType(){return available() ? type : MESSAGE_NONE;};
+
+        /**
+         * @brief get the number of fields in the current message. !; has none
+         */
+        uint8_t getFieldCount(){return available() ? fieldCount : 0;};
+
+        /**
+         * @brief read a field as a whole number
+         * @param field the field index
+         * @param value where to put the number
+         * @returns false if the field doesn't exist or isn't a whole number
+         */
+        bool getInt(uint8_t field, int32_t* value);
+
+        /**
+         * @brief read a field as a decimal number
+         * @returns false if the field doesn't exist or isn't a number
+         */
+        bool getFloat(uint8_t field, float* value);
+
+        /**
+         * @brief get a text field in place. The string ends with a 0 and stays valid until next()
+         * @param field the field index
+         * @param length where to put the length of the string. May be nullptr
+         * @returns the string or nullptr if the field doesn't exist or is binary
+         */
+        const char* getString(uint8_t field, uint16_t* length = nullptr);
+
+        /**
+         * @brief get the raw bytes of a field in place. They stay valid until next()
+         * @param field the field index
+         * @param length where to put the number of bytes
+         * @returns the bytes or nullptr if the field doesn't exist
+         */
+        const uint8_t* getBlob(uint8_t field, uint16_t* length);
+
+        /**
+         * @brief get the number of messages parsed
+         */
+        uint32_t getMessageCount(){return messages;};
+
+        /**
+         * @brief get the number of messages dropped because they were too long, had too many fields or failed their CRC
+         */
+        uint32_t getErrorCount(){return errors;};
+
+    private:
+        typedef enum{
+            PARSE_IDLE,
+            PARSE_TEXT,
+            PARSE_DISCARD,
+            PARSE_LENGTH_LOW,
+            PARSE_LENGTH_HIGH,
+            PARSE_PAYLOAD,
+            PARSE_CRC,
+            PARSE_READY
+        }ParseState;
+
+        ParseState state = PARSE_IDLE;
+        MessageType type = MESSAGE_NONE;
+        // text fields are ended with a 0 in place, so there is room for one more byte than the longest message
+        uint8_t buffer[MESSAGE_MAX_LENGTH + 1];
+        uint16_t length = 0;
+        uint16_t expectedLength = 0;
+        uint8_t crcBytes[4];
+        uint8_t crcLength = 0;
+        uint16_t fieldStart[MESSAGE_MAX_FIELDS];
+        uint16_t fieldLength[MESSAGE_MAX_FIELDS];
+        uint8_t fieldCount = 0;
+        uint32_t messages = 0;
+        uint32_t errors = 0;
+
+        /**
+         * @brief start a new message in state
+         */
+        void start(ParseState newState);
+
+        /**
+         * @brief drop the message being parsed
+         */
+        void drop();
+
+        /**
+         * @brief drop the text message being parsed along with the rest of it, up to its ';' or the next '!'
+         */
+        void discard();
+
+        /**
+         * @brief end the text field being parsed
+         * @returns false if there are too many fields
+         */
+        bool endField();
+
+        /**
+         * @brief check the CRC of a binary message and split it into fields
+         */
+        void finishBinary();
+};
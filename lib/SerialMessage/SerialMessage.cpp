@@ -5,6 +5,7 @@
 */
 
 #include "SerialMessage.h"
+#include "esp_timer.h"
 
 SerialMessage::SerialMessage(HardwareSerial *serial) :
     serial(serial){}
@@ -13,65 +14,121 @@ void SerialMessage::init(unsigned int baud_rate){
     serial->begin(baud_rate);
 }
 
-void SerialMessage::readSerial(){
-    char c;
-
-    // read the incoming serial data:
-    while (serial->available() > 0 && data_recieved == false) {
-        // get the neext character in the serial buffer
-        c = serial->read();
-        // only execute this if the startMarker has been received
-        // if the incoming character is the endMarker clean up and set the flags
-        if (recvInProgress == true) {
-            if (c == endMarker) {
-                data[ndx] = '\0'; // terminate the string
-                recvInProgress = false;
-                ndx = 0;
-                data_recieved = true;
-            }
-            // if the incoming character is not the endMarker
-            else {
-                // add it to the data array
-                data[ndx] = c;
-                ndx++; // increment the data array index
-                // if the index is greater than the maximum data array size,
-                // keep overwriting the last element until the endMarker is received.
-                if (ndx >= num_chars) {
-                    ndx = num_chars - 1;
-                }
-            }
+void SerialMessage::notifyOnReceive(TaskHandle_t task){
+    // the callback runs in the UART driver's event task when bytes arrive or the line goes idle
+    serial->onReceive([task](){
+        xTaskNotifyGive(task);
+    });
+    // the driver drops bytes when its buffer fills. This runs in the same task, and the bytes still buffered were
+    // received before the loss, so it lands there give or take what was read meanwhile
+    serial->onReceiveError([this](hardwareSerial_error_t error){
+        if(error == UART_BUFFER_FULL_ERROR || error == UART_FIFO_OVF_ERROR){
+            markLost(this->rxCount + this->serial->available());
         }
-        // if the incoming character is the startMarker, set the recvInProgress flag
-        else if (c == startMarker) {
-            recvInProgress = true;
+    });
+}
+
+size_t SerialMessage::readBytes(uint8_t* buffer, size_t length){
+    int available = serial->available();
+    if(available <= 0){
+        return 0;
+    }
+    if((size_t)available < length){
+        length = available;
+    }
+    return serial->read(buffer, length);
+}
+
+void SerialMessage::parseData(){
+    // commands only take whole numbers. The args stop at the first field that isn't one,
+    // so a command sees a bad number as a missing arg instead of a 0
+    this->populated_args = 0;
+    if(parser.getType() == MESSAGE_BINARY){
+        // a binary message is the command byte and then each arg as an int32 little endian
+        int32_t command;
+        parser.getInt(0, &command);
+        this->args[this->populated_args++] = command;
+        uint16_t length = 0;
+        const uint8_t* blob = parser.getBlob(1, &length);
+        for(uint16_t i = 0; blob != nullptr && i + 4 <= length && this->populated_args < args_length; i += 4){
+            this->args[this->populated_args++] = (int32_t)((uint32_t)blob[i] | ((uint32_t)blob[i + 1] << 8) |
+                ((uint32_t)blob[i + 2] << 16) | ((uint32_t)blob[i + 3] << 24));
         }
+        return;
+    }
+    int32_t value;
+    for(uint8_t i = 0; i < parser.getFieldCount() && parser.getInt(i, &value); i++){
+        this->args[this->populated_args++] = value;
     }
 }
 
-void SerialMessage::parseData() {      // split the data into its parts
-    this->populated_args = 0; // reset the populated args counter
-    char * indx; // this is used by strtok() as an index
-    int i = 0;
-    indx = strtok(temp_data, ",");      // get the first part - the string
-    while(indx != NULL){
-        this->args[i] = atoi(indx);
-        populated_args++;
-        i++;
-        indx = strtok(NULL, ","); // this continues where the previous call left off
+void SerialMessage::markLost(uint32_t position){
+    portENTER_CRITICAL(&lossLock);
+    if(!lossPending){
+        lossStart = position;
+        lossPending = true;
     }
+    lossEnd = position;
+    portEXIT_CRITICAL(&lossLock);
+}
+
+size_t SerialMessage::readChunk(){
+    size_t length = SERIAL_READ_CHUNK;
+    while(lossPending){
+        uint32_t start = lossStart;
+        if((int32_t)(start - rxCount) > 0){
+            // stop at the loss so the bytes before it still finish their message
+            if(start - rxCount < length){
+                length = start - rxCount;
+            }
+            break;
+        }
+        parser.resync();
+        uint32_t end = lossEnd;
+        while((int32_t)(end - rxCount) > 0){
+            size_t skip = end - rxCount < SERIAL_READ_CHUNK ? end - rxCount : SERIAL_READ_CHUNK;
+            size_t count = readBytes(rxBuffer, skip);
+            if(count == 0){
+                // not here yet. The parser is already waiting for a start, so this picks up where it left off
+                return 0;
+            }
+            rxCount += count;
+        }
+        portENTER_CRITICAL(&lossLock);
+        if(lossEnd == end){
+            lossPending = false;
+        }
+        else{
+            // lost more while skipping
+            lossStart = end;
+        }
+        portEXIT_CRITICAL(&lossLock);
+    }
+    size_t count = readBytes(rxBuffer, length);
+    rxCount += count;
+    return count;
 }
 
 void SerialMessage::update(){
-    readSerial();
-    if (data_recieved == true) {
-        strcpy(temp_data, data);
-        // this temporary copy is necessary to protect the original data
-        //   because strtok() used in parseData() replaces the commas with \0
-        parseData();
-        //printArgs();
-        data_recieved = false;
-        new_data = true;
+    // the last message hasn't been handled yet
+    if(new_data){
+        return;
+    }
+    while(!parser.available()){
+        if(rxStart == rxEnd){
+            rxStart = 0;
+            rxEnd = readChunk();
+            if(rxEnd == 0){
+                return;
+            }
+        }
+        // the parser stops at the end of a message, so the rest waits here for the next update
+        rxStart += parser.feed(&rxBuffer[rxStart], rxEnd - rxStart);
     }
+    // stamped as soon as the message is found, before any command runs
+    receivedTime = esp_timer_get_time();
+    parseData();
+    new_data = true;
 }
 
 bool SerialMessage::isNewData(){
@@ -80,6 +137,7 @@ bool SerialMessage::isNewData(){
 
 void SerialMessage::clearNewData(){
     new_data = false;
+    parser.next();
 }
 
 int * SerialMessage::getArgs(){
@@ -94,6 +152,14 @@ int SerialMessage::getPopulatedArgs(){
     return populated_args;
 }
 
+MessageParser* SerialMessage::getParser(){
+    return &parser;
+}
+
+int64_t SerialMessage::getReceivedTime(){
+    return receivedTime;
+}
+
 void SerialMessage::printArgs(){
     serial->print("Current number of args: ");
     serial->println(populated_args);
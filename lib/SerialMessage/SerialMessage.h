@@ -7,8 +7,11 @@
 #pragma once
 
 #include "Arduino.h"
+#include "MessageParser.h"
 
-#define num_chars 50
+// bytes taken from the port in one read
+#define SERIAL_READ_CHUNK 64
+// commands are sent as !<command>,<arg>,...; or as a binary message with a CRC. See MessageParser.h
 // define some constants
 #define IMU_READ 0
 // when you recieve a message with the first arg of 0, you know it's an IMU_READ message
@@ -19,6 +22,62 @@
 #define TENSION_WRITE 5
 #define IMPACT_READ 6
 #define IMPACT_WRITE 7
+// the commands below reply with !OK,<command>; when they succeed or !ERR,<command>,<reason>; when they don't.
+// Anything they print comes before the reply
+// !8; prints the session and current player exposure. !8,<player>; prints one player
+#define EXPOSURE_READ 8
+// !9; starts a new exposure session. !9,<player>; clears one player's totals
+#define EXPOSURE_RESET 9
+// !10,<player>; sets the player that is being hit
+#define PLAYER_SELECT 10
+// !11; prints the SD writer block usage and overruns
+#define SD_WRITER_STATS 11
+// !12; prints the SD rows written, samples dropped per stream and SD operation latency histograms
+#define SD_STATS 12
+// !13; tests the SD card at each SPI clock and keeps the fastest one that works. It runs on the SD task once no
+// recording is in progress and replies when it is done. The open session container is finished first
+#define SD_AUTOTUNE 13
+// !14; lists the live streams sent to the port the command came from. !14,<stream>,<n>; sends every nth sample
+// of a stream to that port, 0 turns it off
+#define LIVE_STREAM 14
+// !15,<baud>; changes the serial baud rate, up to 2000000. The !OK is sent at the old rate
+#define TELEMETRY_BAUD_SET 15
+// !16; prints how many times each lock was taken and how long it was waited for and held, see InstrumentedLock.h,
+// then how long the print task held the locks for each stream it printed. !16,1; clears them
+#define PRINT_LOCK_STATS 16
+// !17; prints every setting as !Config,<id>,<name>,<value>,<min>,<max>,<default>,<needs restart>;. !17,<id>; prints one
+#define CONFIG_GET 17
+// !18,<id>,<value>; changes a setting until the next restart
+#define CONFIG_SET 18
+// !19; saves the settings to flash. !19,1; puts every setting back to its default
+#define CONFIG_SAVE 19
+// !20,1; starts recording and keeps going until !20,0;
+#define RECORD 20
+// !21; prints !Status,<uptime ms>,<recording>,<manual recording>,<impact>,<concussion>,<peak mg>,<risk permille>,<file number>,<startup errors>,<free heap>;
+#define STATUS 21
+// !22; restarts the device so settings that need a restart take effect
+#define RESTART 22
+// !23; lists the files on the SD card as !File,<index>,<name>,<size>,<crc32>; and then !FileListEnd,<count>;
+#define FILE_LIST 23
+// !24,<index>,<offset>,<crc>; sends a file from the last list in binary chunk frames, starting at offset. crc is the
+// CRC-32 of the bytes before offset as a signed int, so a resumed download doesn't read them again. See Scripts/log_download.py
+#define FILE_GET 24
+// !25; stops the file transfer that is running
+#define FILE_CANCEL 25
+// !26; prints the impact summaries sent over Bluetooth as !ImpactSummaries,<sent>,<waiting>,<dropped>,<frames>,<failed writes>;
+#define IMPACT_SUMMARY_STATS 26
+// !27,<bytes per second>; limits the live streams sent to the port the command came from. 0 removes the limit
+#define LIVE_RATE_LIMIT 27
+// !28,<seq>,<host s>,<host us>; starts a clock sync exchange with the host's Unix time split into seconds and us.
+// The reply is !Sync,<seq>; on the same port instead of !OK. !28; prints the clock. See SyncClock.h and Scripts/time_sync.py
+#define TIME_SYNC 28
+// !29,<seq>,<host s>,<host us>; finishes the exchange with the time the host got !Sync. The reply is
+// !SyncResult,<seq>,<offset us>,<round trip us>,<error bound us>,<prediction error us>,<drift ppb>,<clock error bound us>;
+#define TIME_SYNC_RESULT 29
+// !30; prints !Task,<name>,<period us>,<deadline us>,<passes>,<misses>,<skipped>,<lateness p99 us>,<lateness max us>,<response p99 us>,<response max us>,
+// <jitter p99 us>,<jitter max us>;
+// for each periodic task and then !Stack,<name>,<core>,<priority>,<unused stack bytes>; for every task. !30,1; clears the task stats
+#define TASK_STATS 30
 
 class SerialMessage{
     public:
@@ -32,6 +91,13 @@ class SerialMessage{
          */
         virtual void init(unsigned int baud_rate = 115200);
 
+        /**
+         * @brief Wake a task whenever bytes arrive so it can sleep in ulTaskNotifyTake instead of polling update.
+         * Bytes the driver drops are noted too, so update drops the message they cut
+         * @param task the task to notify
+         */
+        virtual void notifyOnReceive(TaskHandle_t task);
+
         /**
          * @brief Update the SerialMessage object and parse any data that's available
          */
@@ -66,27 +132,66 @@ class SerialMessage{
          */
         int getPopulatedArgs();
 
+        /**
+         * @brief Get the parser so a command can read its fields as other types, like getFloat or getString.
+         * The current message stays valid until clearNewData
+         * @return the parser
+         */
+        MessageParser* getParser();
+
+        /**
+         * @brief Get when the current message finished arriving, for commands that need to know exactly
+         * @return the time from esp_timer_get_time in us
+         */
+        int64_t getReceivedTime();
+
         /**
          * @brief Prints the args array to the serial monitor
          */
         virtual void printArgs();
 
     protected:
-        virtual void readSerial();
+        /**
+         * @brief read the bytes that have arrived without waiting for more
+         * @param buffer where to put the bytes
+         * @param length the most bytes to read
+         * @return the number of bytes read
+         */
+        virtual size_t readBytes(uint8_t* buffer, size_t length);
+
+        /**
+         * @brief fill the args array from the message the parser found
+         */
         void parseData();
 
+        /**
+         * @brief note that received bytes were lost. Safe to call from the receive callbacks
+         * @param position how many bytes had been received before the loss
+         */
+        void markLost(uint32_t position);
+
         bool new_data = false;
-        bool data_recieved = false;
-        bool recvInProgress = false;
-        char data[num_chars]; // an array to store the received data
-        char temp_data[num_chars]; // an array that will be used with strtok()
-        uint8_t ndx = 0;
-        const static int args_length = 30;
+        MessageParser parser;
+        uint8_t rxBuffer[SERIAL_READ_CHUNK]; // bytes read but not parsed yet
+        size_t rxStart = 0;
+        size_t rxEnd = 0;
+        const static int args_length = MESSAGE_MAX_FIELDS;
         int populated_args = 0; // the number of args that have been populated for the current message
         int args[args_length];
-        const char startMarker = '!';
-        const char endMarker = ';';
+        int64_t receivedTime = 0; // when the current message was parsed
+        uint32_t rxCount = 0; // bytes read since init, which places the losses in the stream
     
     private:
+        /**
+         * @brief read the next bytes into rxBuffer. When it reaches a loss the parser drops the message it cut,
+         * and any bytes up to the last loss are thrown away, since more could be missing from them
+         * @return the number of bytes read
+         */
+        size_t readChunk();
+
         HardwareSerial *serial;
+        portMUX_TYPE lossLock = portMUX_INITIALIZER_UNLOCKED;
+        volatile bool lossPending = false;
+        volatile uint32_t lossStart = 0; // the first loss that hasn't been reached yet
+        volatile uint32_t lossEnd = 0; // the last one
 };
\ No newline at end of file
@@ -0,0 +1,68 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief A mutex that keeps count of how long tasks wait for it and how long they hold it
+*/
+
+#include "InstrumentedLock.h"
+
+InstrumentedLock::InstrumentedLock(const char* name){
+    this->name = name;
+    this->handle = xSemaphoreCreateMutex();
+}
+
+void InstrumentedLock::take(){
+    unsigned long start = micros();
+    // try without waiting first so a wait can be told apart from a lock that was free
+    bool wasFree = xSemaphoreTake(this->handle, 0) == pdTRUE;
+    if(!wasFree){
+        xSemaphoreTake(this->handle, portMAX_DELAY);
+    }
+    unsigned long now = micros();
+    this->acquisitions++;
+    if(!wasFree){
+        this->contended++;
+    }
+    this->waits.record(now - start);
+    this->takenAt = now;
+}
+
+void InstrumentedLock::give(){
+    this->holds.record(micros() - this->takenAt);
+    xSemaphoreGive(this->handle);
+}
+
+void InstrumentedLock::print(Print* out){
+    take();
+    uint32_t acquisitions = this->acquisitions;
+    uint32_t contended = this->contended;
+    LatencyHistogram waits = this->waits;
+    LatencyHistogram holds = this->holds;
+    give();
+
+    out->print("!Lock,");
+    out->print(this->name);
+    out->print(",");
+    out->print(acquisitions);
+    out->print(",");
+    out->print(contended);
+    out->print(",");
+    out->print(waits.percentile(0.99));
+    out->print(",");
+    out->print(holds.percentile(0.99));
+    out->println(";");
+    String histogramName = String(this->name) + "Wait";
+    waits.print(out, histogramName.c_str());
+    histogramName = String(this->name) + "Hold";
+    holds.print(out, histogramName.c_str());
+}
+
+void InstrumentedLock::reset(){
+    take();
+    this->acquisitions = 0;
+    this->contended = 0;
+    this->waits.reset();
+    this->holds.reset();
+    // giving the lock back records this hold as the first one after the reset
+    give();
+}
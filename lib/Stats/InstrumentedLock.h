@@ -0,0 +1,57 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief A mutex that keeps count of how long tasks wait for it and how long they hold it
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include "LatencyHistogram.h"
+
+class InstrumentedLock{
+    public:
+        /**
+         * @brief create the lock
+         * @param name printed with the stats. Must outlive the lock
+         */
+        InstrumentedLock(const char* name);
+        ~InstrumentedLock() = default;
+
+        /**
+         * @brief wait for the lock and take it. Not recursive, a task must give the lock before taking it again
+         */
+        void take();
+
+        /**
+         * @brief give the lock back
+         * @pre the calling task holds the lock
+         */
+        void give();
+
+        /**
+         * @brief print the stats in the form !Lock,<name>,<acquisitions>,<contended>,<wait p99 us>,<hold p99 us>;
+         * followed by the wait and hold histograms as !Latency,<name>Wait,...; and !Latency,<name>Hold,...;
+         * The stats are copied under the lock and printed after, so a slow port doesn't hold it
+         * @param out where to print the stats
+         */
+        void print(Print* out);
+
+        /**
+         * @brief clear the stats
+         */
+        void reset();
+
+        const char* getName(){return name;};
+
+    private:
+        const char* name;
+        SemaphoreHandle_t handle;
+        // everything below is only changed while the lock is held
+        uint32_t acquisitions = 0;
+        // acquisitions that found the lock already taken
+        uint32_t contended = 0;
+        LatencyHistogram waits;
+        LatencyHistogram holds;
+        unsigned long takenAt = 0;
+};
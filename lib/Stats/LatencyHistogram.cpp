@@ -0,0 +1,64 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Counts how long an operation takes in power of two microsecond buckets
+*/
+
+#include "LatencyHistogram.h"
+
+uint8_t LatencyHistogram::bucketFor(uint32_t micros){
+    uint8_t bucket = 0;
+    while(micros > 1 && bucket < LATENCY_BUCKETS - 1){
+        micros >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void LatencyHistogram::record(uint32_t micros){
+    this->count++;
+    this->total += micros;
+    if(micros > this->maxMicros){
+        this->maxMicros = micros;
+    }
+    this->buckets[bucketFor(micros)]++;
+}
+
+void LatencyHistogram::reset(){
+    this->count = 0;
+    this->maxMicros = 0;
+    this->total = 0;
+    memset(this->buckets, 0, sizeof(this->buckets));
+}
+
+uint32_t LatencyHistogram::percentile(float fraction){
+    if(this->count == 0){
+        return 0;
+    }
+    uint32_t target = ceil(fraction * this->count);
+    uint32_t seen = 0;
+    for(uint8_t i = 0; i < LATENCY_BUCKETS - 1; i++){
+        seen += this->buckets[i];
+        if(seen >= target){
+            // bucket i ends just before 2^(i+1)
+            return min((uint32_t)((2UL << i) - 1), this->maxMicros);
+        }
+    }
+    return this->maxMicros;
+}
+
+void LatencyHistogram::print(Print* out, const char* name){
+    out->print("!Latency,");
+    out->print(name);
+    out->print(",");
+    out->print(this->count);
+    out->print(",");
+    out->print(this->maxMicros);
+    out->print(",");
+    out->print(getMean());
+    for(uint8_t i = 0; i < LATENCY_BUCKETS; i++){
+        out->print(",");
+        out->print(this->buckets[i]);
+    }
+    out->println(";");
+}
@@ -0,0 +1,60 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Counts how long an operation takes in power of two microsecond buckets
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+// bucket 0 holds 0-1us, bucket i holds 2^i to 2^(i+1)-1 us and the last bucket holds everything from 32.768ms up
+#define LATENCY_BUCKETS 16
+
+class LatencyHistogram{
+    public:
+        LatencyHistogram() = default;
+        ~LatencyHistogram() = default;
+
+        /**
+         * @brief add one measurement
+         * @param micros how long the operation took in microseconds
+         */
+        void record(uint32_t micros);
+
+        /**
+         * @brief clear every measurement
+         */
+        void reset();
+
+        uint32_t getCount(){return count;};
+        uint32_t getMax(){return maxMicros;};
+        uint32_t getMean(){return count == 0 ? 0 : total / count;};
+        uint32_t getBucket(uint8_t bucket){return bucket < LATENCY_BUCKETS ? buckets[bucket] : 0;};
+
+        /**
+         * @brief estimate a percentile of the measurements
+         * @param fraction the percentile as a fraction, 0.99 for the 99th percentile
+         * @returns the upper edge of the bucket the percentile falls in, in microseconds. Never more than the max
+         */
+        uint32_t percentile(float fraction);
+
+        /**
+         * @brief print the histogram in the form !Latency,<name>,<count>,<max us>,<mean us>,<bucket 0>,...,<bucket 15>;
+         * @param out where to print the histogram
+         * @param name what was measured
+         */
+        void print(Print* out, const char* name);
+
+        /**
+         * @brief get the bucket a measurement goes in
+         * @param micros the measurement in microseconds
+         */
+        static uint8_t bucketFor(uint32_t micros);
+
+    private:
+        uint32_t count = 0;
+        uint32_t maxMicros = 0;
+        uint64_t total = 0;
+        uint32_t buckets[LATENCY_BUCKETS] = {0};
+};
@@ -0,0 +1,108 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Keeps a periodic task on its period and counts the passes that start late or miss their deadline
+*/
+
+#include "TaskMonitor.h"
+
+TaskMonitor::TaskMonitor(const char* name){
+    this->name = name;
+}
+
+void TaskMonitor::setPeriod(uint32_t periodMicros, uint32_t deadlineMicros){
+    // the first interval at a new period isn't a period of either kind
+    if(periodMicros != this->periodMicros){
+        this->haveLastStart = false;
+    }
+    this->periodMicros = periodMicros;
+    this->deadlineMicros = deadlineMicros == 0 ? periodMicros : deadlineMicros;
+}
+
+void TaskMonitor::begin(unsigned long release, uint32_t skipped){
+    this->release = release;
+    this->skipped += skipped;
+    unsigned long now = micros();
+    long late = (long)(now - release);
+    // a tick can end a little before the release it was meant for
+    this->lateness.record(late > 0 ? late : 0);
+    // a skipped release is already counted, so the gap over it isn't jitter
+    if(this->haveLastStart && skipped == 0){
+        long interval = (long)(now - this->lastStart);
+        long error = interval - (long)this->periodMicros;
+        this->jitter.record(error >= 0 ? error : -error);
+    }
+    this->lastStart = now;
+    this->haveLastStart = true;
+}
+
+void TaskMonitor::end(){
+    long since = (long)(micros() - this->release);
+    uint32_t took = since > 0 ? since : 0;
+    this->passes++;
+    this->response.record(took);
+    if(took > this->deadlineMicros){
+        this->misses++;
+    }
+}
+
+void TaskMonitor::delayUntilNext(){
+    TickType_t periodTicks = max((TickType_t)1, (TickType_t)pdMS_TO_TICKS(this->periodMicros / 1000));
+    if(!this->started){
+        // start the schedule on a tick so the releases line up with the wakes
+        vTaskDelay(1);
+        this->lastWake = xTaskGetTickCount();
+        this->started = true;
+        begin(micros());
+        return;
+    }
+    // vTaskDelayUntil returns straight away for a wake time that has passed. Releases a whole period
+    // older than that are skipped instead of run back to back
+    TickType_t now = xTaskGetTickCount();
+    uint32_t skipped = 0;
+    while((TickType_t)(now - this->lastWake) >= 2 * periodTicks){
+        this->lastWake += periodTicks;
+        skipped++;
+    }
+    vTaskDelayUntil(&this->lastWake, periodTicks);
+    begin(this->release + (skipped + 1) * periodTicks * portTICK_PERIOD_MS * 1000, skipped);
+}
+
+void TaskMonitor::print(Print* out){
+    // the counts are single words and the task may be mid pass, so a line can be one pass behind
+    out->print("!Task,");
+    out->print(this->name);
+    out->print(",");
+    out->print(this->periodMicros);
+    out->print(",");
+    out->print(this->deadlineMicros);
+    out->print(",");
+    out->print(this->passes);
+    out->print(",");
+    out->print(this->misses);
+    out->print(",");
+    out->print(this->skipped);
+    out->print(",");
+    out->print(this->lateness.percentile(0.99));
+    out->print(",");
+    out->print(this->lateness.getMax());
+    out->print(",");
+    out->print(this->response.percentile(0.99));
+    out->print(",");
+    out->print(this->response.getMax());
+    out->print(",");
+    out->print(this->jitter.percentile(0.99));
+    out->print(",");
+    out->print(this->jitter.getMax());
+    out->println(";");
+}
+
+void TaskMonitor::reset(){
+    this->passes = 0;
+    this->misses = 0;
+    this->skipped = 0;
+    this->lateness.reset();
+    this->response.reset();
+    this->jitter.reset();
+    this->haveLastStart = false;
+}
@@ -0,0 +1,83 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Keeps a periodic task on its period and counts the passes that start late or miss their deadline
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include "LatencyHistogram.h"
+
+/** Each pass of a task is released once a period and has to finish within the deadline of its release.
+ * Lateness is how long after its release a pass started and response is how long after its release it finished.
+ * A release that came and went while the pass before it was still running is skipped and counted.
+ * Jitter is how far the time between the starts of two passes in a row was from the period.
+ */
+class TaskMonitor{
+    public:
+        /**
+         * @param name printed with the stats. Must outlive the monitor
+         */
+        TaskMonitor(const char* name);
+        ~TaskMonitor() = default;
+
+        /**
+         * @brief set how often the task runs. Can be changed between passes
+         * @param periodMicros time between releases in us
+         * @param deadlineMicros how long after its release a pass has to finish, in us. 0 uses the period
+         */
+        void setPeriod(uint32_t periodMicros, uint32_t deadlineMicros = 0);
+
+        /**
+         * @brief start a pass for a release the caller keeps track of, like a hardware timer
+         * @param release micros() when the pass was released
+         * @param skipped releases since the last pass that never got a pass of their own
+         */
+        void begin(unsigned long release, uint32_t skipped = 0);
+
+        /**
+         * @brief end the pass started by begin or delayUntilNext
+         */
+        void end();
+
+        /**
+         * @brief sleep with vTaskDelayUntil until the next release, then begin its pass. The first call returns at the next tick.
+         * The period is rounded to whole ticks
+         */
+        void delayUntilNext();
+
+        /**
+         * @brief print the stats in the form
+         * !Task,<name>,<period us>,<deadline us>,<passes>,<misses>,<skipped>,<lateness p99 us>,<lateness max us>,<response p99 us>,<response max us>,
+         * <jitter p99 us>,<jitter max us>;
+         * @param out where to print the stats
+         */
+        void print(Print* out);
+
+        /**
+         * @brief clear the stats
+         */
+        void reset();
+
+        uint32_t getMisses(){return misses;};
+
+    private:
+        const char* name;
+        uint32_t periodMicros = 0;
+        uint32_t deadlineMicros = 0;
+        // the schedule delayUntilNext keeps
+        bool started = false;
+        TickType_t lastWake = 0;
+        // the release of the pass running now
+        unsigned long release = 0;
+        // when the last pass started, for the jitter
+        unsigned long lastStart = 0;
+        bool haveLastStart = false;
+        uint32_t passes = 0;
+        uint32_t misses = 0;
+        uint32_t skipped = 0;
+        LatencyHistogram lateness;
+        LatencyHistogram response;
+        LatencyHistogram jitter;
+};
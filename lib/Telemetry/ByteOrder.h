@@ -0,0 +1,44 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Reads and writes values in little endian order, the byte order of every frame and log the system sends.
+ * The put helpers return a pointer just past the value they wrote
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+static inline uint8_t* putUInt16(uint8_t* buffer, uint16_t value){
+    buffer[0] = value & 0xFF;
+    buffer[1] = (value >> 8) & 0xFF;
+    return buffer + 2;
+}
+
+static inline uint8_t* putUInt32(uint8_t* buffer, uint32_t value){
+    buffer[0] = value & 0xFF;
+    buffer[1] = (value >> 8) & 0xFF;
+    buffer[2] = (value >> 16) & 0xFF;
+    buffer[3] = (value >> 24) & 0xFF;
+    return buffer + 4;
+}
+
+static inline uint8_t* putInt64(uint8_t* buffer, int64_t value){
+    putUInt32(buffer, (uint64_t)value & 0xFFFFFFFF);
+    return putUInt32(buffer + 4, (uint64_t)value >> 32);
+}
+
+static inline uint8_t* putFloat(uint8_t* buffer, float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return putUInt32(buffer, bits);
+}
+
+static inline uint16_t getUInt16(const uint8_t* buffer){
+    return buffer[0] | (buffer[1] << 8);
+}
+
+static inline uint32_t getUInt32(const uint8_t* buffer){
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
@@ -0,0 +1,27 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Consistent overhead byte stuffing, so frames can be separated by zero bytes. Scripts/telemetry.py undoes it
+*/
+
+#include "COBS.h"
+
+size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out){
+    // each run of up to 254 non zero bytes is sent after a byte holding the distance to the next zero
+    size_t codeIndex = 0;
+    size_t outIndex = 1;
+    uint8_t code = 1;
+    for(size_t i = 0; i < length; i++){
+        if(in[i] != 0){
+            out[outIndex++] = in[i];
+            code++;
+        }
+        if(in[i] == 0 || code == 0xFF){
+            out[codeIndex] = code;
+            code = 1;
+            codeIndex = outIndex++;
+        }
+    }
+    out[codeIndex] = code;
+    return outIndex;
+}
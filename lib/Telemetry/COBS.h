@@ -0,0 +1,19 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Consistent overhead byte stuffing, so frames can be separated by zero bytes. Scripts/telemetry.py undoes it
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief COBS encode a buffer so it contains no zeros
+ * @param in the data to encode
+ * @param length the number of bytes in in
+ * @param out where to put the encoded data. Must hold length + length / 254 + 1 bytes
+ * @returns the number of bytes written to out
+ */
+size_t cobsEncode(const uint8_t* in, size_t length, uint8_t* out);
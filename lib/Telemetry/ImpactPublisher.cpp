@@ -0,0 +1,98 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Sends a short summary of each impact to the sideline. Impacts that arrive close together go out in one
+ * frame and one write, and impacts are kept until a client connects.
+ * This has no Arduino dependencies so it can be tested on a computer. See Scripts/impact_publisher_loopback.cpp
+*/
+
+#include "ImpactPublisher.h"
+#include "CRC32.h"
+#include "COBS.h"
+#include "ByteOrder.h"
+#include <math.h>
+
+// round a value to counts of scale, clamped so an out of range value is obvious instead of wrapping
+static double clampCounts(double value, double scale, double low, double high){
+    double counts = round(value / scale);
+    if(isnan(counts)){
+        return 0;
+    }
+    return counts < low ? low : (counts > high ? high : counts);
+}
+
+ImpactPublisher::ImpactPublisher(ImpactTransport* transport) :
+transport(transport){
+}
+
+void ImpactPublisher::publish(const ImpactSummary& summary, uint32_t now){
+    if(this->count == IMPACT_QUEUE_LENGTH){
+        // keep the newest impacts. The sequence numbers show the host what it missed
+        this->head = (this->head + 1) % IMPACT_QUEUE_LENGTH;
+        this->count--;
+        this->dropped++;
+    }
+    if(this->count == 0){
+        this->firstQueued = now;
+    }
+    size_t tail = (this->head + this->count) % IMPACT_QUEUE_LENGTH;
+    this->queue[tail] = summary;
+    this->sequences[tail] = this->nextSequence++;
+    this->count++;
+}
+
+size_t ImpactPublisher::encodeFrame(uint8_t summaries, uint8_t* out){
+    uint8_t frame[IMPACT_MAX_FRAME];
+    uint8_t* end = frame;
+    *end++ = TELEMETRY_FRAME_IMPACTS;
+    *end++ = summaries;
+    for(uint8_t i = 0; i < summaries; i++){
+        size_t index = (this->head + i) % IMPACT_QUEUE_LENGTH;
+        const ImpactSummary& summary = this->queue[index];
+        end = putUInt32(end, this->sequences[index]);
+        end = putUInt32(end, summary.time);
+        end = putInt64(end, summary.syncedTime);
+        end = putUInt16(end, clampCounts(summary.duration, 1, 0, UINT16_MAX));
+        end = putUInt16(end, clampCounts(summary.peakLinear, 0.1, 0, UINT16_MAX));
+        end = putUInt16(end, clampCounts(summary.peakRotational, 1, 0, UINT16_MAX));
+        end = putUInt16(end, clampCounts(summary.risk, 0.001, 0, 1000));
+        end = putUInt32(end, (uint32_t)(int32_t)clampCounts(summary.peakLeftLoad, 1, INT32_MIN, INT32_MAX));
+        end = putUInt32(end, (uint32_t)(int32_t)clampCounts(summary.peakRightLoad, 1, INT32_MIN, INT32_MAX));
+        double magnitude = sqrt(summary.direction[0] * summary.direction[0] + summary.direction[1] * summary.direction[1] +
+            summary.direction[2] * summary.direction[2]);
+        for(uint8_t axis = 0; axis < 3; axis++){
+            double unit = magnitude > 0 ? summary.direction[axis] / magnitude : 0;
+            *end++ = (uint8_t)(int8_t)clampCounts(unit * 127, 1, -127, 127);
+        }
+    }
+    end = putUInt32(end, crc32(frame, end - frame));
+
+    out[0] = 0;
+    size_t length = cobsEncode(frame, end - frame, out + 1) + 1;
+    out[length++] = 0;
+    return length;
+}
+
+size_t ImpactPublisher::update(uint32_t now){
+    size_t sentNow = 0;
+    // wait for the rest of a burst unless there is already a full frame
+    if(this->count == 0 || (this->count < IMPACT_FRAME_SUMMARIES && now - this->firstQueued < IMPACT_COALESCE_MS)){
+        return 0;
+    }
+    while(this->count > 0 && this->transport->isConnected()){
+        uint8_t summaries = this->count < IMPACT_FRAME_SUMMARIES ? this->count : IMPACT_FRAME_SUMMARIES;
+        uint8_t encoded[IMPACT_MAX_ENCODED];
+        size_t length = encodeFrame(summaries, encoded);
+        if(this->transport->send(encoded, length) != length){
+            // keep them for the next update. The zeros around each frame let the host skip the part that got out
+            this->writeFailures++;
+            break;
+        }
+        this->head = (this->head + summaries) % IMPACT_QUEUE_LENGTH;
+        this->count -= summaries;
+        this->sent += summaries;
+        this->framesSent++;
+        sentNow += summaries;
+    }
+    return sentNow;
+}
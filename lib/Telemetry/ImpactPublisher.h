@@ -0,0 +1,120 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Sends a short summary of each impact to the sideline. Impacts that arrive close together go out in one
+ * frame and one write, and impacts are kept until a client connects.
+ * This has no Arduino dependencies so it can be tested on a computer. See Scripts/impact_publisher_loopback.cpp
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ImpactTransport.h"
+
+/** A frame is laid out like the frames in Telemetry.h: type u8, body, CRC-32 of the type and body u32, COBS encoded
+ * with a zero before and after it. All values are little endian.
+ * TELEMETRY_FRAME_IMPACTS body:
+ * summary count u8, then for each summary, oldest first:
+ * sequence number u32, time ms u32, start time i64 in us since the Unix epoch on the host's clock, 0 if the clock
+ * wasn't synced, duration ms u16, peak linear acceleration 0.1g u16,
+ * peak rotational acceleration u16, risk permille u16, left load cell peak i32, right load cell peak i32,
+ * direction of the peak linear acceleration x, y, z i8 as a unit vector times 127
+ * Values that don't fit are clamped. The sequence number counts every summary published, so the host can spot
+ * summaries that were dropped or sent twice
+ */
+#define TELEMETRY_FRAME_IMPACTS 0x05
+#define IMPACT_SUMMARY_BYTES 35
+// the most summaries in one frame, so a frame fits the same 250 bytes as a telemetry frame
+#define IMPACT_FRAME_SUMMARIES ((250 - 2 - 4) / IMPACT_SUMMARY_BYTES)
+#define IMPACT_MAX_FRAME (2 + IMPACT_FRAME_SUMMARIES * IMPACT_SUMMARY_BYTES + 4)
+// a frame after COBS encoding with the zeros around it
+#define IMPACT_MAX_ENCODED (IMPACT_MAX_FRAME + IMPACT_MAX_FRAME / 254 + 3)
+// summaries kept while no client is connected. The oldest is dropped to make room
+#define IMPACT_QUEUE_LENGTH 32
+// how long the first summary waits for others to share its frame, in ms
+#define IMPACT_COALESCE_MS 50
+
+struct ImpactSummary{
+    uint32_t time = 0; // ms since power up when the impact started
+    int64_t syncedTime = 0; // when the impact started in us since the Unix epoch, 0 if the clock wasn't synced
+    uint32_t duration = 0; // ms the impact stayed over the threshold
+    double peakLinear = 0; // g
+    double peakRotational = 0; // in the head gyro's units, the same value the risk is worked out from
+    double risk = 0; // concussion probability from 0 to 1
+    double peakLeftLoad = 0; // raw load cell readings
+    double peakRightLoad = 0;
+    double direction[3] = {0, 0, 0}; // linear acceleration at the peak. Only the direction is sent
+};
+
+class ImpactPublisher{
+    public:
+        /**
+         * @brief Construct a new Impact Publisher object
+         * @param transport where to send frames
+         */
+        ImpactPublisher(ImpactTransport* transport);
+        ~ImpactPublisher() = default;
+
+        /**
+         * @brief queue a summary to be sent by update
+         * @param summary the impact
+         * @param now the time in ms
+         */
+        void publish(const ImpactSummary& summary, uint32_t now);
+
+        /**
+         * @brief send the queued summaries once a client is connected and the first one has waited IMPACT_COALESCE_MS,
+         * or right away if a frame is full. Each frame is sent with a single write
+         * @param now the time in ms
+         * @returns the number of summaries sent
+         */
+        size_t update(uint32_t now);
+
+        /**
+         * @brief get the number of summaries waiting to be sent
+         */
+        size_t getPending(){return count;};
+
+        /**
+         * @brief get the number of summaries sent
+         */
+        uint32_t getSent(){return sent;};
+
+        /**
+         * @brief get the number of summaries dropped because the queue was full
+         */
+        uint32_t getDropped(){return dropped;};
+
+        /**
+         * @brief get the number of frames sent
+         */
+        uint32_t getFramesSent(){return framesSent;};
+
+        /**
+         * @brief get the number of writes that didn't take the whole frame. Those summaries are sent again
+         */
+        uint32_t getWriteFailures(){return writeFailures;};
+
+    private:
+        ImpactTransport* transport;
+        // a ring of the summaries waiting to be sent
+        ImpactSummary queue[IMPACT_QUEUE_LENGTH];
+        uint32_t sequences[IMPACT_QUEUE_LENGTH];
+        size_t head = 0;
+        size_t count = 0;
+        uint32_t nextSequence = 0;
+        uint32_t firstQueued = 0;
+        uint32_t sent = 0;
+        uint32_t dropped = 0;
+        uint32_t framesSent = 0;
+        uint32_t writeFailures = 0;
+
+        /**
+         * @brief build the frame for the oldest summaries in the queue, ready to send
+         * @param summaries the number of summaries, at most IMPACT_FRAME_SUMMARIES
+         * @param out where to put the frame. Must hold IMPACT_MAX_ENCODED bytes
+         * @returns the number of bytes in the frame
+         */
+        size_t encodeFrame(uint8_t summaries, uint8_t* out);
+};
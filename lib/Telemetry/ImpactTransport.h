@@ -0,0 +1,29 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Where ImpactPublisher sends its frames. BluetoothSerialMessage sends them to the sideline tablet and
+ * Scripts/impact_publisher_loopback.cpp keeps them in memory to check them on a computer
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class ImpactTransport{
+    public:
+        virtual ~ImpactTransport() = default;
+
+        /**
+         * @brief returns true if something is listening. Frames wait in the publisher until it is
+         */
+        virtual bool isConnected() = 0;
+
+        /**
+         * @brief send bytes
+         * @param data the bytes to send
+         * @param length the number of bytes
+         * @returns the number of bytes sent
+         */
+        virtual size_t send(const uint8_t* data, size_t length) = 0;
+};
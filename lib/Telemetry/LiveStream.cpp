@@ -0,0 +1,314 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Forwards samples and events to the hosts as they are acquired. Each stream is published once and sent to every
+ * client that subscribed to it, at the client's own decimation and rate limit
+*/
+
+#include "LiveStream.h"
+
+// the greatest common divisor, where 0 means nothing wants the samples
+static uint16_t gcd(uint16_t a, uint16_t b){
+    while(b != 0){
+        uint16_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+void LiveStream::init(){
+    if(this->queue == nullptr){
+        this->queue = xQueueCreate(LIVE_QUEUE_LENGTH, sizeof(LiveSample));
+    }
+    if(this->lock == nullptr){
+        this->lock = xSemaphoreCreateMutex();
+    }
+}
+
+void LiveStream::lockClients(){
+    if(this->lock != nullptr){
+        xSemaphoreTake(this->lock, portMAX_DELAY);
+    }
+}
+
+void LiveStream::unlockClients(){
+    if(this->lock != nullptr){
+        xSemaphoreGive(this->lock);
+    }
+}
+
+bool LiveStream::registerStream(uint8_t id, const char* name, uint8_t axes, float scale, float sampleRate){
+    if(id >= LIVE_MAX_STREAMS || axes == 0 || axes > 3){
+        return false;
+    }
+    LiveStreamInfo* stream = &this->streams[id];
+    stream->name = name;
+    stream->axes = axes;
+    stream->scale = scale;
+    stream->sampleRate = sampleRate;
+    stream->event = false;
+    for(uint8_t i = 0; i < this->clientCount; i++){
+        this->clients[i].describeNow = true;
+    }
+    return true;
+}
+
+bool LiveStream::registerEvent(uint8_t id, const char* name, uint8_t axes, float scale){
+    if(!this->registerStream(id, name, axes, scale, 0)){
+        return false;
+    }
+    this->streams[id].event = true;
+    return true;
+}
+
+bool LiveStream::addClient(Telemetry* telemetry, uint32_t maxBytesPerSecond){
+    if(this->clientCount >= LIVE_MAX_CLIENTS || telemetry == nullptr){
+        return false;
+    }
+    LiveClient* client = &this->clients[this->clientCount];
+    client->telemetry = telemetry;
+    client->maxBytesPerSecond = maxBytesPerSecond;
+    client->lastRefill = millis();
+    this->clientCount++;
+    return true;
+}
+
+LiveClient* LiveStream::findClient(Telemetry* telemetry){
+    for(uint8_t i = 0; i < this->clientCount; i++){
+        if(this->clients[i].telemetry == telemetry){
+            return &this->clients[i];
+        }
+    }
+    return nullptr;
+}
+
+void LiveStream::updateGate(uint8_t id){
+    uint16_t gate = 0;
+    for(uint8_t i = 0; i < this->clientCount; i++){
+        gate = gcd(gate, this->clients[i].subscriptions[id].decimation);
+    }
+    this->streams[id].gate = gate;
+}
+
+bool LiveStream::subscribe(Telemetry* telemetry, uint8_t id, uint16_t decimation){
+    LiveClient* client = this->findClient(telemetry);
+    if(client == nullptr || id >= LIVE_MAX_STREAMS || this->streams[id].name == nullptr){
+        return false;
+    }
+    this->lockClients();
+    LiveSubscription* subscription = &client->subscriptions[id];
+    if(subscription->decimation != decimation){
+        // the waiting samples were counted at the old decimation, so their indexes don't fit the new one
+        subscription->pendingCount = 0;
+    }
+    subscription->decimation = decimation;
+    this->updateGate(id);
+    // the host needs the new rate before the next samples arrive
+    client->describeNow = true;
+    this->unlockClients();
+    return true;
+}
+
+bool LiveStream::setRateLimit(Telemetry* telemetry, uint32_t maxBytesPerSecond){
+    LiveClient* client = this->findClient(telemetry);
+    if(client == nullptr){
+        return false;
+    }
+    this->lockClients();
+    client->maxBytesPerSecond = maxBytesPerSecond;
+    client->budget = 0;
+    client->lastRefill = millis();
+    this->unlockClients();
+    return true;
+}
+
+void LiveStream::push(uint8_t id, float x, float y, float z){
+    if(this->queue == nullptr || id >= LIVE_MAX_STREAMS){
+        return;
+    }
+    LiveStreamInfo* stream = &this->streams[id];
+    uint32_t index = stream->index++;
+    // read once. A gate that changed between two reads could be 0 by the time of the modulo
+    uint16_t gate = stream->gate;
+    if(gate == 0 || index % gate != 0){
+        return;
+    }
+    LiveSample sample = {id, index, (uint32_t)SyncClock::localTime(), {x, y, z}};
+    // acquisition never waits on the hosts. A full queue shows up as a gap in the index
+    if(xQueueSend(this->queue, &sample, 0) != pdTRUE){
+        this->dropped++;
+    }
+}
+
+void LiveStream::push(uint8_t id, const xyzData* sample){
+    if(sample == nullptr){
+        return;
+    }
+    this->push(id, sample->x, sample->y, sample->z);
+}
+
+void LiveStream::push(uint8_t id, double value){
+    this->push(id, value, 0, 0);
+}
+
+void LiveStream::describe(LiveClient* client){
+    for(uint8_t i = 0; i < LIVE_MAX_STREAMS; i++){
+        LiveStreamInfo* stream = &this->streams[i];
+        uint16_t decimation = client->subscriptions[i].decimation;
+        if(stream->name == nullptr || decimation == 0){
+            continue;
+        }
+        client->telemetry->describe(i, stream->name, stream->axes, stream->scale, stream->sampleRate / decimation);
+    }
+    client->lastDescribe = millis();
+    client->describeNow = false;
+}
+
+void LiveStream::sendPending(LiveClient* client, uint8_t id){
+    LiveSubscription* subscription = &client->subscriptions[id];
+    if(subscription->pendingCount == 0){
+        return;
+    }
+    LiveStreamInfo* stream = &this->streams[id];
+    if(client->maxBytesPerSecond > 0){
+        unsigned long now = millis();
+        int32_t burst = client->maxBytesPerSecond / LIVE_BURST_DIVISOR;
+        int64_t budget = client->budget + (int64_t)(now - client->lastRefill) * client->maxBytesPerSecond / 1000;
+        client->budget = budget > burst ? burst : budget;
+        client->lastRefill = now;
+        if(client->budget <= 0 && !stream->event){
+            // the client is over its limit. The samples are dropped and show up as a gap in the index
+            client->framesLimited++;
+            subscription->pendingCount = 0;
+            return;
+        }
+    }
+    // a backed up client is skipped instead of waiting on it, which would hold up every other client
+    if(client->stalled && millis() - client->stalledAt < LIVE_STALL_BACKOFF_MS){
+        client->framesSkipped++;
+        subscription->pendingCount = 0;
+        return;
+    }
+    client->stalled = false;
+    if(!client->telemetry->hasRoomForSamples(subscription->pendingCount, stream->axes)){
+        client->framesSkipped++;
+        subscription->pendingCount = 0;
+        return;
+    }
+    int64_t time = this->clock == nullptr ? 0 : this->clock->toHostTime(subscription->pendingTime);
+    unsigned long start = micros();
+    uint32_t frameBytes = 0;
+    client->telemetry->sendSamples(id, subscription->pendingIndex, time, subscription->pending, subscription->pendingCount, stream->axes, stream->scale, &frameBytes);
+    if(micros() - start >= LIVE_STALL_US){
+        client->stalled = true;
+        client->stalledAt = millis();
+    }
+    // only this frame counts, file chunks sent on the same telemetry don't use up the budget
+    client->budget -= frameBytes;
+    subscription->pendingCount = 0;
+}
+
+void LiveStream::addSample(LiveClient* client, uint8_t id, const LiveSample* sample, int64_t time){
+    LiveSubscription* subscription = &client->subscriptions[id];
+    uint16_t decimation = subscription->decimation;
+    if(decimation == 0 || sample->index % decimation != 0){
+        return;
+    }
+    uint8_t axes = this->streams[id].axes;
+    uint32_t index = sample->index / decimation;
+    // a frame holds consecutive samples, so a gap starts a new one
+    if(subscription->pendingCount > 0 && index != subscription->pendingIndex + subscription->pendingCount){
+        this->sendPending(client, id);
+    }
+    if(subscription->pendingCount == 0){
+        subscription->pendingIndex = index;
+        subscription->pendingSince = millis();
+        subscription->pendingTime = time;
+    }
+    memcpy(&subscription->pending[subscription->pendingCount * axes], sample->values, axes * sizeof(float));
+    subscription->pendingCount++;
+    if(subscription->pendingCount >= LIVE_FRAME_SAMPLES || this->streams[id].event){
+        this->sendPending(client, id);
+    }
+}
+
+void LiveStream::update(){
+    if(this->queue == nullptr){
+        delay(LIVE_MAX_LATENCY_MS);
+        return;
+    }
+    LiveSample sample;
+    // wait for samples before taking the lock so commands aren't held up by an idle stream
+    bool received = xQueueReceive(this->queue, &sample, pdMS_TO_TICKS(LIVE_MAX_LATENCY_MS)) == pdTRUE;
+    this->lockClients();
+    for(uint8_t i = 0; i < this->clientCount; i++){
+        LiveClient* client = &this->clients[i];
+        if(client->describeNow || millis() - client->lastDescribe >= LIVE_DESCRIBE_MS){
+            this->describe(client);
+        }
+    }
+
+    // drain at most one queue's worth so old frames still go out while the queue is being refilled
+    for(uint16_t count = 0; received && count < LIVE_QUEUE_LENGTH; count++){
+        if(count > 0 && xQueueReceive(this->queue, &sample, 0) != pdTRUE){
+            break;
+        }
+        if(sample.id >= LIVE_MAX_STREAMS){
+            continue;
+        }
+        // the sample is only a few ms old, so its full time is the latest time with the same low bits
+        int64_t now = SyncClock::localTime();
+        int64_t time = now - (uint32_t)((uint32_t)now - sample.time);
+        // the fan out to each client happens here, off the acquisition tasks
+        for(uint8_t i = 0; i < this->clientCount; i++){
+            this->addSample(&this->clients[i], sample.id, &sample, time);
+        }
+    }
+
+    for(uint8_t i = 0; i < this->clientCount; i++){
+        LiveClient* client = &this->clients[i];
+        for(uint8_t id = 0; id < LIVE_MAX_STREAMS; id++){
+            LiveSubscription* subscription = &client->subscriptions[id];
+            if(subscription->pendingCount > 0 && millis() - subscription->pendingSince >= LIVE_MAX_LATENCY_MS){
+                this->sendPending(client, id);
+            }
+        }
+    }
+    this->unlockClients();
+}
+
+void LiveStream::printStreams(Print* out, Telemetry* telemetry){
+    LiveClient* client = this->findClient(telemetry);
+    if(client == nullptr){
+        return;
+    }
+    this->lockClients();
+    for(uint8_t i = 0; i < LIVE_MAX_STREAMS; i++){
+        LiveStreamInfo* stream = &this->streams[i];
+        if(stream->name == nullptr){
+            continue;
+        }
+        uint16_t decimation = client->subscriptions[i].decimation;
+        float rate = decimation == 0 ? 0 : stream->sampleRate / decimation;
+        out->print("!Live,");
+        out->print(i);
+        out->print(",");
+        out->print(stream->name);
+        out->print(",");
+        out->print(decimation);
+        out->print(",");
+        out->print(rate, 1);
+        out->println(";");
+    }
+    out->print("!LiveDropped,");
+    out->print(this->dropped);
+    out->print(",");
+    out->print(telemetry->getFramesDropped());
+    out->print(",");
+    out->print(client->framesLimited);
+    out->print(",");
+    out->print(client->framesSkipped);
+    out->println(";");
+    this->unlockClients();
+}
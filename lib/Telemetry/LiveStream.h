@@ -0,0 +1,235 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Forwards samples and events to the hosts as they are acquired. Each stream is published once and sent to every
+ * client that subscribed to it, at the client's own decimation and rate limit
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include "sensorTemplate.h"
+#include "Telemetry.h"
+#include "SyncClock.h"
+
+// the most streams that can be registered. Streams and events are both topics that a client can subscribe to
+#define LIVE_MAX_STREAMS 12
+// the most clients, one per transport
+#define LIVE_MAX_CLIENTS 2
+// samples waiting between the acquisition tasks and the sending task. 512 holds about 100ms of every stream at 500Hz
+#define LIVE_QUEUE_LENGTH 512
+// samples collected per stream before a frame is sent
+#define LIVE_FRAME_SAMPLES 16
+// the longest a sample waits for the rest of its frame in ms
+#define LIVE_MAX_LATENCY_MS 20
+// how often the stream descriptions are sent again in ms so a host can start listening at any time
+#define LIVE_DESCRIBE_MS 2000
+// how much of a second's rate limit a client can save up and send at once, as a divisor
+#define LIVE_BURST_DIVISOR 4
+// a write that takes longer than this in us means the client's link is backed up
+#define LIVE_STALL_US 5000
+// how long a backed up client is skipped in ms so it can't hold up the other clients
+#define LIVE_STALL_BACKOFF_MS 100
+
+// one sample on its way from an acquisition task to the sending task
+struct LiveSample{
+    uint8_t id;
+    // how many samples the stream had produced before this one
+    uint32_t index;
+    // the low 32 bits of SyncClock::localTime when the sample was pushed. It is sent long before that wraps
+    uint32_t time;
+    float values[3];
+};
+
+struct LiveStreamInfo{
+    const char* name = nullptr;
+    uint8_t axes = 0;
+    float scale = 1;
+    float sampleRate = 0;
+    // events are sent as soon as they happen and the rate limit never holds them back
+    bool event = false;
+    // queue every nth sample. The greatest common divisor of the clients' decimations, so every client gets
+    // the samples it wants from one queue. 0 when no client wants the stream.
+    // Changed under the client lock but read by push without it, so push reads it once
+    volatile uint16_t gate = 0;
+    // samples produced so far, whether or not they were queued
+    uint32_t index = 0;
+};
+
+// one client's view of a stream
+struct LiveSubscription{
+    // send every nth sample, 0 when the client doesn't want the stream
+    uint16_t decimation = 0;
+    // samples waiting to be sent as one frame, oldest first
+    float pending[LIVE_FRAME_SAMPLES * 3];
+    uint8_t pendingCount = 0;
+    // the stream index divided by the decimation, so each client sees consecutive indexes and can spot gaps
+    uint32_t pendingIndex = 0;
+    unsigned long pendingSince = 0;
+    // the local time of the first pending sample
+    int64_t pendingTime = 0;
+};
+
+struct LiveClient{
+    Telemetry* telemetry = nullptr;
+    // 0 for no limit
+    uint32_t maxBytesPerSecond = 0;
+    // bytes the client can send before it hits its rate limit
+    int32_t budget = 0;
+    unsigned long lastRefill = 0;
+    // frames not sent because of the rate limit
+    uint32_t framesLimited = 0;
+    // frames not sent because the client's output had no room or was backed up
+    uint32_t framesSkipped = 0;
+    // set when a write took longer than LIVE_STALL_US
+    bool stalled = false;
+    unsigned long stalledAt = 0;
+    unsigned long lastDescribe = 0;
+    // set to send the descriptions on the next update
+    bool describeNow = true;
+    LiveSubscription subscriptions[LIVE_MAX_STREAMS];
+};
+
+class LiveStream{
+    public:
+        LiveStream() = default;
+        ~LiveStream() = default;
+
+        /**
+         * @brief create the sample queue and the client lock. Call once from setup before any samples are pushed
+         */
+        void init();
+
+        /**
+         * @brief add a stream that clients can subscribe to
+         * @param id the stream id used in the frames, less than LIVE_MAX_STREAMS
+         * @param name the stream name. Must stay valid for the life of the program
+         * @param axes 1 for a double stream, 3 for an xyz stream
+         * @param scale the value of one count in the sample frames
+         * @param sampleRate how often push is called for the stream in Hz, 0 if unknown
+         * @returns false if the id is out of range
+         */
+        bool registerStream(uint8_t id, const char* name, uint8_t axes, float scale, float sampleRate);
+
+        /**
+         * @brief add an event that clients can subscribe to. Events are rare, so they are sent right away and a client's
+         * rate limit never drops them. They are still dropped like samples when the client's output has no room
+         * @param id the stream id used in the frames, less than LIVE_MAX_STREAMS
+         * @param name the event name. Must stay valid for the life of the program
+         * @param axes the number of values sent with each event, up to 3
+         * @param scale the value of one count in the sample frames
+         * @returns false if the id is out of range
+         */
+        bool registerEvent(uint8_t id, const char* name, uint8_t axes, float scale);
+
+        /**
+         * @brief add a transport that frames are sent to. Clients start with no subscriptions
+         * @param telemetry where to send the client's frames
+         * @param maxBytesPerSecond the most bytes per second to send the client, 0 for no limit.
+         * Frames over the limit are dropped and show up as gaps in the index
+         * @returns false if there are already LIVE_MAX_CLIENTS clients
+         */
+        bool addClient(Telemetry* telemetry, uint32_t maxBytesPerSecond = 0);
+
+        /**
+         * @brief change how many samples of a stream a client gets
+         * @param telemetry the client's telemetry output
+         * @param id the stream
+         * @param decimation send every nth sample, 0 unsubscribes
+         * @returns false if the client or stream doesn't exist
+         */
+        bool subscribe(Telemetry* telemetry, uint8_t id, uint16_t decimation);
+
+        /**
+         * @brief change a client's rate limit
+         * @param maxBytesPerSecond the most bytes per second, 0 for no limit
+         * @returns false if the client doesn't exist
+         */
+        bool setRateLimit(Telemetry* telemetry, uint32_t maxBytesPerSecond);
+
+        /**
+         * @brief stamp each frame with the host's time of its first sample. Frames are stamped 0 without a clock
+         * or until it is synced
+         * @param clock the clock synced with the host
+         */
+        void setClock(SyncClock* clock){this->clock = clock;};
+
+        /**
+         * @brief offer a new xyz sample. Never blocks, the sample is counted as dropped if the queue is full.
+         * A sample is queued once no matter how many clients want it. Each stream must only be pushed from one task
+         */
+        void push(uint8_t id, const xyzData* sample);
+
+        /**
+         * @brief offer a new double sample. The same as the xyz push with one axis
+         */
+        void push(uint8_t id, double value);
+
+        /**
+         * @brief offer an event with up to three values
+         */
+        void push(uint8_t id, float x, float y, float z);
+
+        /**
+         * @brief wait up to LIVE_MAX_LATENCY_MS for samples and send every client the frames that are full or old enough.
+         * Call this in a loop from the one task that owns every client's telemetry output
+         */
+        void update();
+
+        /**
+         * @brief print each stream a client can get as !Live,<id>,<name>,<decimation>,<forwarded rate>; and the totals as
+         * !LiveDropped,<queue drops>,<frames dropped>,<frames over the rate limit>,<frames skipped for a busy link>;
+         * @param out where to print
+         * @param telemetry the client's telemetry output
+         */
+        void printStreams(Print* out, Telemetry* telemetry);
+
+        /**
+         * @brief get the number of samples dropped because the queue was full
+         */
+        uint32_t getDropped(){return dropped;};
+
+    private:
+        QueueHandle_t queue = nullptr;
+        // guards the clients, which are changed by the command task while update sends to them
+        SemaphoreHandle_t lock = nullptr;
+        LiveStreamInfo streams[LIVE_MAX_STREAMS];
+        LiveClient clients[LIVE_MAX_CLIENTS];
+        uint8_t clientCount = 0;
+        uint32_t dropped = 0;
+        SyncClock* clock = nullptr;
+
+        /**
+         * @brief find the client that sends to telemetry
+         * @returns the client or nullptr
+         */
+        LiveClient* findClient(Telemetry* telemetry);
+
+        /**
+         * @brief take and give the client lock. Does nothing before init
+         */
+        void lockClients();
+        void unlockClients();
+
+        /**
+         * @brief work out which samples of a stream need to be queued after a subscription changes
+         */
+        void updateGate(uint8_t id);
+
+        /**
+         * @brief add a sample to a client's frame for the stream, sending the frame once it is full
+         * @param time the local time of the sample
+         */
+        void addSample(LiveClient* client, uint8_t id, const LiveSample* sample, int64_t time);
+
+        /**
+         * @brief send the samples waiting for a stream as one frame if the client's rate limit and output allow it.
+         * A client whose write blocks is skipped for LIVE_STALL_BACKOFF_MS
+         */
+        void sendPending(LiveClient* client, uint8_t id);
+
+        /**
+         * @brief send the name, scale and forwarded rate of every stream the client gets
+         */
+        void describe(LiveClient* client);
+};
@@ -0,0 +1,172 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Sends sensor samples as compact binary frames. See Scripts/telemetry.py for the host side
+*/
+
+#include "Telemetry.h"
+#include "CRC32.h"
+#include "COBS.h"
+#include "ByteOrder.h"
+
+// convert a value to counts of scale, clamped so an out of range value is obvious instead of wrapping
+static uint8_t* putSample(uint8_t* buffer, double value, float scale){
+    double scaled = round(value / scale);
+    int16_t count;
+    if(isnan(scaled)){
+        count = 0;
+    }
+    else if(scaled >= INT16_MAX){
+        count = INT16_MAX;
+    }
+    else if(scaled <= INT16_MIN){
+        count = INT16_MIN;
+    }
+    else{
+        count = (int16_t)scaled;
+    }
+    buffer[0] = (uint16_t)count & 0xFF;
+    buffer[1] = ((uint16_t)count >> 8) & 0xFF;
+    return buffer + 2;
+}
+
+Telemetry::Telemetry(Print* out) :
+out(out){
+    this->sendLock = xSemaphoreCreateMutex();
+}
+
+// the bytes a frame of length bytes takes on the wire with its CRC, the COBS overhead and the zeros around it
+static size_t encodedSize(size_t length){
+    length += 4;
+    return length + length / 254 + 3;
+}
+
+bool Telemetry::hasRoomForSamples(uint8_t count, uint8_t axes){
+    if(!this->flowControl){
+        return true;
+    }
+    return this->out->availableForWrite() >= (int)encodedSize(21 + (size_t)count * axes * 2);
+}
+
+bool Telemetry::sendFrame(uint8_t* frame, size_t length, uint32_t* frameBytes){
+    putUInt32(frame + length, crc32(frame, length));
+    length += 4;
+    if(frameBytes != nullptr){
+        *frameBytes = 0;
+    }
+
+    uint8_t encoded[TELEMETRY_MAX_ENCODED];
+    encoded[0] = 0;
+    size_t encodedLength = cobsEncode(frame, length, encoded + 1) + 1;
+    encoded[encodedLength++] = 0;
+    // file transfers and live samples can share an output from different tasks
+    xSemaphoreTake(this->sendLock, portMAX_DELAY);
+    if(this->flowControl){
+        // a frame is only started once the whole thing fits so a slow host never stalls the sender mid frame
+        unsigned long start = millis();
+        while(this->out->availableForWrite() < (int)encodedLength){
+            if(millis() - start >= TELEMETRY_FLOW_TIMEOUT_MS){
+                this->framesDropped++;
+                xSemaphoreGive(this->sendLock);
+                return false;
+            }
+            vTaskDelay(1);
+        }
+    }
+    size_t sent = this->out->write(encoded, encodedLength);
+    this->bytesSent += sent;
+    if(sent == encodedLength){
+        this->framesSent++;
+    }
+    xSemaphoreGive(this->sendLock);
+    if(frameBytes != nullptr){
+        *frameBytes = sent;
+    }
+    return sent == encodedLength;
+}
+
+bool Telemetry::describe(uint8_t id, const char* name, uint8_t axes, float scale, float sampleRate){
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t nameLength = min(strlen(name), (size_t)(TELEMETRY_MAX_FRAME - 16));
+    uint8_t* end = frame;
+    *end++ = TELEMETRY_FRAME_DESCRIPTION;
+    *end++ = id;
+    *end++ = axes;
+    end = putFloat(end, scale);
+    end = putFloat(end, sampleRate);
+    *end++ = nameLength;
+    memcpy(end, name, nameLength);
+    end += nameLength;
+    return sendFrame(frame, end - frame);
+}
+
+uint8_t* Telemetry::startSamples(uint8_t* frame, uint8_t id, uint32_t firstIndex, int64_t time, uint8_t count, uint8_t axes, float scale){
+    uint8_t* end = frame;
+    *end++ = TELEMETRY_FRAME_SAMPLES;
+    *end++ = id;
+    end = putUInt32(end, firstIndex);
+    *end++ = count;
+    *end++ = axes;
+    end = putFloat(end, scale);
+    return putInt64(end, time);
+}
+
+bool Telemetry::sendXYZ(uint8_t id, uint32_t firstIndex, int64_t time, const xyzData* samples, uint8_t count, float scale){
+    count = min(count, (uint8_t)TELEMETRY_MAX_SAMPLES);
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t* end = startSamples(frame, id, firstIndex, time, count, 3, scale);
+    for(uint8_t i = 0; i < count; i++){
+        end = putSample(end, samples[i].x, scale);
+        end = putSample(end, samples[i].y, scale);
+        end = putSample(end, samples[i].z, scale);
+    }
+    return sendFrame(frame, end - frame);
+}
+
+bool Telemetry::sendDouble(uint8_t id, uint32_t firstIndex, int64_t time, const double* samples, uint8_t count, float scale){
+    count = min(count, (uint8_t)(TELEMETRY_MAX_SAMPLES * 3));
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t* end = startSamples(frame, id, firstIndex, time, count, 1, scale);
+    for(uint8_t i = 0; i < count; i++){
+        end = putSample(end, samples[i], scale);
+    }
+    return sendFrame(frame, end - frame);
+}
+
+bool Telemetry::sendSamples(uint8_t id, uint32_t firstIndex, int64_t time, const float* values, uint8_t count, uint8_t axes, float scale, uint32_t* frameBytes){
+    if(axes == 0){
+        return false;
+    }
+    count = min(count, (uint8_t)(TELEMETRY_MAX_SAMPLES * 3 / axes));
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t* end = startSamples(frame, id, firstIndex, time, count, axes, scale);
+    for(uint16_t i = 0; i < (uint16_t)count * axes; i++){
+        end = putSample(end, values[i], scale);
+    }
+    return sendFrame(frame, end - frame, frameBytes);
+}
+
+bool Telemetry::sendFileChunk(uint8_t file, uint32_t sequence, uint32_t offset, const uint8_t* data, uint8_t length){
+    length = min(length, (uint8_t)TELEMETRY_MAX_CHUNK);
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t* end = frame;
+    *end++ = TELEMETRY_FRAME_FILE_CHUNK;
+    *end++ = file;
+    end = putUInt32(end, sequence);
+    end = putUInt32(end, offset);
+    *end++ = length;
+    memcpy(end, data, length);
+    end += length;
+    return sendFrame(frame, end - frame);
+}
+
+bool Telemetry::sendFileEnd(uint8_t file, uint32_t sequence, uint32_t size, uint32_t crc){
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    uint8_t* end = frame;
+    *end++ = TELEMETRY_FRAME_FILE_END;
+    *end++ = file;
+    end = putUInt32(end, sequence);
+    end = putUInt32(end, size);
+    end = putUInt32(end, crc);
+    return sendFrame(frame, end - frame);
+}
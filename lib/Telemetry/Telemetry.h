@@ -0,0 +1,157 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Sends sensor samples as compact binary frames. See Scripts/telemetry.py for the host side
+*/
+
+#pragma once
+
+#include <Arduino.h>
+#include "sensorTemplate.h"
+
+/** Frame layout before COBS encoding. All values are little endian:
+ * type u8, then the body for that type, then the CRC-32 of the type and body u32
+ * TELEMETRY_FRAME_SAMPLES body:
+ * stream id u8, index of the first sample u32, sample count u8, axes u8, scale f32,
+ * time of the first sample i64 in us since the Unix epoch on the host's clock, 0 until the clock is synced,
+ * int16 per axis per sample, oldest first
+ * TELEMETRY_FRAME_DESCRIPTION body:
+ * stream id u8, axes u8, scale f32, sample rate f32, name length u8, name
+ * TELEMETRY_FRAME_FILE_CHUNK body:
+ * file index u8, sequence number u32, offset in the file u32, length u8, data
+ * TELEMETRY_FRAME_FILE_END body:
+ * file index u8, sequence number u32, file size u32, CRC-32 of the whole file u32
+ * TELEMETRY_FRAME_IMPACTS is sent over Bluetooth by ImpactPublisher. See ImpactPublisher.h for its body
+ * Each frame is COBS encoded so it has no zero bytes and a zero is sent before and after it.
+ * Text printed on the same port ends up between zeros too and fails the CRC, so the host can tell it apart.
+ */
+#define TELEMETRY_FRAME_SAMPLES 0x01
+#define TELEMETRY_FRAME_DESCRIPTION 0x02
+#define TELEMETRY_FRAME_FILE_CHUNK 0x03
+#define TELEMETRY_FRAME_FILE_END 0x04
+// 0x05 is TELEMETRY_FRAME_IMPACTS in ImpactPublisher.h
+// the most bytes in a frame before COBS encoding
+#define TELEMETRY_MAX_FRAME 250
+// the most xyz samples that fit in one frame
+#define TELEMETRY_MAX_SAMPLES ((TELEMETRY_MAX_FRAME - 21 - 4) / 6)
+// the most file bytes that fit in one frame
+#define TELEMETRY_MAX_CHUNK (TELEMETRY_MAX_FRAME - 11 - 4)
+// the most bytes a frame takes on the wire after COBS encoding and the zeros around it
+#define TELEMETRY_MAX_ENCODED (TELEMETRY_MAX_FRAME + TELEMETRY_MAX_FRAME / 254 + 3)
+// how long a frame waits for room in the transmit buffer before it is dropped when flow control is on
+#define TELEMETRY_FLOW_TIMEOUT_MS 50
+
+class Telemetry{
+    public:
+        /**
+         * @brief Construct a new Telemetry object
+         * @param out where to send frames
+         */
+        Telemetry(Print* out);
+        ~Telemetry() = default;
+
+        /**
+         * @brief send the name and format of a stream so the host can label its samples
+         * @param id the stream id used in sample frames
+         * @param name the stream name
+         * @param axes 1 for a double stream, 3 for an xyz stream
+         * @param scale the value of one count in the sample frames
+         * @param sampleRate how often the stream is sampled in Hz, 0 if unknown
+         */
+        bool describe(uint8_t id, const char* name, uint8_t axes, float scale, float sampleRate);
+
+        /**
+         * @brief send xyz samples. Each axis is sent as round(value / scale) clamped to an int16
+         * @param id the stream id
+         * @param firstIndex how many samples the stream had produced before samples[0], so the host can spot gaps
+         * @param time when samples[0] was taken in us since the Unix epoch, 0 if the clock isn't synced. See SyncClock
+         * @param samples the samples, oldest first
+         * @param count the number of samples, at most TELEMETRY_MAX_SAMPLES
+         * @param scale the value of one count
+         */
+        bool sendXYZ(uint8_t id, uint32_t firstIndex, int64_t time, const xyzData* samples, uint8_t count, float scale);
+
+        /**
+         * @brief send double samples. The same as sendXYZ with one axis
+         */
+        bool sendDouble(uint8_t id, uint32_t firstIndex, int64_t time, const double* samples, uint8_t count, float scale);
+
+        /**
+         * @brief send samples stored as floats
+         * @param values axes values per sample, oldest sample first
+         * @param count the number of samples. At most TELEMETRY_MAX_SAMPLES * 3 / axes
+         * @param axes the number of values in each sample
+         * @param frameBytes if not null, set to the bytes this frame took including framing, 0 if it was dropped
+         */
+        bool sendSamples(uint8_t id, uint32_t firstIndex, int64_t time, const float* values, uint8_t count, uint8_t axes, float scale, uint32_t* frameBytes = nullptr);
+
+        /**
+         * @brief send part of a file
+         * @param file the file's index in the file list
+         * @param sequence counts up from 0 for each transfer so the host can spot a missing chunk
+         * @param offset where the data starts in the file
+         * @param data the file data
+         * @param length the number of bytes, at most TELEMETRY_MAX_CHUNK
+         */
+        bool sendFileChunk(uint8_t file, uint32_t sequence, uint32_t offset, const uint8_t* data, uint8_t length);
+
+        /**
+         * @brief mark the end of a file transfer
+         * @param file the file's index in the file list
+         * @param sequence the sequence number after the last chunk
+         * @param size the size of the file
+         * @param crc the CRC-32 of the whole file
+         */
+        bool sendFileEnd(uint8_t file, uint32_t sequence, uint32_t size, uint32_t crc);
+
+        /**
+         * @brief wait for room in the output's transmit buffer before sending each frame instead of blocking inside write.
+         * Only turn this on when sending from a task that is allowed to wait, and when the output reports availableForWrite
+         * @param enabled true to wait for room
+         */
+        void setFlowControl(bool enabled){flowControl = enabled;};
+
+        /**
+         * @brief check if the output can take a samples frame right now without waiting. Always true without flow control
+         * @param count the number of samples
+         * @param axes the number of values in each sample
+         */
+        bool hasRoomForSamples(uint8_t count, uint8_t axes);
+
+        /**
+         * @brief get the number of frames dropped because the output had no room for them
+         */
+        uint32_t getFramesDropped(){return framesDropped;};
+
+        /**
+         * @brief get the number of frames sent
+         */
+        uint32_t getFramesSent(){return framesSent;};
+
+        /**
+         * @brief get the number of bytes sent, including framing
+         */
+        uint32_t getBytesSent(){return bytesSent;};
+
+    private:
+        Print* out;
+        uint32_t framesSent = 0;
+        uint32_t bytesSent = 0;
+        uint32_t framesDropped = 0;
+        bool flowControl = false;
+        SemaphoreHandle_t sendLock; // held for each frame so frames sent from different tasks don't mix on the output
+
+        /**
+         * @brief add the CRC to a frame, encode it and send it
+         * @param frame the frame with TELEMETRY_MAX_FRAME bytes of room
+         * @param length the number of bytes in the frame so far
+         * @param frameBytes if not null, set to the bytes the frame took including framing, 0 if it was dropped
+         */
+        bool sendFrame(uint8_t* frame, size_t length, uint32_t* frameBytes = nullptr);
+
+        /**
+         * @brief start a samples frame
+         * @returns a pointer to where the samples go
+         */
+        uint8_t* startSamples(uint8_t* frame, uint8_t id, uint32_t firstIndex, int64_t time, uint8_t count, uint8_t axes, float scale);
+};
@@ -0,0 +1,200 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Keeps the device clock in step with the host's clock so logs and telemetry can be stamped with Unix time.
+ * The host runs NTP style exchanges over the command channel, see Scripts/time_sync.py
+*/
+
+#include "SyncClock.h"
+#include "esp_timer.h"
+
+int64_t SyncClock::localTime(){
+    // the 64 bit timer never wraps, unlike micros()
+    return esp_timer_get_time();
+}
+
+void SyncClock::request(uint32_t sequence, int64_t hostSent, int64_t received){
+    // only the command task starts and finishes exchanges, so the pending exchange needs no lock
+    this->pendingSequence = sequence;
+    this->pendingSent = hostSent;
+    this->pendingReceived = received;
+    this->pending = true;
+    // last, so the time spent here counts as part of the device's turnaround instead of the round trip
+    this->pendingReplied = localTime();
+}
+
+bool SyncClock::complete(uint32_t sequence, int64_t hostReceived, SyncResult* result){
+    if(!this->pending || sequence != this->pendingSequence){
+        return false;
+    }
+    this->pending = false;
+    int64_t t1 = this->pendingSent;
+    int64_t t2 = this->pendingReceived;
+    int64_t t3 = this->pendingReplied;
+    int64_t t4 = hostReceived;
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    // a negative round trip means the host mixed up its times
+    if(delay < 0 || delay > UINT32_MAX){
+        return false;
+    }
+    SyncSample sample;
+    sample.local = t2 + (t3 - t2) / 2;
+    sample.offset = ((t1 - t2) + (t4 - t3)) / 2;
+    sample.delay = delay;
+
+    // the model is only written from this task, so it can be read here without the lock
+    int64_t predictionError = 0;
+    if(this->synced){
+        predictionError = sample.offset - predictOffset(sample.local);
+        int64_t allowed = (int64_t)SYNC_RESET_US + getErrorBound(sample.local) + sample.delay / 2;
+        if(predictionError > allowed || predictionError < -allowed){
+            this->sampleCount = 0;
+            this->nextSample = 0;
+            this->driftError = SYNC_UNFITTED_DRIFT_PPM;
+            this->drift = 0;
+        }
+    }
+    this->samples[this->nextSample] = sample;
+    this->nextSample = (this->nextSample + 1) % SYNC_SAMPLES;
+    if(this->sampleCount < SYNC_SAMPLES){
+        this->sampleCount++;
+    }
+    this->exchanges++;
+    fit();
+
+    result->offset = sample.offset;
+    result->delay = sample.delay;
+    result->bound = sample.delay / 2;
+    result->predictionError = predictionError;
+    result->driftPpb = (int32_t)llround(this->drift * 1e9);
+    result->clockBound = this->baseBound;
+    return true;
+}
+
+void SyncClock::fit(){
+    const SyncSample* newest = &this->samples[(this->nextSample + SYNC_SAMPLES - 1) % SYNC_SAMPLES];
+    const SyncSample* first = newest;
+    const SyncSample* best = newest;
+    int64_t oldestLocal = newest->local;
+    for(uint8_t i = 0; i < this->sampleCount; i++){
+        const SyncSample* sample = &this->samples[i];
+        if(sample->local < oldestLocal){
+            oldestLocal = sample->local;
+            first = sample;
+        }
+        if(sample->delay < best->delay){
+            best = sample;
+        }
+    }
+
+    // the offset is a line through the exchanges. Exchanges with a short round trip are the most exact,
+    // so each is weighted by one over its delay squared
+    double drift = this->drift;
+    double driftError = this->driftError;
+    int64_t lineLocal = best->local;
+    double lineOffset = best->offset;
+    if(this->sampleCount >= 2 && newest->local - oldestLocal >= SYNC_MIN_DRIFT_SPAN_US){
+        double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for(uint8_t i = 0; i < this->sampleCount; i++){
+            const SyncSample* sample = &this->samples[i];
+            double delay = max(sample->delay, (uint32_t)SYNC_MIN_DELAY_US);
+            double w = 1 / (delay * delay);
+            // relative to the first exchange so the sums keep their precision
+            double x = (sample->local - first->local) / 1e6;
+            double y = sample->offset - first->offset;
+            sw += w;
+            sx += w * x;
+            sy += w * y;
+            sxx += w * x * x;
+            sxy += w * x * y;
+        }
+        double spread = sxx - sx * sx / sw;
+        if(spread > 0){
+            // us of offset per second is the same as ppm
+            double slope = (sxy - sx * sy / sw) / spread;
+            // the slope is a weighted sum of the offsets. Each offset is within delay / 2 of the truth,
+            // so the worst the slope can be off by is the sum of those errors through the weights
+            double slopeError = 0;
+            for(uint8_t i = 0; i < this->sampleCount; i++){
+                const SyncSample* sample = &this->samples[i];
+                double delay = max(sample->delay, (uint32_t)SYNC_MIN_DELAY_US);
+                double x = (sample->local - first->local) / 1e6;
+                slopeError += fabs(x - sx / sw) / (delay * delay) / spread * sample->delay / 2;
+            }
+            // a fit that knows less than the crystal tolerances is no use
+            if(slopeError + SYNC_DRIFT_WANDER_PPM < SYNC_UNFITTED_DRIFT_PPM){
+                slope = constrain(slope, -SYNC_MAX_DRIFT_PPM, SYNC_MAX_DRIFT_PPM);
+                drift = slope / 1e6;
+                driftError = slopeError + SYNC_DRIFT_WANDER_PPM;
+                lineLocal = first->local;
+                lineOffset = first->offset + (sy - slope * sx) / sw;
+            }
+        }
+    }
+
+    int64_t baseLocal = newest->local;
+    int64_t baseOffset = llround(lineOffset + drift * (baseLocal - lineLocal));
+    // the true offset at each exchange is within delay / 2 of what it measured. Carry that to the base with the drift,
+    // allow for the drift being off, and add how far the line is from that exchange. The tightest one holds
+    double bound = UINT32_MAX;
+    for(uint8_t i = 0; i < this->sampleCount; i++){
+        const SyncSample* sample = &this->samples[i];
+        int64_t age = baseLocal - sample->local;
+        double carried = sample->offset + drift * age;
+        double candidate = sample->delay / 2.0 + fabs(carried - baseOffset) + fabs((double)age) * driftError / 1e6;
+        bound = min(bound, candidate);
+    }
+
+    portENTER_CRITICAL(&this->lock);
+    this->baseLocal = baseLocal;
+    this->baseOffset = baseOffset;
+    this->drift = drift;
+    this->driftError = driftError;
+    this->baseBound = (uint32_t)ceil(bound);
+    this->synced = true;
+    this->generation++;
+    portEXIT_CRITICAL(&this->lock);
+}
+
+int64_t SyncClock::predictOffset(int64_t local){
+    return this->baseOffset + llround(this->drift * (local - this->baseLocal));
+}
+
+bool SyncClock::isSynced(){
+    return this->synced;
+}
+
+int64_t SyncClock::toHostTime(int64_t local){
+    portENTER_CRITICAL(&this->lock);
+    bool synced = this->synced;
+    int64_t offset = synced ? predictOffset(local) : 0;
+    portEXIT_CRITICAL(&this->lock);
+    return synced ? local + offset : 0;
+}
+
+uint32_t SyncClock::getErrorBound(int64_t local){
+    portENTER_CRITICAL(&this->lock);
+    bool synced = this->synced;
+    double age = fabs((double)(local - this->baseLocal));
+    double bound = this->baseBound + age * this->driftError / 1e6;
+    portEXIT_CRITICAL(&this->lock);
+    if(!synced || bound >= UINT32_MAX){
+        return UINT32_MAX;
+    }
+    return (uint32_t)ceil(bound);
+}
+
+void SyncClock::print(Print* out){
+    int64_t local = localTime();
+    out->print("!Clock,");
+    out->print(this->synced ? 1 : 0);
+    out->print(",");
+    out->print((long long)toHostTime(local));
+    out->print(",");
+    out->print(getErrorBound(local));
+    out->print(",");
+    out->print((long)llround(this->drift * 1e9));
+    out->print(",");
+    out->print(this->exchanges);
+    out->println(";");
+}
@@ -0,0 +1,147 @@
+/**
+ * @author Quinn Henthorne Email: henth013@d.umn.edu Phone: 763-656-8391
+ * @date 03-26-2023
+ * @brief Keeps the device clock in step with the host's clock so logs and telemetry can be stamped with Unix time.
+ * The host runs NTP style exchanges over the command channel, see Scripts/time_sync.py
+*/
+
+#pragma once
+
+#include <Arduino.h>
+
+/** One exchange, with T1 and T4 on the host's clock and T2 and T3 on the device's clock:
+ * host sends !28,<seq>,<T1 s>,<T1 us>;   T2 is when the device received it
+ * device replies !Sync,<seq>;            T3 is just before the reply is printed
+ * host sends !29,<seq>,<T4 s>,<T4 us>;   T4 is when the host received the reply
+ * offset = ((T1 - T2) + (T4 - T3)) / 2 and round trip delay = (T4 - T1) - (T3 - T2).
+ * The true offset is within delay / 2 of the measured one however the delay is split between the two directions.
+ */
+// exchanges kept to work out the drift. The oldest is dropped to make room
+#define SYNC_SAMPLES 16
+// the drift is only fitted once the exchanges kept span this long, in us. Before that the last fitted drift is used
+#define SYNC_MIN_DRIFT_SPAN_US 30000000LL
+// neither clock is more than 100ppm off, so a fitted drift bigger than this is a bad fit
+#define SYNC_MAX_DRIFT_PPM 200
+// how fast the error bound grows between exchanges, in ppm, while the drift isn't known
+#define SYNC_UNFITTED_DRIFT_PPM 100
+// how much the drift can wander with temperature on top of how far off the fit can be, in ppm
+#define SYNC_DRIFT_WANDER_PPM 2
+// an exchange this far from what the clock predicted means the host's clock was changed or another host is syncing.
+// The old exchanges are thrown away instead of being fitted with the new one
+#define SYNC_RESET_US 100000
+// exchanges with less round trip delay than this are weighted as if they had this much
+#define SYNC_MIN_DELAY_US 100
+
+// what one exchange measured, sent back to the host
+struct SyncResult{
+    int64_t offset; // host time minus device time in us
+    uint32_t delay; // round trip delay in us
+    uint32_t bound; // the measured offset is within this many us of the true one
+    int64_t predictionError; // the measured offset minus what the clock predicted before this exchange. 0 for the first
+    int32_t driftPpb; // how much faster the host's clock runs than the device's, in parts per billion
+    uint32_t clockBound; // the error bound of the clock once this exchange is included, in us
+};
+
+class SyncClock{
+    public:
+        SyncClock() = default;
+        ~SyncClock() = default;
+
+        /**
+         * @brief the device clock every time stamp is taken from, in us since power up
+         */
+        static int64_t localTime();
+
+        /**
+         * @brief start an exchange. Prints nothing; the caller prints !Sync,<seq>; right after this returns
+         * @param sequence the host's number for the exchange
+         * @param hostSent T1, the host's time when it sent the request, in us since the Unix epoch
+         * @param received T2, the local time the request arrived
+         */
+        void request(uint32_t sequence, int64_t hostSent, int64_t received);
+
+        /**
+         * @brief finish an exchange and update the clock with it
+         * @param sequence the host's number for the exchange. It has to match the last request
+         * @param hostReceived T4, the host's time when it got the reply, in us since the Unix epoch
+         * @param result filled with what the exchange measured
+         * @returns false if the exchange doesn't match the last request or the times don't make sense
+         */
+        bool complete(uint32_t sequence, int64_t hostReceived, SyncResult* result);
+
+        /**
+         * @brief true once an exchange has completed
+         */
+        bool isSynced();
+
+        /**
+         * @brief convert a local time to the host's clock
+         * @param local a time from localTime
+         * @returns us since the Unix epoch, or 0 if the clock hasn't been synced
+         */
+        int64_t toHostTime(int64_t local);
+
+        /**
+         * @brief the host's time now, or 0 if the clock hasn't been synced
+         */
+        int64_t now(){return toHostTime(localTime());};
+
+        /**
+         * @brief how far off toHostTime can be for a local time
+         * @returns the bound in us, or UINT32_MAX if the clock hasn't been synced
+         */
+        uint32_t getErrorBound(int64_t local);
+
+        /**
+         * @brief counts up every time the clock is corrected, so a log can tell when to stamp the new correction
+         */
+        uint32_t getGeneration(){return generation;};
+
+        /**
+         * @brief print the clock as !Clock,<synced>,<host time us>,<error bound us>,<drift ppb>,<exchanges>;
+         * @param out where to print
+         */
+        void print(Print* out);
+
+    private:
+        // one completed exchange
+        struct SyncSample{
+            int64_t local; // the middle of T2 and T3
+            int64_t offset;
+            uint32_t delay;
+        };
+
+        portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        SyncSample samples[SYNC_SAMPLES];
+        uint8_t sampleCount = 0;
+        uint8_t nextSample = 0;
+
+        // the exchange waiting for its second message
+        uint32_t pendingSequence = 0;
+        int64_t pendingSent = 0;
+        int64_t pendingReceived = 0;
+        int64_t pendingReplied = 0;
+        bool pending = false;
+
+        // the clock: host time = local + baseOffset + drift * (local - baseLocal)
+        int64_t baseLocal = 0;
+        int64_t baseOffset = 0;
+        double drift = 0;
+        // how fast the error bound grows away from the base, in ppm
+        double driftError = SYNC_UNFITTED_DRIFT_PPM;
+        uint32_t baseBound = 0;
+        bool synced = false;
+        uint32_t generation = 0;
+        uint32_t exchanges = 0;
+
+        /**
+         * @brief the offset the clock predicts for a local time
+         * @pre the lock is held and the clock is synced
+         */
+        int64_t predictOffset(int64_t local);
+
+        /**
+         * @brief work the clock out again from the exchanges kept
+         */
+        void fit();
+};
@@ -18,6 +18,76 @@
 #include "BluetoothSerialMessage.h"
 #include "SDCard.h"
 #include "ControlPanel.h"
+#include "CFCFilter.h"
+#include "AccelFusion.h"
+#include "ExposureTracker.h"
+#include "Telemetry.h"
+#include "LiveStream.h"
+#include "LatencyHistogram.h"
+#include "InstrumentedLock.h"
+#include "TaskMonitor.h"
+#include "RuntimeConfig.h"
+#include "FileTransfer.h"
+#include "ImpactPublisher.h"
+#include "SyncClock.h"
+
+// uncomment to time the processing stages on startup
+// #define RUN_BENCHMARKS
+
+// the IMU task runs every 2ms. This is the default for the ImuRateHz setting
+#define IMU_SAMPLE_RATE 500
+// SAE J211 channel frequency classes for the head and body sensors, 0 for none.
+// CFC 180 and 1000 need the IMU loop to sample at roughly 10x the CFC, so CFC 60 is the highest class
+// that can be realized at the current sample rate. That would flatten the short head impact peaks that impact
+// detection, peak g and concussion risk are judged on, so the accelerometers are left unfiltered and filtered
+// offline with Scripts/log_to_csv.py --filter instead
+#define ACCEL_CFC 0
+#define GYRO_CFC 60
+
+// comment out to log human readable CSV files instead of binary files.
+// Binary logs are converted to CSV with Scripts/log_to_csv.py
+#define USE_BINARY_LOG
+// comment out to store binary rows as fixed size int32 records instead of delta encoded varints
+#define USE_DELTA_ENCODING
+
+// comment out to write each recording to its own file instead of one session container per power up.
+// Scripts/log_to_csv.py can list and extract the recordings in a container
+#define USE_SESSION_FILE
+
+// space reserved ahead of each recording so the SD writer never allocates clusters mid-recording. A session container
+// reserves this much more whenever an event starts with less than this left.
+// 1MB holds over 30s of binary rows at the IMU rate. Set to 0 to grow files as they are written
+#define SD_PREALLOCATE_BYTES (1024UL * 1024UL)
+
+// comment out to write binary records without sequence numbers and CRCs. A journaled log that wasn't closed is
+// repaired at startup after a power loss, keeping every good frame up to the last checkpoint
+#define USE_JOURNALED_LOG
+// how often a recording is synced to the card in ms. Every recording is also synced when it ends.
+// Each checkpoint writes a partly filled block and syncs the FAT, so shorter intervals cost writer time and card wear.
+// This is the default for the CheckpointMs setting
+#define SD_CHECKPOINT_MS 500
+
+// comment out to print the data streams as ASCII !Header,x,y,z; lines instead of binary frames.
+// Decode the frames with Scripts/telemetry.py
+#define USE_BINARY_TELEMETRY
+// binary telemetry needs a faster link to keep up with every stream. !15,<baud>; changes it at runtime, up to 2Mbaud
+#define TELEMETRY_BAUD 921600
+#define TELEMETRY_MAX_BAUD 2000000
+// room for a few frames so the print task can queue the next frame while the last one is still going out
+#define TELEMETRY_TX_BUFFER 4096
+// the most live stream bytes per second sent over Bluetooth. !27,<bytes per second>; changes the limit of the port it's sent on
+#define BLUETOOTH_TELEMETRY_BYTES_PER_SECOND 20000
+
+// the command task sleeps until bytes arrive. This is only how often it wakes up anyway, in ms
+#define COMMAND_IDLE_MS 1000
+
+// linear acceleration in g that counts as an impact. This is the default for the ImpactMilliG setting
+#define IMPACT_THRESHOLD_G 5
+// an impact summary is sent over Bluetooth once the head has stayed under the impact threshold this long, in ms
+#define IMPACT_END_MS 30
+
+// the hardware timer that releases each pass of the IMU task. The IR receiver uses timer 3
+#define IMU_TIMER 0
 
 // set up sensor headers
 char head[] = "HEAD";
@@ -38,14 +108,95 @@ I2C_IMU bodyIMU(&wire0, 0x6A, body);
 I2C_Accel bodyAccel(&wire0, 0x18, body);
 I2C_IMU headIMU(&wire1, 0x6A, head);
 I2C_Accel headAccel(&wire1, 0x18, head);
+// combines the head IMU and the head high g accelerometer into one linear acceleration in g
+AccelFusion headFusion;
 
 LoadCell leftLoadCell(LOAD_CELL1_DAT_PIN, LOAD_CELL1_CLK_PIN);
 LoadCell rightLoadCell(LOAD_CELL2_DAT_PIN, LOAD_CELL2_CLK_PIN);
 
 // Create a SerialMessage object
 SerialMessage serialMessage;
+Telemetry telemetry(&Serial);
+// the stream and event ids used by the live stream. !14,<id>,<decimation>; changes how many samples of a stream are sent
+// to the port the command came from. Each port has its own subscriptions
+typedef enum{
+  LIVE_LEFT_CELL,
+  LIVE_RIGHT_CELL,
+  LIVE_HEAD_IMU_GYRO,
+  LIVE_BODY_ACCEL,
+  LIVE_HEAD_ACCEL,
+  LIVE_BODY_IMU_GYRO,
+  LIVE_HEAD_IMU_ACCEL,
+  LIVE_BODY_IMU_ACCEL,
+  LIVE_TEMP,
+  LIVE_HEAD_FUSION,
+  LIVE_IMPACT // an event with the peak g, risk in percent and duration in ms of each impact
+}LiveStreamId;
+LiveStream liveStream;
+// how long printing holds the sensor and load cell locks in us. !16; prints it with the lock stats
+LatencyHistogram printLockHold;
 BluetoothSerial bleSerial;
 BluetoothSerialMessage bleSerialRead(&bleSerial);
+// file chunks go back on the port that asked for them
+Telemetry bleTelemetry(&bleSerial);
+FileTransfer fileTransfer;
+// sends a summary of each impact to the sideline tablet. !26; prints how many were sent
+ImpactPublisher impactPublisher(&bleSerialRead);
+// impacts found by the IMU task wait here for the publish task
+QueueHandle_t impactQueue;
+// messages from the acquisition tasks. They wait here for the publish task so a full serial port never holds up acquisition
+typedef enum{
+  NOTICE_BODY_IMU_IMPACT,
+  NOTICE_HEAD_IMU_IMPACT,
+  NOTICE_CONCUSSION,
+  NOTICE_LEFT_CELL_IMPACT,
+  NOTICE_RIGHT_CELL_IMPACT,
+  NOTICE_COUNT
+}Notice;
+const char* noticeMessages[NOTICE_COUNT] = {
+  "Impact Detected by Body IMU",
+  "Impact Detected by Head IMU",
+  "Concussion Detected",
+  "Impact Detected by left load cell",
+  "Impact Detected by right load cell"
+};
+QueueHandle_t noticeQueue;
+// the host's clock, kept in step by !28 and !29 exchanges. Logs, live frames and impact summaries are stamped with it
+SyncClock syncClock;
+
+// settings that can be changed with !18,<id>,<value>; and saved with !19;
+// the setting ids are the indexes in configEntries
+typedef enum{
+  CONFIG_IMPACT_MILLI_G,
+  CONFIG_RISK_PERMILLE,
+  CONFIG_LOAD_CELL_LIMIT,
+  CONFIG_IMU_RATE_HZ,
+  CONFIG_LOAD_CELL_MS,
+  CONFIG_PRE_TRIGGER_MS,
+  CONFIG_POST_TRIGGER_MS,
+  CONFIG_SPLIT_MS,
+  CONFIG_CHECKPOINT_MS,
+  CONFIG_COUNT
+}ConfigId;
+const ConfigEntry configEntries[CONFIG_COUNT] = {
+  // name, default, min, max, needs restart
+  {"ImpactMilliG", IMPACT_THRESHOLD_G * 1000, 500, 400000, false}, // linear acceleration that counts as an impact
+  {"RiskPermille", 250, 1, 1000, false}, // concussion probability that counts as a concussion
+  {"LoadCellLimit", 100000000, 0, INT32_MAX, false}, // load cell peak, in the units LoadCell::getPeaks reports, that counts as an impact
+  {"ImuRateHz", IMU_SAMPLE_RATE, 100, 500, true}, // the filters and logs are set up for this rate at startup. Must divide 1000000, see checkSetting
+  {"LoadCellMs", 2, 1, 1000, false}, // time between load cell reads
+  {"PreTriggerMs", MAX_STREAM_LENGTH * 1000 / IMU_SAMPLE_RATE, 0, MAX_STREAM_LENGTH * 1000 / 100, false}, // history logged before a trigger. At most the stream length, see checkSetting
+  {"PostTriggerMs", 2000, 100, 60000, false}, // how long recording goes on after the last trigger
+  {"SplitMs", 3000, 100, 120000, false}, // a trigger this long after the last one starts a new recording
+  {"CheckpointMs", SD_CHECKPOINT_MS, 0, 60000, false} // how often a journaled recording is synced, 0 for only when it ends
+};
+RuntimeConfig config(configEntries, CONFIG_COUNT);
+// the IMU rate the tasks were started with. ImuRateHz only changes this after a restart
+int32_t imuSampleRate = IMU_SAMPLE_RATE;
+// set by !20,1; to record until !20,0; no matter what the sensors see
+volatile bool manualRecording = false;
+// set by !13; for the SD task to tune the card clock between recordings
+volatile bool autotuneRequested = false;
 
 bool bootup_errors_shown = false;
 // each respective index is tru if the given thing is not initialized:
@@ -53,28 +204,49 @@ bool bootup_errors_shown = false;
 byte startup_errors = 0b00000000;
 
 
+/**
+ * Each shared object is guarded by the lock of the resource it belongs to instead of one lock for everything.
+ * When a task needs more than one they are always taken in this order: sdLock, sensorLock, loadCellLock.
+ * The SD task never holds two. It copies the logged streams under each lock in turn and writes from the copies.
+ * exposureLock and panelLock are never held together with another lock. !16; prints how long each is waited for and held
+*/
+// the SD card producer: the update task and the SD commands
+InstrumentedLock sdLock("SDCard");
+// the IMUs, accelerometers, head fusion and concussion stream
+InstrumentedLock sensorLock("Sensors");
+// the load cells
+InstrumentedLock loadCellLock("LoadCells");
+// the exposure totals, which are saved to flash as they change
+InstrumentedLock exposureLock("Exposure");
+// the control panel, the LED strip and the startup errors
+InstrumentedLock panelLock("Panel");
+InstrumentedLock* locks[] = {&sdLock, &sensorLock, &loadCellLock, &exposureLock, &panelLock};
+
+// the newest values from the acquisition tasks for the readers that only need the latest one: the LEDs, impact tracking
+// and temperature compensation. A float is one word the ESP32 reads and writes whole, so they are read without a lock
+volatile float latestTemperature = 0;
+volatile float latestHeadAccel = 0;
+volatile float latestHeadGyro = 0;
+volatile float latestConcussion = 0;
+volatile float latestLeftLoad = 0;
+volatile float latestRightLoad = 0;
+
 /**
  * This section define all needed functions and variables for the status lights
 */
 // define functions
 double headAccelMag(){
-  double *IMUData = headIMU.getData();
-  if(!headIMU.isInitialized() || !headAccel.isInitialized()){
+  if(!headIMU.isInitialized() && !headAccel.isInitialized()){
     return 100;
   }
-  if(IMUData[0] > 15 || IMUData[1] > 15 || IMUData[2] > 15){
-    double *accelData = headAccel.getData();
-    return sqrt(accelData[0]*accelData[0] + accelData[1]*accelData[1] + accelData[2]*accelData[2]);
-  }
-  return sqrt(IMUData[0]*IMUData[0] + IMUData[1]*IMUData[1] + IMUData[2]*IMUData[2]);
+  return latestHeadAccel;
 };
 
 double headGyroMag(){
   if(!headIMU.isInitialized()){
     return 8000;
   }
-  double *data = headIMU.getData();
-  return sqrt(data[3]*data[3] + data[4]*data[4] + data[5]*data[5]);
+  return latestHeadGyro;
 };
 
 
@@ -82,50 +254,75 @@ double leftLoadCellMag(){
   if(!leftLoadCell.isInitialized()){
     return 500;
   }
-  return leftLoadCell.getData();
+  return latestLeftLoad;
 };
 
 double rightLoadCellMag(){
   if(!rightLoadCell.isInitialized()){
     return 500;
   }
-  return rightLoadCell.getData();
+  return latestRightLoad;
 };
 
 double getBatteryVoltage(){
   return double(analogRead(BATTERY_PIN)) * 100 / 65535;
 };
 
-double concussionProbability(){
-  double *data1 = bodyIMU.getPeaks();
-  if(!headIMU.isInitialized() || !headAccel.isInitialized()){
-    return 1;
-  }
+double impactThresholdG(){
+  return config.get(CONFIG_IMPACT_MILLI_G) / 1000.0;
+}
 
-  double gyroMag = sqrt(data1[3]*data1[3] + data1[4]*data1[4] + data1[5]*data1[5]);
-  double accelMag;
-  // if the low g accelerometer is saturated, use the high g accelerometer
-  if(data1[0] > 15 || data1[1] > 15 || data1[2] > 15){
-    double *data2 = bodyAccel.getPeaks();
-    accelMag = sqrt(data2[0]*data2[0] + data2[1]*data2[1] + data2[2]*data2[2]);
-  }
-  else{
-    accelMag = sqrt(data1[0]*data1[0] + data1[1]*data1[1] + data1[2]*data1[2]);
-  }
+double concussionThreshold(){
+  return config.get(CONFIG_RISK_PERMILLE) / 1000.0;
+}
 
+double concussionRisk(double accelMag, double gyroMag){
   // return the probability of concussion. This was given by the paper:
   // Brain Injury Prediction: Assessing the Combined Probability of Concussion Using Linear and Rotational Head Acceleration
   return 1/(1 + exp(-(-10.2 + 0.0433*accelMag + 0.000873*gyroMag - 0.00000092*accelMag*gyroMag)));
+}
+
+// @pre the sensor lock is held
+double concussionProbability(){
+  if(!headIMU.isInitialized()){
+    return 1;
+  }
+
+  double gyroMag = headIMU.getGyroPeak();
+  // the fused stream already switches to the high g accelerometer when the IMU saturates
+  double accelMag = headFusion.getPeaks()->magnitude();
+
+  return concussionRisk(accelMag, gyroMag);
+};
+
+// the probability the IMU task last worked out, for the LEDs
+double concussionLevel(){
+  if(!headIMU.isInitialized()){
+    return 1;
+  }
+  return latestConcussion;
 };
 
 DataStream<double> concussionStream = DataStream<double>();
+// copies of the logged streams that the SD task writes from. See copyLoggedStreams
+DataStream<double> loggedLeftLoadCell;
+DataStream<xyzData> loggedBodyIMUAccel;
+DataStream<xyzData> loggedBodyIMUGyro;
+DataStream<xyzData> loggedBodyAccel;
+DataStream<xyzData> loggedHeadFusion;
+DataStream<double> loggedConcussion;
 
 
-bool impactDetected = false;
-bool concussionDetected = false;
+// set while holding the sensor or load cell lock. The SD task only clears a flag it saw set at the start of its pass,
+// so a trigger that lands while it is ending a recording isn't lost
+volatile bool impactDetected = false;
+volatile bool concussionDetected = false;
+
+// running totals of every impact for the session and each player
+ExposureTracker exposure;
 
 // define all of the status lights
-IndicatorLight indic1(0, concussionProbability, 0, 1, true, false);
+IndicatorLight indic1(0, concussionLevel, 0, 1, true, false);
 IndicatorLight indic2(1, leftLoadCellMag, 0, 500, true, false);
 IndicatorLight indic3(2, rightLoadCellMag, 0, 500, true, false);
 IndicatorLight indic4(3, headGyroMag, 0, 8000, true, false);
@@ -150,8 +347,16 @@ LEDStrip leds(LED_STRIP_PIN, statusLights, 8);
 
 // create the SD card object
 SDCard sdCard(SPI_CS_PIN);
+#if defined(USE_SESSION_FILE)
+char extension[] = ".ses";
+char dynamicFilename[] = "/session";
+#elif defined(USE_BINARY_LOG)
+char extension[] = ".bin";
+char dynamicFilename[] = "/impact";
+#else
 char extension[] = ".csv";
 char dynamicFilename[] = "/impact";
+#endif
 
 /**
  * This section defines all of the tasks
@@ -170,92 +375,342 @@ TaskHandle_t printDataTask;
 TaskHandle_t updateLoadCellTask;
 TaskHandle_t readSerialTask;
 TaskHandle_t updateSDCardTask;
+TaskHandle_t writeSDCardTask;
 TaskHandle_t showStartupErrorsTask;
+TaskHandle_t transferFilesTask;
+TaskHandle_t publishImpactsTask;
+
+// the period and deadline of each periodic task. !30; prints them
+TaskMonitor imuMonitor("IMU");
+TaskMonitor loadCellMonitor("LoadCells");
+TaskMonitor sdUpdateMonitor("SDUpdate");
+TaskMonitor tempMonitor("Temp");
+TaskMonitor controlPanelMonitor("ControlPanel");
+
+// true while a recording is being written, so file transfers leave the card alone
+bool recordingInProgress(){
+  return sdCard.isFileOpen();
+}
 
-// create a mutex to prevent multiple tasks from accessing the same data at the same time
-SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+// the open session container keeps changing, so it isn't offered for download until the writer is done with it
+bool fileInUse(const char* name){
+  return sdCard.isFileInUse(name);
+}
+
+// send files to the host. This runs below every other task so a download never holds up acquisition
+void transferFiles(void * parameter){
+  for(;;){
+    fileTransfer.run(portMAX_DELAY);
+  }
+  vTaskDelete(NULL);
+}
+
+// defined with the commands below, since it replies like one
+void runAutotune();
+
+// copy the logged streams under the lock of the resource they belong to, one lock at a time
+void copyLoggedStreams(){
+  loadCellLock.take();
+  loggedLeftLoadCell.copyFrom(leftLoadCell.getDataStream());
+  loadCellLock.give();
+  sensorLock.take();
+  loggedBodyIMUAccel.copyFrom(bodyIMU.getAccelStream());
+  loggedBodyIMUGyro.copyFrom(bodyIMU.getGyroStream());
+  loggedBodyAccel.copyFrom(bodyAccel.getDataStream());
+  loggedHeadFusion.copyFrom(headFusion.getDataStream());
+  loggedConcussion.copyFrom(&concussionStream);
+  sensorLock.give();
+}
+
+// hand back what the SD update didn't take. Samples that arrived meanwhile stay in front of it
+void restoreLoggedStreams(){
+  loadCellLock.take();
+  leftLoadCell.getDataStream()->restoreFrom(&loggedLeftLoadCell);
+  loadCellLock.give();
+  sensorLock.take();
+  bodyIMU.getAccelStream()->restoreFrom(&loggedBodyIMUAccel);
+  bodyIMU.getGyroStream()->restoreFrom(&loggedBodyIMUGyro);
+  bodyAccel.getDataStream()->restoreFrom(&loggedBodyAccel);
+  headFusion.getDataStream()->restoreFrom(&loggedHeadFusion);
+  concussionStream.restoreFrom(&loggedConcussion);
+  sensorLock.give();
+}
 
 // update the sd card data ONCE
 void updateSDCard(void * parameter){
   unsigned long time = 0;
+  bool recording = false;
+  sdUpdateMonitor.setPeriod(100000);
   for(;;){
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    if(impactDetected || concussionDetected){
-      if(sdCard.isFileOpen() && (millis() - time > 3000)){
-        sdCard.setFileNumber(sdCard.getFileNumber() + 1);
+    sdUpdateMonitor.delayUntilNext();
+    // only the triggers seen here are cleared when the recording ends, so one that lands later starts the next recording
+    bool sawImpact = impactDetected;
+    bool sawConcussion = concussionDetected;
+    sdLock.take();
+    // the windows are read every pass so a changed setting applies to the next recording
+    unsigned long postTrigger = config.get(CONFIG_POST_TRIGGER_MS);
+    sdCard.setPreTrigger(config.get(CONFIG_PRE_TRIGGER_MS) * imuSampleRate / 1000);
+    sdCard.setCheckpointInterval(config.get(CONFIG_CHECKPOINT_MS));
+    if(sawImpact || sawConcussion || manualRecording){
+      recording = true;
+      if(sdCard.isFileOpen() && (millis() - time > (unsigned long)config.get(CONFIG_SPLIT_MS))){
+        sdCard.nextFile();
         Serial.print("New recording started #: ");
         Serial.println(sdCard.getFileNumber());
       }
       
       time = millis();
     }
-    if(millis() - time < 2000){
+    sdLock.give();
+
+    if(millis() - time < postTrigger){
+      // the update works on copies, so the sensors and load cells are only held up for a copy each
+      copyLoggedStreams();
+      sdLock.take();
       sdCard.update(true);
+      sdLock.give();
+      restoreLoggedStreams();
     }
-    if(millis() - time >= 2000){
-      impactDetected = false;
-      concussionDetected = false;
-      sdCard.closeFile();
+    else{
+      double peak = 0;
+      double risk = 0;
+      // the event is tagged with the recording's peaks before they are cleared
+      sensorLock.take();
+      if(recording){
+        peak = headFusion.getPeaks()->magnitude();
+        risk = concussionProbability();
+      }
+      if(sawImpact){
+        impactDetected = false;
+      }
+      if(sawConcussion){
+        concussionDetected = false;
+      }
       bodyIMU.resetPeaks();
       bodyAccel.resetPeaks();
       headIMU.resetPeaks();
       headAccel.resetPeaks();
+      headFusion.resetPeaks();
+      sensorLock.give();
+      loadCellLock.take();
       leftLoadCell.resetPeaks();
       rightLoadCell.resetPeaks();
+      loadCellLock.give();
+
+      sdLock.take();
+      if(recording){
+        sdCard.endEvent(peak, risk);
+      }
+      else{
+        sdCard.closeFile();
+      }
+      sdLock.give();
+      recording = false;
+    }
+    sdUpdateMonitor.end();
+
+    // the sensors keep going while this runs and a recording that starts meanwhile begins once it is done
+    if(autotuneRequested && !recording){
+      runAutotune();
     }
-    xSemaphoreGive(mutex);
 
     // speed up this task while recording
-    if(millis() - time < 2000){
-      delay(2);
+    if(millis() - time < postTrigger){
+      sdUpdateMonitor.setPeriod(2000);
     }
     else{
-      delay(100);
+      sdUpdateMonitor.setPeriod(100000);
     }
   }
   vTaskDelete(NULL);
 }
 
+// write the blocks filled by updateSDCard to the card.
+// This is the only task that does file I/O while recording and it never takes a lock
+void writeSDCard(void * parameter){
+  for(;;){
+    sdCard.writeBlocks(portMAX_DELAY);
+  }
+  vTaskDelete(NULL);
+}
+
+// the impact being summarized for the sideline. Its peaks are its own, unlike the sensor peaks which last the whole recording
+ImpactSummary currentImpact;
+bool impactInProgress = false;
+unsigned long impactLastAbove = 0;
+int64_t impactStartTime = 0; // SyncClock::localTime when the impact started
+
+// follow the head acceleration through an impact and queue its summary once it's over
+// @pre the sensor lock is held and the head fusion has been updated
+void trackImpact(){
+  xyzData* accel = headFusion.getData();
+  double accelMag = accel->magnitude();
+  unsigned long now = millis();
+  if(accelMag > impactThresholdG()){
+    if(!impactInProgress){
+      impactInProgress = true;
+      currentImpact = ImpactSummary();
+      currentImpact.time = now;
+      impactStartTime = SyncClock::localTime();
+    }
+    impactLastAbove = now;
+    if(accelMag > currentImpact.peakLinear){
+      currentImpact.peakLinear = accelMag;
+      currentImpact.direction[0] = accel->x;
+      currentImpact.direction[1] = accel->y;
+      currentImpact.direction[2] = accel->z;
+    }
+  }
+  if(!impactInProgress){
+    return;
+  }
+  if(headIMU.isInitialized()){
+    currentImpact.peakRotational = max(currentImpact.peakRotational, headGyroMag());
+  }
+  // the load cells belong to their own task, so their latest published readings are used
+  if(leftLoadCell.isInitialized()){
+    currentImpact.peakLeftLoad = max(currentImpact.peakLeftLoad, (double)latestLeftLoad);
+  }
+  if(rightLoadCell.isInitialized()){
+    currentImpact.peakRightLoad = max(currentImpact.peakRightLoad, (double)latestRightLoad);
+  }
+  // a short dip under the threshold is still the same impact
+  if(now - impactLastAbove >= IMPACT_END_MS){
+    impactInProgress = false;
+    currentImpact.duration = impactLastAbove - currentImpact.time;
+    currentImpact.risk = concussionRisk(currentImpact.peakLinear, currentImpact.peakRotational);
+    currentImpact.syncedTime = syncClock.toHostTime(impactStartTime);
+    liveStream.push(LIVE_IMPACT, currentImpact.peakLinear, currentImpact.risk * 100, currentImpact.duration);
+    // the publish task does the Bluetooth writes and adds the impact to the exposure totals.
+    // If it has fallen this far behind, the impact is dropped
+    if(xQueueSend(impactQueue, &currentImpact, 0) == pdTRUE){
+      xTaskNotifyGive(publishImpactsTask);
+    }
+  }
+}
+
+// true while the detector behind each notice is over its threshold. Each notice is only raised from one task
+bool noticeAbove[NOTICE_COUNT] = {false};
+
+// queue a notice for the publish task the first time its detector goes over the threshold.
+// The peaks hold until a recording ends, so this is once per crossing instead of once per sample
+void raiseNotice(Notice notice, bool above){
+  if(above && !noticeAbove[notice] && xQueueSend(noticeQueue, &notice, 0) == pdTRUE){
+    xTaskNotifyGive(publishImpactsTask);
+  }
+  noticeAbove[notice] = above;
+}
+
+// send the impact summaries over Bluetooth and add them to the exposure totals. Writes can wait on the Bluetooth stack
+// and saving the totals waits on flash, so they happen here instead of in the IMU task. The notices are printed here
+// for the same reason
+void publishImpacts(void * parameter){
+  for(;;){
+    // sleep until an impact ends. While summaries are waiting for more to join them or for a client, check back soon
+    ulTaskNotifyTake(pdTRUE, impactPublisher.getPending() > 0 ? pdMS_TO_TICKS(IMPACT_COALESCE_MS) : portMAX_DELAY);
+    Notice notice;
+    while(xQueueReceive(noticeQueue, &notice, 0) == pdTRUE){
+      Serial.println(noticeMessages[notice]);
+    }
+    ImpactSummary summary;
+    while(xQueueReceive(impactQueue, &summary, 0) == pdTRUE){
+      impactPublisher.publish(summary, millis());
+      // every impact counts on its own, even several in one recording. The duration runs from the first sample over
+      // the threshold to the last, so one sample period is added for the last one. Saving the totals writes to flash
+      exposureLock.take();
+      exposure.recordImpact(summary.peakLinear, summary.risk, summary.duration / 1000.0 + 1.0 / imuSampleRate);
+      exposureLock.give();
+    }
+    impactPublisher.update(millis());
+  }
+  vTaskDelete(NULL);
+}
+
+// micros() when the timer last released the IMU task
+volatile unsigned long imuRelease = 0;
+
+// release the next IMU pass. The interrupt runs on core 1, where the IMU task attached it
+void IRAM_ATTR releaseIMU(){
+  imuRelease = micros();
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(updateIMUTask, &woken);
+  if(woken == pdTRUE){
+    portYIELD_FROM_ISR();
+  }
+}
+
 void updateIMU(void * parameter){
+  // a hardware timer keeps the period instead of the tick, so the rate holds to the us whatever Bluetooth is doing
+  // on the other core, and rates that aren't a whole number of ms come out right
+  uint32_t period = 1000000 / imuSampleRate;
+  imuMonitor.setPeriod(period);
+  hw_timer_t* timer = timerBegin(IMU_TIMER, 80, true); // 1us per count from the 80MHz APB clock
+  timerAttachInterrupt(timer, &releaseIMU, true);
+  timerAlarmWrite(timer, period, true);
+  timerAlarmEnable(timer);
   for(;;){
-    xSemaphoreTake(mutex, portMAX_DELAY);
+    // more than one release since the last pass means the ones between were skipped
+    uint32_t releases = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    imuMonitor.begin(imuRelease, releases - 1);
+    sensorLock.take();
     if(bodyIMU.isInitialized()){
       bodyIMU.update();
-      if(bodyIMU.getAccelPeak() > 5){
-        Serial.println("Impact Detected by Body IMU");
+      liveStream.push(LIVE_BODY_IMU_ACCEL, bodyIMU.getAccelData());
+      liveStream.push(LIVE_BODY_IMU_GYRO, bodyIMU.getGyroData());
+      bool above = bodyIMU.getAccelPeak() > impactThresholdG();
+      raiseNotice(NOTICE_BODY_IMU_IMPACT, above);
+      if(above){
         impactDetected = true;
       }
     }
     if(bodyAccel.isInitialized()){
       bodyAccel.update();
+      liveStream.push(LIVE_BODY_ACCEL, bodyAccel.getAccelData());
     }
     if(headIMU.isInitialized()){
       headIMU.update();
-      if(headIMU.getAccelPeak() > 5){
-        Serial.println("Impact Detected by Head IMU");
+      double *data = headIMU.getData();
+      latestHeadGyro = sqrt(data[3]*data[3] + data[4]*data[4] + data[5]*data[5]);
+      liveStream.push(LIVE_HEAD_IMU_ACCEL, headIMU.getAccelData());
+      liveStream.push(LIVE_HEAD_IMU_GYRO, headIMU.getGyroData());
+      bool above = headIMU.getAccelPeak() > impactThresholdG();
+      raiseNotice(NOTICE_HEAD_IMU_IMPACT, above);
+      if(above){
         impactDetected = true;
       }
     }
     if(headAccel.isInitialized()){
       headAccel.update();
+      liveStream.push(LIVE_HEAD_ACCEL, headAccel.getAccelData());
+    }
+    // fuse the head accelerometers once per sample so every consumer shares the same value
+    if(headIMU.isInitialized() || headAccel.isInitialized()){
+      headFusion.update(
+        headIMU.isInitialized() ? headIMU.getAccelData() : nullptr,
+        headAccel.isInitialized() ? headAccel.getAccelData() : nullptr,
+        headIMU.isInitialized() ? headIMU.getRawAccelData() : nullptr
+      );
+      liveStream.push(LIVE_HEAD_FUSION, headFusion.getData());
+      latestHeadAccel = headFusion.getData()->magnitude();
+      trackImpact();
     }
     
     // only calculate concussion probability if an impact has not yet been detected.
     // once it has been detected, calcualting that probability is someone else's job
-    if(headIMU.isInitialized() && headAccel.isInitialized()){
+    if(headIMU.isInitialized()){
       double prob = concussionProbability();
       concussionStream.prepend(prob);
+      latestConcussion = prob;
       // Serial.print("Probability: ");
       // Serial.println(prob,8);
-      if(prob > 0.25){
-        Serial.println("Concussion Detected");
+      bool above = prob > concussionThreshold();
+      raiseNotice(NOTICE_CONCUSSION, above);
+      if(above){
         concussionDetected = true;
       }
     }
-    xSemaphoreGive(mutex);
-    
-    // gives the ability for other tasks to run like bluetooth
-    delay(2);
+    sensorLock.give();
+    imuMonitor.end();
   }
 
   // in case the loop ever needs to exit, delete the task
@@ -265,125 +720,498 @@ void updateIMU(void * parameter){
 // update the load cell data
 void updateLoadCells(void * parameter){
   while(true){
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    if(leftLoadCell.isInitialized()){
-    leftLoadCell.setCurrentTemp(temp.getData()[0]);
+    // the period is read every pass so a changed LoadCellMs applies straight away
+    loadCellMonitor.setPeriod(config.get(CONFIG_LOAD_CELL_MS) * 1000);
+    loadCellMonitor.delayUntilNext();
+    // the HX711s are read before the lock is taken, and a pass without a new reading doesn't take it at all
+    bool leftNew = leftLoadCell.sample();
+    bool rightNew = rightLoadCell.sample();
+    if(!leftNew && !rightNew){
+      loadCellMonitor.end();
+      continue;
+    }
+    loadCellLock.take();
+    if(leftNew){
+      leftLoadCell.setCurrentTemp(latestTemperature);
+      uint32_t leftCount = leftLoadCell.getDataStream()->getTotalCount();
       leftLoadCell.update();
+      latestLeftLoad = leftLoadCell.getData();
+      // readings that don't calibrate to a positive weight aren't kept
+      if(leftLoadCell.getDataStream()->getTotalCount() != leftCount){
+        liveStream.push(LIVE_LEFT_CELL, leftLoadCell.getData());
+      }
       // TODO: Change this inequality when the load cell is calibrated
-      if(leftLoadCell.getPeaks() > 100000000){
-        Serial.println("Impact Detected by left load cell");
+      bool above = leftLoadCell.getPeaks() > config.get(CONFIG_LOAD_CELL_LIMIT);
+      raiseNotice(NOTICE_LEFT_CELL_IMPACT, above);
+      if(above){
         impactDetected = true;
       }
     }
-    if(rightLoadCell.isInitialized()){
-      rightLoadCell.setCurrentTemp(temp.getData()[0]);
+    if(rightNew){
+      rightLoadCell.setCurrentTemp(latestTemperature);
+      uint32_t rightCount = rightLoadCell.getDataStream()->getTotalCount();
       rightLoadCell.update();
-      if(rightLoadCell.getPeaks() > 100000000){
-        Serial.println("Impact Detected by right load cell");
+      latestRightLoad = rightLoadCell.getData();
+      if(rightLoadCell.getDataStream()->getTotalCount() != rightCount){
+        liveStream.push(LIVE_RIGHT_CELL, rightLoadCell.getData());
+      }
+      bool above = rightLoadCell.getPeaks() > config.get(CONFIG_LOAD_CELL_LIMIT);
+      raiseNotice(NOTICE_RIGHT_CELL_IMPACT, above);
+      if(above){
         impactDetected = true;
       }
     }
 
-    xSemaphoreGive(mutex);
-    // gives the ability for other tasks to run like bluetooth
-    delay(2);
+    loadCellLock.give();
+    loadCellMonitor.end();
   }
   // in case the loop ever needs to exit, delete the task
   vTaskDelete(updateLoadCellTask);
 }
 
+// only this task touches the temperature sensor after setup, so it needs no lock. The I2C bus it shares with the
+// body sensors is locked by the Wire library
 void updateTemp(void * parameter){
+  // We only need to get the temperature occasionally, so we can wait longer
+  tempMonitor.setPeriod(10000000);
   for(;;){
-    xSemaphoreTake(mutex, portMAX_DELAY);
+    tempMonitor.delayUntilNext();
     temp.update();
-    xSemaphoreGive(mutex);
-    // We only need to get the temperature occasionally, so we can wait longer
-    delay(10000);
+    latestTemperature = temp.getData()[0];
+    liveStream.push(LIVE_TEMP, latestTemperature);
+    tempMonitor.end();
   }
   vTaskDelete(updateTempTask);
 }
 
-void readSerial(void * parameter){
-  uint8_t argLength = 0;
-  int * args;
-  for(;;){
-    while(impactDetected || concussionDetected){
-      delay(2500);
-    }
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    argLength = 0;
-    serialMessage.update();
-    bleSerialRead.update();
-    if(serialMessage.isNewData()){
-      argLength = serialMessage.getArgsLength();
-      args = serialMessage.getArgs();
-      serialMessage.clearNewData();
-    }
+// replies that tools can wait for, sent on both ports like every other reply
+void respondOK(int command){
+  String reply = "!OK," + String(command) + ";";
+  Serial.println(reply);
+  bleSerial.println(reply);
+}
 
-    if(bleSerialRead.isNewData()){
-      argLength = bleSerialRead.getArgsLength();
-      args = bleSerialRead.getArgs();
-      bleSerialRead.clearNewData();
-    }
+void respondError(int command, const char* reason){
+  String reply = "!ERR," + String(command) + "," + reason + ";";
+  Serial.println(reply);
+  bleSerial.println(reply);
+}
+
+// find the fastest SD clock. Runs on the SD task so it can't race a recording
+void runAutotune(){
+  autotuneRequested = false;
+  // autotune restarts the card, so no transfer can have a file open meanwhile
+  fileTransfer.suspend();
+  sdLock.take();
+  bool tuned = sdCard.autotune(&Serial);
+  uint32_t frequency = sdCard.getFrequency();
+  sdLock.give();
+  fileTransfer.resume();
+  if(!tuned){
+    respondError(SD_AUTOTUNE, "SD autotune failed");
+    return;
+  }
+  // the per clock results only go to the USB port, so Bluetooth just gets the one that was picked
+  bleSerial.println("!SDClockSelected," + String(frequency) + ";");
+  respondOK(SD_AUTOTUNE);
+}
 
-    // TODO: Fill out commands here
-    if(argLength > 0){
-      switch(args[0]){
-        case 0:
-          Serial.println("Do something");
-          bleSerial.println("Do something");
+void printStatus(Print* out){
+  sensorLock.take();
+  long peakMilliG = headFusion.getPeaks()->magnitude() * 1000;
+  long riskPermille = concussionProbability() * 1000;
+  sensorLock.give();
+  // the rest are single words that are read without a lock
+  out->print("!Status,");
+  out->print(millis());
+  out->print(",");
+  out->print(sdCard.isFileOpen() ? 1 : 0);
+  out->print(",");
+  out->print(manualRecording ? 1 : 0);
+  out->print(",");
+  out->print(impactDetected ? 1 : 0);
+  out->print(",");
+  out->print(concussionDetected ? 1 : 0);
+  out->print(",");
+  out->print(peakMilliG);
+  out->print(",");
+  out->print(riskPermille);
+  out->print(",");
+  out->print(sdCard.getFileNumber());
+  out->print(",");
+  out->print(startup_errors);
+  out->print(",");
+  out->print(ESP.getFreeHeap());
+  out->println(";");
+}
+
+// defined with the task table below, after the tasks it lists
+void printTasks(Print* out);
+void resetTaskMonitors();
+
+// returns why a value can't be used for a setting, or nullptr if it can, for the limits RuntimeConfig can't know about
+const char* checkSetting(uint8_t id, int32_t value){
+  // the IMU timer counts whole us, so any other rate would drift from the rate written in the logs
+  if(id == CONFIG_IMU_RATE_HZ && (value <= 0 || 1000000 % value != 0)){
+    return "Rate must divide 1000000";
+  }
+  if(id == CONFIG_PRE_TRIGGER_MS && value > MAX_STREAM_LENGTH * 1000 / imuSampleRate){
+    return "Longer than the stream history";
+  }
+  return nullptr;
+}
+
+// run one command. Each command takes the lock of whatever it touches, so a command never holds up the sensors
+// unless it reads them
+// @param port the port the command came from
+// @param link the telemetry output on that port
+// @param receivedAt when the command arrived, from SerialMessage::getReceivedTime
+void runCommand(int * args, uint8_t argLength, Print* port, Telemetry* link, int64_t receivedAt){
+  if(argLength > 0){
+    switch(args[0]){
+      case CONFIG_GET:
+        if(argLength > 1){
+          if(args[1] < 0 || args[1] >= config.size()){
+            respondError(args[0], "Invalid setting");
+            break;
+          }
+          config.print(&Serial, args[1]);
+          config.print(&bleSerial, args[1]);
+        }
+        else{
+          for(uint8_t i = 0; i < config.size(); i++){
+            config.print(&Serial, i);
+            config.print(&bleSerial, i);
+          }
+        }
+        respondOK(args[0]);
+        break;
+      case CONFIG_SET:{
+        if(argLength < 3 || args[1] < 0 || args[1] >= config.size()){
+          respondError(args[0], "Invalid setting");
+          break;
+        }
+        const char* problem = checkSetting(args[1], args[2]);
+        if(problem != nullptr || !config.set(args[1], args[2])){
+          respondError(args[0], problem != nullptr ? problem : "Value out of range");
+          break;
+        }
+        config.print(&Serial, args[1]);
+        config.print(&bleSerial, args[1]);
+        respondOK(args[0]);
+        break;
+      }
+      case CONFIG_SAVE:
+        if(argLength > 1 && args[1] == 1){
+          config.resetDefaults();
+          respondOK(args[0]);
+          break;
+        }
+        if(!config.save()){
+          respondError(args[0], "Flash not available");
+          break;
+        }
+        respondOK(args[0]);
+        break;
+      case RECORD:
+        if(argLength < 2 || (args[1] != 0 && args[1] != 1)){
+          respondError(args[0], "Expected 0 or 1");
           break;
-        case 1:
-          Serial.println("Do something else");
-          bleSerial.println("Do something else");
+        }
+        // recording stops the post-trigger time after manual recording ends, like any other trigger
+        manualRecording = args[1] == 1;
+        respondOK(args[0]);
+        break;
+      case STATUS:
+        printStatus(&Serial);
+        printStatus(&bleSerial);
+        respondOK(args[0]);
+        break;
+      case FILE_LIST:
+        if(!fileTransfer.requestList(port, link)){
+          respondError(args[0], "Transfer not available");
+          break;
+        }
+        respondOK(args[0]);
+        break;
+      case FILE_GET:
+        // the CRC of what the host already has comes as a signed int. It's 0 when starting from the beginning
+        if(argLength < 3 || args[2] < 0 || !fileTransfer.requestFile(port, link, args[1], args[2], argLength > 3 ? (uint32_t)args[3] : 0)){
+          respondError(args[0], "List the files first or check the index");
           break;
-        default:
-          Serial.println("Invalid command");
-          bleSerial.println("Invalid command");
+        }
+        respondOK(args[0]);
+        break;
+      case FILE_CANCEL:
+        fileTransfer.cancel();
+        respondOK(args[0]);
+        break;
+      case RESTART:
+        respondOK(args[0]);
+        Serial.flush();
+        ESP.restart();
+        break;
+      case EXPOSURE_READ:
+        // the player APIs take a uint8_t, so a large number would wrap to a real player
+        if(argLength > 1 && (args[1] < 0 || args[1] >= EXPOSURE_MAX_PLAYERS)){
+          respondError(args[0], "Invalid player");
           break;
+        }
+        exposureLock.take();
+        if(argLength > 1){
+          ExposureRecord* record = exposure.getPlayerRecord(args[1]);
+          if(record == nullptr){
+            exposureLock.give();
+            respondError(args[0], "Invalid player");
+            break;
+          }
+          ExposureTracker::print(&Serial, String(args[1]), record);
+          ExposureTracker::print(&bleSerial, String(args[1]), record);
+          exposureLock.give();
+          respondOK(args[0]);
+          break;
+        }
+        ExposureTracker::print(&Serial, "Session", exposure.getSession());
+        ExposureTracker::print(&bleSerial, "Session", exposure.getSession());
+        ExposureTracker::print(&Serial, String(exposure.getPlayer()), exposure.getPlayerRecord(exposure.getPlayer()));
+        ExposureTracker::print(&bleSerial, String(exposure.getPlayer()), exposure.getPlayerRecord(exposure.getPlayer()));
+        exposureLock.give();
+        respondOK(args[0]);
+        break;
+      case EXPOSURE_RESET:
+        if(argLength > 1 && (args[1] < 0 || args[1] >= EXPOSURE_MAX_PLAYERS)){
+          respondError(args[0], "Invalid player");
+          break;
+        }
+        exposureLock.take();
+        if(argLength > 1){
+          exposure.resetPlayer(args[1]);
+        }
+        else{
+          exposure.resetSession();
+        }
+        exposureLock.give();
+        respondOK(args[0]);
+        break;
+      case SD_WRITER_STATS:
+        sdLock.take();
+        sdCard.printWriterStats(&Serial);
+        sdCard.printWriterStats(&bleSerial);
+        sdLock.give();
+        respondOK(args[0]);
+        break;
+      case SD_STATS:
+        sdLock.take();
+        sdCard.printStats(&Serial);
+        sdCard.printStats(&bleSerial);
+        sdLock.give();
+        respondOK(args[0]);
+        break;
+      case SD_AUTOTUNE:
+        // the SD task runs it between recordings and replies once it is done
+        autotuneRequested = true;
+        break;
+      case LIVE_STREAM:
+        if(argLength > 2){
+          if(args[1] < 0 || args[2] < 0 || args[2] > UINT16_MAX || !liveStream.subscribe(link, args[1], args[2])){
+            respondError(args[0], "Invalid stream");
+            break;
+          }
+        }
+        liveStream.printStreams(&Serial, link);
+        liveStream.printStreams(&bleSerial, link);
+        respondOK(args[0]);
+        break;
+      case LIVE_RATE_LIMIT:
+        if(argLength < 2 || args[1] < 0 || !liveStream.setRateLimit(link, args[1])){
+          respondError(args[0], "Invalid rate limit");
+          break;
+        }
+        respondOK(args[0]);
+        break;
+      case TELEMETRY_BAUD_SET:
+        if(argLength < 2 || args[1] <= 0 || args[1] > TELEMETRY_MAX_BAUD){
+          respondError(args[0], "Invalid baud rate");
+          break;
+        }
+        // the reply goes out at the old rate so the host knows when to switch
+        respondOK(args[0]);
+        Serial.flush();
+        Serial.updateBaudRate(args[1]);
+        break;
+      case PRINT_LOCK_STATS:
+        if(argLength > 1 && args[1] == 1){
+          for(InstrumentedLock* lock : locks){
+            lock->reset();
+          }
+          printLockHold.reset();
+          respondOK(args[0]);
+          break;
+        }
+        for(InstrumentedLock* lock : locks){
+          lock->print(&Serial);
+          lock->print(&bleSerial);
+        }
+        printLockHold.print(&Serial, "PrintLock");
+        printLockHold.print(&bleSerial, "PrintLock");
+        respondOK(args[0]);
+        break;
+      case IMPACT_SUMMARY_STATS:{
+        // the publish task changes these without a lock, but a count that is one behind doesn't matter here
+        String stats = "!ImpactSummaries," + String(impactPublisher.getSent()) + "," + String(impactPublisher.getPending()) + "," +
+          String(impactPublisher.getDropped()) + "," + String(impactPublisher.getFramesSent()) + "," + String(impactPublisher.getWriteFailures()) + ";";
+        Serial.println(stats);
+        bleSerial.println(stats);
+        respondOK(args[0]);
+        break;
       }
+      case TIME_SYNC:{
+        if(argLength == 1){
+          syncClock.print(&Serial);
+          syncClock.print(&bleSerial);
+          respondOK(args[0]);
+          break;
+        }
+        if(argLength < 4 || args[2] < 0 || args[3] < 0 || args[3] >= 1000000){
+          respondError(args[0], "Expected <seq>,<s>,<us>");
+          break;
+        }
+        // the reply is ready before the exchange starts so only the write happens after the device's send time is taken.
+        // It only goes back on the port that asked, since the other port's delay is different
+        char reply[24];
+        snprintf(reply, sizeof(reply), "!Sync,%d;", args[1]);
+        syncClock.request(args[1], (int64_t)args[2] * 1000000 + args[3], receivedAt);
+        port->println(reply);
+        break;
+      }
+      case TIME_SYNC_RESULT:{
+        SyncResult result;
+        if(argLength < 4 || args[2] < 0 || args[3] < 0 || args[3] >= 1000000 ||
+          !syncClock.complete(args[1], (int64_t)args[2] * 1000000 + args[3], &result)){
+          respondError(args[0], "No matching exchange");
+          break;
+        }
+        char reply[128];
+        snprintf(reply, sizeof(reply), "!SyncResult,%d,%lld,%u,%u,%lld,%d,%u;", args[1], (long long)result.offset,
+          (unsigned)result.delay, (unsigned)result.bound, (long long)result.predictionError, (int)result.driftPpb,
+          (unsigned)result.clockBound);
+        port->println(reply);
+        break;
+      }
+      case TASK_STATS:
+        if(argLength > 1 && args[1] == 1){
+          resetTaskMonitors();
+          respondOK(args[0]);
+          break;
+        }
+        printTasks(&Serial);
+        printTasks(&bleSerial);
+        respondOK(args[0]);
+        break;
+      case PLAYER_SELECT:{
+        if(argLength < 2 || args[1] < 0 || args[1] >= EXPOSURE_MAX_PLAYERS){
+          respondError(args[0], "Invalid player");
+          break;
+        }
+        exposureLock.take();
+        bool selected = exposure.setPlayer(args[1]);
+        exposureLock.give();
+        if(!selected){
+          respondError(args[0], "Invalid player");
+          break;
+        }
+        respondOK(args[0]);
+        break;
+      }
+      default:
+        respondError(args[0], "Unknown command");
+        break;
     }
-    
-    xSemaphoreGive(mutex);
+  }
+}
+
+void readSerial(void * parameter){
+  for(;;){
+    // sleep until the serial port or Bluetooth says bytes arrived. The timeout only matters if no bytes ever arrive
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(COMMAND_IDLE_MS));
+    // reading the messages doesn't touch anything shared, so it doesn't need a lock.
+    // Each update finds at most one message, so keep going until both ports are drained
+    bool handled;
+    do{
+      handled = false;
+      serialMessage.update();
+      if(serialMessage.isNewData()){
+        runCommand(serialMessage.getArgs(), serialMessage.getPopulatedArgs(), &Serial, &telemetry, serialMessage.getReceivedTime());
+        serialMessage.clearNewData();
+        handled = true;
+      }
+      bleSerialRead.update();
+      if(bleSerialRead.isNewData()){
+        runCommand(bleSerialRead.getArgs(), bleSerialRead.getPopulatedArgs(), &bleSerial, &bleTelemetry, bleSerialRead.getReceivedTime());
+        bleSerialRead.clearNewData();
+        handled = true;
+      }
+    }while(handled);
   }
   vTaskDelete(readSerialTask);
 }
 
-void printXYZDataStream(DataStream<xyzData>* stream, String header){
-  for(int i = 0; i < stream->size(); i++){
-    Serial.print(header);
-    Serial.print(",");
-    Serial.print(stream->peek(i).x, 3);
-    Serial.print(",");
-    Serial.print(stream->peek(i).y, 3);
-    Serial.print(",");
-    Serial.print(stream->peek(i).z, 3);
-    Serial.println(";");
-    while(impactDetected || concussionDetected){
-        xSemaphoreGive(mutex);
-        delay(2000);
-        xSemaphoreTake(mutex, portMAX_DELAY);
-    }
+// the streams are copied here under their lock and printed from the copy so acquisition never waits on the serial port
+xyzData xyzSnapshot[MAX_STREAM_LENGTH];
+double doubleSnapshot[MAX_STREAM_LENGTH];
+
+// copy a stream while holding the lock of the task that fills it
+// @returns the number of items copied, newest first
+template <typename ItemType>
+unsigned int snapshotStream(DataStream<ItemType>* stream, ItemType* snapshot, InstrumentedLock* lock){
+  lock->take();
+  unsigned long start = micros();
+  unsigned int count = stream->snapshot(snapshot, MAX_STREAM_LENGTH);
+  printLockHold.record(micros() - start);
+  lock->give();
+  return count;
+}
+
+// pause printing while an impact is detected
+void waitForImpactToEnd(){
+  while(impactDetected || concussionDetected){
+    delay(2000);
   }
+}
 
+void printXYZDataStream(DataStream<xyzData>* stream, const char* header){
+  unsigned int count = snapshotStream(stream, xyzSnapshot, &sensorLock);
+  // each line is formatted first so it goes out in one write
+  char line[96];
+  for(unsigned int i = 0; i < count; i++){
+    int length = snprintf(line, sizeof(line), "%s,%.3f,%.3f,%.3f;\r\n", header, xyzSnapshot[i].x, xyzSnapshot[i].y, xyzSnapshot[i].z);
+    Serial.write((const uint8_t*)line, min(length, (int)sizeof(line) - 1));
+    waitForImpactToEnd();
+  }
 }
 
-void printDoubleDataStream(DataStream<double>* stream, String header){
-  for(int i = 0; i < stream->size(); i++){
-    Serial.print(header);
-    Serial.print(",");
-    Serial.print(stream->peek(i), 3);
-    Serial.println(";");
-    while(impactDetected || concussionDetected){
-        xSemaphoreGive(mutex);
-        delay(2000);
-        xSemaphoreTake(mutex, portMAX_DELAY);
-    }
+void printDoubleDataStream(DataStream<double>* stream, const char* header){
+  unsigned int count = snapshotStream(stream, doubleSnapshot, &loadCellLock);
+  char line[48];
+  for(unsigned int i = 0; i < count; i++){
+    int length = snprintf(line, sizeof(line), "%s,%.3f;\r\n", header, doubleSnapshot[i]);
+    Serial.write((const uint8_t*)line, min(length, (int)sizeof(line) - 1));
+    waitForImpactToEnd();
   }
 }
 
+#ifdef USE_BINARY_TELEMETRY
+// send the samples pushed by the acquisition tasks as they arrive. Waiting on the serial port only holds up this task
 void printData(void * parameter){
-  xSemaphoreTake(mutex, portMAX_DELAY);
+  for(;;){
+    liveStream.update();
+  }
+
+  vTaskDelete(printDataTask);
+}
+#else
+void printData(void * parameter){
+  // the streams never move, so the pointers are taken once without a lock
   DataStream<xyzData>* bodyIMUAccelStream = bodyIMU.getAccelStream();
   DataStream<xyzData>* bodyIMUGyroStream = bodyIMU.getGyroStream();
   DataStream<xyzData>* headIMUAccelStream = headIMU.getAccelStream();
@@ -392,64 +1220,45 @@ void printData(void * parameter){
   DataStream<xyzData>* headAccelStream = headAccel.getDataStream();
   DataStream<double>* leftLoadCellStream = leftLoadCell.getDataStream();
   DataStream<double>* rightLoadCellStream = rightLoadCell.getDataStream();
-  xSemaphoreGive(mutex);
 
   for(;;){
-    // pause this task while an impact is detected
-    while(impactDetected || concussionDetected){
-        xSemaphoreGive(mutex);
-        delay(2000);
-        xSemaphoreTake(mutex, portMAX_DELAY);
-    }
-    xSemaphoreTake(mutex, portMAX_DELAY);
+    waitForImpactToEnd();
     printDoubleDataStream(leftLoadCellStream, "!LeftCell");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printDoubleDataStream(rightLoadCellStream, "!RightCell");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printXYZDataStream(headIMUGyroStream, "!HeadIMUGyro");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printXYZDataStream(bodyAccelStream, "!BodyAccel");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printXYZDataStream(headAccelStream, "!HeadAccel");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printXYZDataStream(bodyIMUGyroStream, "!BodyIMUGyro");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printXYZDataStream(headIMUAccelStream, "!HeadIMUAccel");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     printXYZDataStream(bodyIMUAccelStream, "!BodyIMUAccel");
-    xSemaphoreGive(mutex);
     delay(100);
-    xSemaphoreTake(mutex, portMAX_DELAY);
     Serial.print("!Temp,");
-    Serial.print(temp.getData()[0], 3);
+    Serial.print(latestTemperature, 3);
     Serial.println(";");
-    xSemaphoreGive(mutex);
     // We only need to get the temperature occasionally, so we can wait longer
     delay(2300);
   }
 
   vTaskDelete(printDataTask);
 }
+#endif
 
 void updateControlPanel(void * parameter){
+  controlPanelMonitor.setPeriod(30000);
   while(true){
-    xSemaphoreTake(mutex, portMAX_DELAY);
+    controlPanelMonitor.delayUntilNext();
+    panelLock.take();
     controlPanel.update();
     bool * buttonStates = controlPanel.getButtonStates();
+    bool recordPressed = buttonStates[2];
+    bool resetPressed = buttonStates[3];
     if(buttonStates[0]){
       Serial.println("Left button pressed");
       controlPanel.getButtonStates()[0] = false;
@@ -460,24 +1269,32 @@ void updateControlPanel(void * parameter){
       controlPanel.getButtonStates()[1] = false;
       digitalWrite(RIGHT_LED_PIN, !digitalRead(RIGHT_LED_PIN));
     }
-    if(buttonStates[2]){
+    buttonStates[2] = false;
+    buttonStates[3] = false;
+    panelLock.give();
+
+    // the sensors are only locked when a button needs them, so refreshing the LEDs never holds up acquisition
+    if(recordPressed){
       Serial.println("Record button pressed");
-      controlPanel.getButtonStates()[2] = false;
+      sensorLock.take();
       impactDetected = true;
+      sensorLock.give();
     }
-    if(buttonStates[3]){
+    if(resetPressed){
       Serial.println("Reset button pressed");
-      controlPanel.getButtonStates()[3] = false;
+      sensorLock.take();
       headAccel.resetPeaks();
       bodyAccel.resetPeaks();
-      leftLoadCell.resetPeaks();
-      rightLoadCell.resetPeaks();
       headIMU.resetPeaks();
       bodyIMU.resetPeaks();
+      headFusion.resetPeaks();
+      sensorLock.give();
+      loadCellLock.take();
+      leftLoadCell.resetPeaks();
+      rightLoadCell.resetPeaks();
+      loadCellLock.give();
     }
-
-    xSemaphoreGive(mutex);
-    delay(30);
+    controlPanelMonitor.end();
   }
   vTaskDelete(NULL);
 }
@@ -491,7 +1308,7 @@ void showStartupErrors(void * parameter){
   unsigned long timer = millis();
 
   while(!bootup_errors_shown){
-      xSemaphoreTake(mutex, portMAX_DELAY);
+      panelLock.take();
       // if all flags are false, stop trying to show bootup errors
       if(startup_errors & 255 == 0) bootup_errors_shown = true;
       //if the body IMU is not initialized, flash red once on error1 led
@@ -568,15 +1385,137 @@ void showStartupErrors(void * parameter){
           timer = millis();
         }
       }
-      xSemaphoreGive(mutex);
+      panelLock.give();
       delay(25);
     }
     vTaskDelete(NULL);
 }
 
+/**
+ * This section sets up how every task is scheduled
+*/
+// Bluetooth and the esp_timer task run on core 0, so acquisition has core 1 to itself, above every other task there.
+// The tasks that talk to the host share core 0 with the radio, below its priorities.
+// The temperature task stays on core 1 too, since it shares the I2C bus with the body sensors and a Bluetooth burst
+// could otherwise stall it while it has the bus. !30; prints how much of each stack was never used
+typedef struct{
+  TaskFunction_t function;
+  const char* name;
+  uint32_t stack; // in bytes
+  UBaseType_t priority;
+  BaseType_t core;
+  TaskHandle_t* handle;
+  TaskMonitor* monitor; // nullptr for tasks that wait on events instead of running on a period
+}TaskConfig;
+typedef enum{
+  TASK_IMU,
+  TASK_LOAD_CELLS,
+  TASK_SD_UPDATE,
+  TASK_SD_WRITE,
+  TASK_TEMP,
+  TASK_CONTROL_PANEL,
+  TASK_TRANSFER,
+  TASK_SERIAL,
+  TASK_PRINT,
+  TASK_PUBLISH,
+  TASK_STARTUP_ERRORS,
+  TASK_COUNT
+}TaskId;
+const TaskConfig taskConfigs[TASK_COUNT] = {
+  // function, name, stack, priority, core, handle, monitor
+  {updateIMU, "IMU", 10000, 20, 1, &updateIMUTask, &imuMonitor}, // only the IPC task is higher on core 1
+  // a pass only polls the HX711s, so this stays above the SD tasks but well below the IMU
+  {updateLoadCells, "LoadCells", 10000, 10, 1, &updateLoadCellTask, &loadCellMonitor},
+  {updateSDCard, "SDUpdate", 10000, 5, 1, &updateSDCardTask, &sdUpdateMonitor},
+  {writeSDCard, "SDWrite", 10000, 4, 1, &writeSDCardTask, nullptr},
+  {updateTemp, "Temp", 10000, 3, 1, &updateTempTask, &tempMonitor},
+  {updateControlPanel, "ControlPanel", 10000, 2, 1, &updateControlPanelTask, &controlPanelMonitor},
+  {transferFiles, "Transfer", 10000, tskIDLE_PRIORITY, 1, &transferFilesTask, nullptr}, // only uses spare time
+  {readSerial, "Serial", 10000, 3, 0, &readSerialTask, nullptr},
+  {printData, "Print", 10000, 2, 0, &printDataTask, nullptr},
+  {publishImpacts, "Publish", 10000, 2, 0, &publishImpactsTask, nullptr},
+  {showStartupErrors, "StartupErrors", 10000, 1, 0, &showStartupErrorsTask, nullptr}
+};
+
+void startTask(TaskId id){
+  const TaskConfig* task = &taskConfigs[id];
+  xTaskCreatePinnedToCore(task->function, task->name, task->stack, NULL, task->priority, task->handle, task->core);
+}
+
+// the counts are changed by the tasks without a lock, so a pass that ends during the reset can be left in
+void resetTaskMonitors(){
+  for(uint8_t i = 0; i < TASK_COUNT; i++){
+    if(taskConfigs[i].monitor != nullptr){
+      taskConfigs[i].monitor->reset();
+    }
+  }
+}
+
+// print the deadline stats of the periodic tasks and the stack left on every task
+void printTasks(Print* out){
+  for(uint8_t i = 0; i < TASK_COUNT; i++){
+    if(taskConfigs[i].monitor != nullptr){
+      taskConfigs[i].monitor->print(out);
+    }
+  }
+  for(uint8_t i = 0; i < TASK_COUNT; i++){
+    const TaskConfig* task = &taskConfigs[i];
+    // the startup error task deletes itself once it is done
+    if(*task->handle == NULL || (i == TASK_STARTUP_ERRORS && bootup_errors_shown)){
+      continue;
+    }
+    out->print("!Stack,");
+    out->print(task->name);
+    out->print(",");
+    out->print(task->core);
+    out->print(",");
+    out->print(task->priority);
+    out->print(",");
+    out->print(uxTaskGetStackHighWaterMark(*task->handle));
+    out->println(";");
+  }
+}
+
 void setup() {
-  // initialize serial communication at 115200 bits per second:
+  // load the saved settings first since the tasks and logs are set up with them
+  config.init();
+  // a saved rate from before the IMU timer was added may not suit it
+  if(checkSetting(CONFIG_IMU_RATE_HZ, config.get(CONFIG_IMU_RATE_HZ)) != nullptr){
+    config.set(CONFIG_IMU_RATE_HZ, IMU_SAMPLE_RATE);
+  }
+  imuSampleRate = config.get(CONFIG_IMU_RATE_HZ);
+
+  // initialize serial communication. Binary telemetry needs a faster link
+  #ifdef USE_BINARY_TELEMETRY
+  // the transmit buffer has to be set before begin
+  Serial.setTxBufferSize(TELEMETRY_TX_BUFFER);
+  Serial.begin(TELEMETRY_BAUD);
+  // only the print task sends frames, so it can wait for room in the buffer instead of blocking in write
+  telemetry.setFlowControl(true);
+  liveStream.init();
+  liveStream.setClock(&syncClock);
+  liveStream.registerStream(LIVE_LEFT_CELL, "LeftCell", 1, 0.1, 0);
+  liveStream.registerStream(LIVE_RIGHT_CELL, "RightCell", 1, 0.1, 0);
+  liveStream.registerStream(LIVE_HEAD_IMU_GYRO, "HeadIMUGyro", 3, 0.1, imuSampleRate);
+  liveStream.registerStream(LIVE_BODY_ACCEL, "BodyAccel", 3, 0.2, imuSampleRate);
+  liveStream.registerStream(LIVE_HEAD_ACCEL, "HeadAccel", 3, 0.2, imuSampleRate);
+  liveStream.registerStream(LIVE_BODY_IMU_GYRO, "BodyIMUGyro", 3, 0.1, imuSampleRate);
+  liveStream.registerStream(LIVE_HEAD_IMU_ACCEL, "HeadIMUAccel", 3, 0.001, imuSampleRate);
+  liveStream.registerStream(LIVE_BODY_IMU_ACCEL, "BodyIMUAccel", 3, 0.001, imuSampleRate);
+  liveStream.registerStream(LIVE_TEMP, "Temp", 1, 0.01, 0.1);
+  liveStream.registerStream(LIVE_HEAD_FUSION, "HeadFusion", 3, 0.01, imuSampleRate);
+  liveStream.registerEvent(LIVE_IMPACT, "Impact", 3, 0.1);
+  // USB gets every stream except the fused head acceleration, which is off until the host asks for it
+  liveStream.addClient(&telemetry);
+  for(uint8_t id = LIVE_LEFT_CELL; id <= LIVE_IMPACT; id++){
+    liveStream.subscribe(&telemetry, id, id == LIVE_HEAD_FUSION ? 0 : 1);
+  }
+  // Bluetooth is much slower, so it only gets the impacts until the tablet asks for more
+  liveStream.addClient(&bleTelemetry, BLUETOOTH_TELEMETRY_BYTES_PER_SECOND);
+  liveStream.subscribe(&bleTelemetry, LIVE_IMPACT, 1);
+  #else
   Serial.begin(115200);
+  #endif
   bleSerialRead.init(115200);
 
   // initialize everything for the control panel
@@ -601,6 +1540,7 @@ void setup() {
   Serial.println("Initializing Temperature Sensor");
   startup_errors |= (!temp.init()) << 2;
   temp.update();
+  latestTemperature = temp.getData()[0];
   
   Serial.println("Initializing Body IMU");
   startup_errors |= !bodyIMU.init();
@@ -612,6 +1552,24 @@ void setup() {
   Serial.println("Initializing Head Accelerometer");
   headAccel.init();
   
+  headFusion.setHeader(head, 4);
+  headFusion.init();
+
+  Serial.println("Configuring CFC filters");
+  // the filters for a kind of data share a class and rate, so either all of them configure or none do.
+  // The logs record the classes that did so the export tool doesn't filter the same data twice
+  float accelCFC = bodyIMU.setAccelFilter(ACCEL_CFC, imuSampleRate) ? ACCEL_CFC : 0;
+  float gyroCFC = bodyIMU.setGyroFilter(GYRO_CFC, imuSampleRate) ? GYRO_CFC : 0;
+  headIMU.setAccelFilter(ACCEL_CFC, imuSampleRate);
+  headIMU.setGyroFilter(GYRO_CFC, imuSampleRate);
+  bodyAccel.setFilter(ACCEL_CFC, imuSampleRate);
+  headAccel.setFilter(ACCEL_CFC, imuSampleRate);
+
+  #ifdef RUN_BENCHMARKS
+  Serial.print("CFC filter cost per 3 axis sample (us): ");
+  Serial.println(XYZFilter::benchmark(), 3);
+  #endif
+  
   Serial.println("Initializing Load Cell");
   leftLoadCell.init();
   rightLoadCell.init();
@@ -630,17 +1588,49 @@ void setup() {
   rightLoadCell.setLocation(rightShoulder, 9);
   
 
+  Serial.println("Loading impact exposure totals");
+  exposure.init();
+
   // initialize SD card
   Serial.println("Initializing SD Card");
   startup_errors |= (!sdCard.init()) << 3;
+  #ifdef RUN_BENCHMARKS
+  sdCard.benchmark(&Serial);
+  sdCard.benchmarkEncoding(&Serial);
+  #endif
   
   // register all sensor data streams
   concussionStream.setHeader(concussionLabel, strlen(concussionLabel));
-  sdCard.registerDoubleDatastream(leftLoadCell.getDataStream());
-  sdCard.registerXYZDatastream(bodyIMU.getAccelStream());
-  sdCard.registerXYZDatastream(bodyIMU.getGyroStream());
-  sdCard.registerXYZDatastream(bodyAccel.getDataStream());
-  sdCard.registerDoubleDatastream(&concussionStream);
+  // the scale is the resolution each stream is stored at in binary logs
+  // the SD card reads copies so it never holds a sensor lock while it writes. The copies pick up the headers
+  loggedLeftLoadCell.copyFrom(leftLoadCell.getDataStream());
+  loggedBodyIMUAccel.copyFrom(bodyIMU.getAccelStream());
+  loggedBodyIMUGyro.copyFrom(bodyIMU.getGyroStream());
+  loggedBodyAccel.copyFrom(bodyAccel.getDataStream());
+  loggedHeadFusion.copyFrom(headFusion.getDataStream());
+  loggedConcussion.copyFrom(&concussionStream);
+  sdCard.registerDoubleDatastream(&loggedLeftLoadCell, 0.001);
+  sdCard.registerXYZDatastream(&loggedBodyIMUAccel, 0.0001, imuSampleRate, accelCFC);
+  sdCard.registerXYZDatastream(&loggedBodyIMUGyro, 0.00001, imuSampleRate, gyroCFC);
+  sdCard.registerXYZDatastream(&loggedBodyAccel, 0.001, imuSampleRate, accelCFC);
+  // the fusion is made from the head accelerometers, so it is filtered the same way
+  sdCard.registerXYZDatastream(&loggedHeadFusion, 0.0001, imuSampleRate, accelCFC);
+  sdCard.registerDoubleDatastream(&loggedConcussion, 0.000001, imuSampleRate);
+  #ifdef USE_BINARY_LOG
+  sdCard.setFormat(LOG_BINARY);
+  #endif
+  #ifdef USE_DELTA_ENCODING
+  sdCard.setEncoding(ENCODING_DELTA);
+  #endif
+  sdCard.setPreallocation(SD_PREALLOCATE_BYTES);
+  // binary logs get a time record every SD_TIME_RECORD_MS and whenever the clock is synced
+  sdCard.setClock(&syncClock);
+  #ifdef USE_SESSION_FILE
+  sdCard.setSessionContainer(true);
+  #endif
+  #ifdef USE_JOURNALED_LOG
+  sdCard.setJournaled(true);
+  #endif
   
   leftLoadCell.resetPeaks();
   rightLoadCell.resetPeaks();
@@ -648,93 +1638,56 @@ void setup() {
   bodyAccel.resetPeaks();
   bodyIMU.resetPeaks();
   headIMU.resetPeaks();
+  headFusion.resetPeaks();
 
   sdCard.setDynamicFilename(dynamicFilename, extension);
+  // fix up the last log if the power went out while it was being written
+  sdCard.recover();
+  // the IMU task sends impacts to this task, so it has to exist first
+  Serial.println("Creating impact summary task");
+  impactQueue = xQueueCreate(IMPACT_QUEUE_LENGTH, sizeof(ImpactSummary));
+  noticeQueue = xQueueCreate(NOTICE_COUNT * 2, sizeof(Notice));
+  startTask(TASK_PUBLISH);
+
   Serial.println("Creating IMU task");
-  // Create an IMU task to run on core 0
-  // WARNING!! WiFi runs on core 0 and can crash the program if it doesn't get enough runtime. You need to use some yield() function to give it time to run
-  xTaskCreatePinnedToCore(
-    updateIMU, // task function
-    "Get IMU Data", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    1, // priority. Keep all task priorities at 1
-    &updateIMUTask, // task handle
-    0 // the core it should run on
-  );
-  
-  xTaskCreatePinnedToCore(
-    updateLoadCells, // task function
-    "Get IMU Data", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    1, // priority. Keep all task priorities at 1
-    &updateLoadCellTask, // task handle
-    0 // the core it should run on
-  );
+  startTask(TASK_IMU);
+  startTask(TASK_LOAD_CELLS);
 
   Serial.println("Creating Temperature task");
-  // create a task to get the temperature
-  xTaskCreatePinnedToCore(
-    updateTemp, // task function
-    "Get the current temperature", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    1, // priority. Keep all task priorities at 1
-    &updateTempTask, // task handle
-    1 // the core it should run on
-  );
+  startTask(TASK_TEMP);
 
   Serial.println("Creating Print task");
-  // create a task to print the data
-  xTaskCreatePinnedToCore(
-    printData, // task function
-    "Print the data", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    1, // priority. Keep all task priorities at 1
-    &printDataTask, // task handle
-    1 // the core it should run on
-  );
+  startTask(TASK_PRINT);
 
   Serial.println("Creating Serial task");
-  // create a task to read the serial port
-  xTaskCreatePinnedToCore(
-    readSerial, // task function
-    "Read the serial port", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    1, // priority. Keep all task priorities at 1
-    &readSerialTask, // task handle
-    1 // the core it should run on
-  );
+  startTask(TASK_SERIAL);
+  // wake the task when a command arrives instead of polling the ports
+  serialMessage.notifyOnReceive(readSerialTask);
+  bleSerialRead.notifyOnReceive(readSerialTask);
 
   Serial.println("Creating SD Card Task");
-  xTaskCreatePinnedToCore(
-    updateSDCard, // task function
-    "Update SD Card", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    1, // priority. Keep all task priorities at 1
-    &updateSDCardTask, // task handle
-    1 // the core it should run on
-  );
-
-  xTaskCreatePinnedToCore(
-    updateControlPanel, // task function
-    "Update the control panel", // task name
-    10000, // stack size in words or bytes, i've seen conflicting info
-    NULL, // parameters to give to the task function
-    2, // priority. Keep all task priorities at 1
-    &updateControlPanelTask, // task handle
-    1 // the core it should run on
-  );
+  startTask(TASK_SD_UPDATE);
+
+  Serial.println("Creating SD Card writer task");
+  sdCard.useBackgroundWriter(true);
+  startTask(TASK_SD_WRITE);
+
+  Serial.println("Creating file transfer task");
+  fileTransfer.init();
+  fileTransfer.setPauseCheck(recordingInProgress);
+  fileTransfer.setInUseCheck(fileInUse);
+  startTask(TASK_TRANSFER);
+
+  startTask(TASK_CONTROL_PANEL);
 
   // show any error codes.
-  xTaskCreatePinnedToCore(showStartupErrors, "", 10000, NULL, 1, &showStartupErrorsTask, 0); // start task to show startup errors
+  startTask(TASK_STARTUP_ERRORS);
+  // the control panel task is already refreshing the LEDs
+  panelLock.take();
   error1.set_low_color(green); // set error 1 back to green
   error2.set_low_color(green); // set error 2 back to green
   leds.update();
+  panelLock.give();
   Serial.println("Finished setup");
   
 }